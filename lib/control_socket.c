@@ -0,0 +1,298 @@
+/**
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "control_socket.h"
+#include "threads.h"
+
+/* Clients that send nothing for this long are disconnected, in milliseconds */
+#define CONTROL_IDLE_TIMEOUT 5000
+#define CONTROL_MAX_LINE 256
+#define CONTROL_MAX_REPLY 512
+
+struct control_socket_s {
+    logger_t *logger;
+    control_socket_handler_t handler;
+    void *cls;
+
+    int fd;
+    /* Written to by control_socket_destroy to wake up the thread */
+    int stop_pipe[2];
+    thread_handle_t thread;
+    char path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+    /* Identify the socket file we created, so that we never remove somebody else's */
+    dev_t dev;
+    ino_t ino;
+};
+
+/* Removes a socket left over from an unclean exit. Returns -1 if path is anything else or still in use */
+static int
+control_socket_remove_stale(logger_t *logger, const struct sockaddr_un *addr)
+{
+    struct stat st;
+
+    if (lstat(addr->sun_path, &st) < 0) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        logger_log(logger, LOGGER_ERR, "Could not check control socket %s: %s", addr->sun_path, strerror(errno));
+        return -1;
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        logger_log(logger, LOGGER_ERR, "Control socket path %s exists and is not a socket", addr->sun_path);
+        return -1;
+    }
+
+    // A socket somebody still listens on belongs to another instance
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int ret = connect(fd, (const struct sockaddr *) addr, sizeof(*addr));
+    int error = errno;
+    close(fd);
+    if (ret == 0) {
+        logger_log(logger, LOGGER_ERR, "Control socket %s is in use by another instance", addr->sun_path);
+        return -1;
+    }
+    if (error != ECONNREFUSED) {
+        logger_log(logger, LOGGER_ERR, "Could not check control socket %s: %s", addr->sun_path, strerror(error));
+        return -1;
+    }
+    unlink(addr->sun_path);
+    return 0;
+}
+
+/* Removes the socket file, unless it has been replaced since we created it */
+static void
+control_socket_remove(control_socket_t *control)
+{
+    struct stat st;
+
+    if (lstat(control->path, &st) == 0 && S_ISSOCK(st.st_mode) &&
+        st.st_dev == control->dev && st.st_ino == control->ino) {
+        unlink(control->path);
+    }
+}
+
+static int
+control_socket_send(int fd, const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t ret = send(fd, data, len, MSG_NOSIGNAL);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) return -1;
+        data += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+/* Serves one client until it disconnects, idles or the server stops. Returns 1 if the server stops */
+static int
+control_socket_serve(control_socket_t *control, int client_fd)
+{
+    char line[CONTROL_MAX_LINE];
+    char reply[CONTROL_MAX_REPLY];
+    size_t line_len = 0;
+    int overlong = 0;
+
+    while (1) {
+        struct pollfd fds[2] = {
+            { .fd = client_fd, .events = POLLIN },
+            { .fd = control->stop_pipe[0], .events = POLLIN },
+        };
+        int ret = poll(fds, 2, CONTROL_IDLE_TIMEOUT);
+        if (ret < 0 && errno == EINTR) continue;
+        if (fds[1].revents) return 1;
+        if (ret == 0) {
+            logger_log(control->logger, LOGGER_DEBUG, "Control client idle, disconnecting");
+            return 0;
+        }
+        if (ret < 0) return 0;
+
+        char buffer[CONTROL_MAX_LINE];
+        ssize_t len = recv(client_fd, buffer, sizeof(buffer), 0);
+        if (len < 0 && errno == EINTR) continue;
+        if (len <= 0) return 0;
+
+        for (ssize_t i = 0; i < len; i++) {
+            if (buffer[i] != '\n') {
+                // Lines that do not fit are answered with an error once they end
+                if (line_len < sizeof(line) - 1) {
+                    line[line_len++] = buffer[i];
+                } else {
+                    overlong = 1;
+                }
+                continue;
+            }
+            if (line_len > 0 && line[line_len - 1] == '\r') line_len--;
+            line[line_len] = '\0';
+
+            if (overlong) {
+                snprintf(reply, sizeof(reply), "error command too long");
+            } else if (line_len == 0) {
+                line_len = 0;
+                continue;
+            } else {
+                logger_log(control->logger, LOGGER_DEBUG, "Control command: %s", line);
+                reply[0] = '\0';
+                control->handler(control->cls, line, reply, sizeof(reply) - 1);
+            }
+            line_len = 0;
+            overlong = 0;
+
+            size_t reply_len = strlen(reply);
+            reply[reply_len++] = '\n';
+            if (control_socket_send(client_fd, reply, reply_len) < 0) {
+                return 0;
+            }
+        }
+    }
+}
+
+static THREAD_RETVAL
+control_socket_thread(void *arg)
+{
+    control_socket_t *control = arg;
+
+    assert(control);
+
+    while (1) {
+        struct pollfd fds[2] = {
+            { .fd = control->fd, .events = POLLIN },
+            { .fd = control->stop_pipe[0], .events = POLLIN },
+        };
+        if (poll(fds, 2, -1) < 0) {
+            continue;
+        }
+        if (fds[1].revents) {
+            break;
+        }
+        if (!fds[0].revents) {
+            continue;
+        }
+
+        int client_fd = accept(control->fd, NULL, NULL);
+        if (client_fd < 0) {
+            continue;
+        }
+        int stop = control_socket_serve(control, client_fd);
+        close(client_fd);
+        if (stop) {
+            break;
+        }
+    }
+    return 0;
+}
+
+control_socket_t *
+control_socket_init(logger_t *logger, const char *path, control_socket_handler_t handler, void *cls)
+{
+    control_socket_t *control;
+    struct sockaddr_un addr;
+
+    assert(logger);
+    assert(path);
+    assert(handler);
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        logger_log(logger, LOGGER_ERR, "Control socket path %s is too long", path);
+        return NULL;
+    }
+
+    control = calloc(1, sizeof(control_socket_t));
+    if (!control) {
+        return NULL;
+    }
+    control->logger = logger;
+    control->handler = handler;
+    control->cls = cls;
+    strcpy(control->path, path);
+
+    control->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (control->fd < 0) {
+        logger_log(logger, LOGGER_ERR, "Could not create control socket: %s", strerror(errno));
+        free(control);
+        return NULL;
+    }
+    fcntl(control->fd, F_SETFD, FD_CLOEXEC);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    // Left over if we did not exit cleanly last time
+    if (control_socket_remove_stale(logger, &addr) < 0) {
+        close(control->fd);
+        free(control);
+        return NULL;
+    }
+    if (bind(control->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        logger_log(logger, LOGGER_ERR, "Could not bind control socket %s: %s", path, strerror(errno));
+        close(control->fd);
+        free(control);
+        return NULL;
+    }
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        control->dev = st.st_dev;
+        control->ino = st.st_ino;
+    }
+    // Nobody but the owner may connect. Connecting fails until we listen, so the mode is set in time
+    if (chmod(path, S_IRUSR | S_IWUSR) < 0 || listen(control->fd, 4) < 0) {
+        logger_log(logger, LOGGER_ERR, "Could not listen on control socket %s: %s", path, strerror(errno));
+        close(control->fd);
+        control_socket_remove(control);
+        free(control);
+        return NULL;
+    }
+
+    if (pipe(control->stop_pipe) < 0) {
+        close(control->fd);
+        control_socket_remove(control);
+        free(control);
+        return NULL;
+    }
+
+    THREAD_CREATE(control->thread, control_socket_thread, control);
+    logger_log(logger, LOGGER_INFO, "Listening for control commands on %s", path);
+    return control;
+}
+
+void
+control_socket_destroy(control_socket_t *control)
+{
+    if (!control) {
+        return;
+    }
+
+    if (write(control->stop_pipe[1], "", 1) == 1 && control->thread) {
+        THREAD_JOIN(control->thread);
+    }
+    close(control->fd);
+    close(control->stop_pipe[0]);
+    close(control->stop_pipe[1]);
+    control_socket_remove(control);
+    free(control);
+}
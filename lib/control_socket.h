@@ -0,0 +1,52 @@
+/**
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+/*
+ * Local control socket for changing settings while the server runs. Clients
+ * connect to a Unix stream socket that only the owner may open and send one
+ * command per line, every line is answered with one line. Clients are served
+ * one after another from a single thread, and dropped after a few seconds
+ * without a command so that a stuck client cannot lock out the others.
+ */
+
+#ifndef CONTROL_SOCKET_H
+#define CONTROL_SOCKET_H
+
+#include <stddef.h>
+#include "logger.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct control_socket_s control_socket_t;
+
+/**
+ * Handles one command, without the line end, and writes the answer to reply.
+ * Called on the control socket thread.
+ */
+typedef void (*control_socket_handler_t)(void *cls, const char *command, char *reply, size_t reply_len);
+
+/**
+ * Replaces a stale socket file at path. Returns NULL if the socket cannot be created,
+ * if path is not a socket or if another instance still listens on it.
+ */
+control_socket_t *control_socket_init(logger_t *logger, const char *path, control_socket_handler_t handler, void *cls);
+
+/* Stops the thread and removes the socket file, if it still is the one we created */
+void control_socket_destroy(control_socket_t *control);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //CONTROL_SOCKET_H
@@ -214,6 +214,20 @@ x25519_key_t *x25519_key_from_raw(const unsigned char data[X25519_KEY_SIZE]) {
     return key;
 }
 
+x25519_key_t *x25519_key_from_private_raw(const unsigned char data[X25519_KEY_SIZE]) {
+    x25519_key_t *key;
+
+    key = malloc(sizeof(x25519_key_t));
+    assert(key);
+
+    key->pkey = EVP_PKEY_new_raw_private_key(EVP_PKEY_X25519, NULL, data, X25519_KEY_SIZE);
+    if (!key->pkey) {
+        handle_error(__func__);
+    }
+
+    return key;
+}
+
 void x25519_key_get_raw(unsigned char data[X25519_KEY_SIZE], const x25519_key_t *key) {
     assert(key);
     if (!EVP_PKEY_get_raw_public_key(key->pkey, data, &(size_t) {X25519_KEY_SIZE})) {
@@ -292,6 +306,27 @@ ed25519_key_t *ed25519_key_from_raw(const unsigned char data[ED25519_KEY_SIZE])
     return key;
 }
 
+ed25519_key_t *ed25519_key_from_private_raw(const unsigned char data[ED25519_KEY_SIZE]) {
+    ed25519_key_t *key;
+
+    key = malloc(sizeof(ed25519_key_t));
+    assert(key);
+
+    key->pkey = EVP_PKEY_new_raw_private_key(EVP_PKEY_ED25519, NULL, data, ED25519_KEY_SIZE);
+    if (!key->pkey) {
+        handle_error(__func__);
+    }
+
+    return key;
+}
+
+void ed25519_key_get_private_raw(unsigned char data[ED25519_KEY_SIZE], const ed25519_key_t *key) {
+    assert(key);
+    if (!EVP_PKEY_get_raw_private_key(key->pkey, data, &(size_t) {ED25519_KEY_SIZE})) {
+        handle_error(__func__);
+    }
+}
+
 void ed25519_key_get_raw(unsigned char data[ED25519_KEY_SIZE], const ed25519_key_t *key) {
     assert(key);
     if (!EVP_PKEY_get_raw_public_key(key->pkey, data, &(size_t) {ED25519_KEY_SIZE})) {
@@ -62,6 +62,7 @@ typedef struct x25519_key_s x25519_key_t;
 
 x25519_key_t *x25519_key_generate(void);
 x25519_key_t *x25519_key_from_raw(const unsigned char data[X25519_KEY_SIZE]);
+x25519_key_t *x25519_key_from_private_raw(const unsigned char data[X25519_KEY_SIZE]);
 void x25519_key_get_raw(unsigned char data[X25519_KEY_SIZE], const x25519_key_t *key);
 void x25519_key_destroy(x25519_key_t *key);
 
@@ -76,6 +77,9 @@ typedef struct ed25519_key_s ed25519_key_t;
 ed25519_key_t *ed25519_key_generate(void);
 ed25519_key_t *ed25519_key_from_raw(const unsigned char data[ED25519_KEY_SIZE]);
 void ed25519_key_get_raw(unsigned char data[ED25519_KEY_SIZE], const ed25519_key_t *key);
+/* The private key in raw form is the 32 byte seed it was generated from */
+ed25519_key_t *ed25519_key_from_private_raw(const unsigned char data[ED25519_KEY_SIZE]);
+void ed25519_key_get_private_raw(unsigned char data[ED25519_KEY_SIZE], const ed25519_key_t *key);
 /*
  * Note that this function does *not copy* the OpenSSL key but only the wrapper. The internal OpenSSL key is still the
  * same. Only the reference count is increased so destroying both the original and the copy is allowed.
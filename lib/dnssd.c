@@ -31,6 +31,7 @@
 
 #include "dnssdint.h"
 #include "dnssd.h"
+#include "mdns.h"
 #include "global.h"
 #include "compat.h"
 #include "utils.h"
@@ -39,6 +40,7 @@
 
 #define MAX_DEVICEID 18
 #define MAX_SERVNAME 256
+#define MAX_TXTRECORD 512
 
 #if defined(HAVE_LIBDL) && !defined(__APPLE__)
 # define USE_LIBDL 1
@@ -60,7 +62,6 @@
 # endif
 
 typedef struct _DNSServiceRef_t *DNSServiceRef;
-typedef union _TXTRecordRef_t { char PrivateData[16]; char *ForceNaturalAlignment; } TXTRecordRef;
 
 typedef uint32_t DNSServiceFlags;
 typedef int32_t  DNSServiceErrorType;
@@ -97,22 +98,6 @@ typedef DNSServiceErrorType (DNSSD_STDCALL *DNSServiceRegister_t)
                 void                                *context
         );
 typedef void (DNSSD_STDCALL *DNSServiceRefDeallocate_t)(DNSServiceRef sdRef);
-typedef void (DNSSD_STDCALL *TXTRecordCreate_t)
-        (
-                TXTRecordRef     *txtRecord,
-                uint16_t         bufferLen,
-                void             *buffer
-        );
-typedef void (DNSSD_STDCALL *TXTRecordDeallocate_t)(TXTRecordRef *txtRecord);
-typedef DNSServiceErrorType (DNSSD_STDCALL *TXTRecordSetValue_t)
-        (
-                TXTRecordRef     *txtRecord,
-                const char       *key,
-                uint8_t          valueSize,
-                const void       *value
-        );
-typedef uint16_t (DNSSD_STDCALL *TXTRecordGetLength_t)(const TXTRecordRef *txtRecord);
-typedef const void * (DNSSD_STDCALL *TXTRecordGetBytesPtr_t)(const TXTRecordRef *txtRecord);
 
 
 struct dnssd_s {
@@ -124,96 +109,98 @@ struct dnssd_s {
 
     DNSServiceRegister_t       DNSServiceRegister;
     DNSServiceRefDeallocate_t  DNSServiceRefDeallocate;
-    TXTRecordCreate_t          TXTRecordCreate;
-    TXTRecordSetValue_t        TXTRecordSetValue;
-    TXTRecordGetLength_t       TXTRecordGetLength;
-    TXTRecordGetBytesPtr_t     TXTRecordGetBytesPtr;
-    TXTRecordDeallocate_t      TXTRecordDeallocate;
 
-    TXTRecordRef raop_record;
-    TXTRecordRef airplay_record;
+    /* TXT records in wire format, built once at registration */
+    unsigned char raop_record[MAX_TXTRECORD];
+    int raop_record_len;
+    unsigned char airplay_record[MAX_TXTRECORD];
+    int airplay_record_len;
 
     DNSServiceRef raop_service;
     DNSServiceRef airplay_service;
 
+    /* Built-in responder, used instead of the dns_sd library if set */
+    mdns_t *mdns;
+    int raop_id;
+    int airplay_id;
+
     char *name;
     int name_len;
 
     char *hw_addr;
     int hw_addr_len;
+
+    uint64_t features;
 };
 
 
 
-dnssd_t *
-dnssd_init(const char* name, int name_len, const char* hw_addr, int hw_addr_len, int *error)
+static int
+dnssd_load_library(dnssd_t *dnssd, int *error)
 {
-    dnssd_t *dnssd;
-
-    if (error) *error = DNSSD_ERROR_NOERROR;
-
-    dnssd = calloc(1, sizeof(dnssd_t));
-    if (!dnssd) {
-        if (error) *error = DNSSD_ERROR_OUTOFMEM;
-        return NULL;
-    }
-
 #ifdef WIN32
     dnssd->module = LoadLibraryA("dnssd.dll");
 	if (!dnssd->module) {
 		if (error) *error = DNSSD_ERROR_LIBNOTFOUND;
-		free(dnssd);
-		return NULL;
+		return -1;
 	}
 	dnssd->DNSServiceRegister = (DNSServiceRegister_t)GetProcAddress(dnssd->module, "DNSServiceRegister");
 	dnssd->DNSServiceRefDeallocate = (DNSServiceRefDeallocate_t)GetProcAddress(dnssd->module, "DNSServiceRefDeallocate");
-	dnssd->TXTRecordCreate = (TXTRecordCreate_t)GetProcAddress(dnssd->module, "TXTRecordCreate");
-	dnssd->TXTRecordSetValue = (TXTRecordSetValue_t)GetProcAddress(dnssd->module, "TXTRecordSetValue");
-	dnssd->TXTRecordGetLength = (TXTRecordGetLength_t)GetProcAddress(dnssd->module, "TXTRecordGetLength");
-	dnssd->TXTRecordGetBytesPtr = (TXTRecordGetBytesPtr_t)GetProcAddress(dnssd->module, "TXTRecordGetBytesPtr");
-	dnssd->TXTRecordDeallocate = (TXTRecordDeallocate_t)GetProcAddress(dnssd->module, "TXTRecordDeallocate");
-
-	if (!dnssd->DNSServiceRegister || !dnssd->DNSServiceRefDeallocate || !dnssd->TXTRecordCreate ||
-	    !dnssd->TXTRecordSetValue || !dnssd->TXTRecordGetLength || !dnssd->TXTRecordGetBytesPtr ||
-	    !dnssd->TXTRecordDeallocate) {
+
+	if (!dnssd->DNSServiceRegister || !dnssd->DNSServiceRefDeallocate) {
 		if (error) *error = DNSSD_ERROR_PROCNOTFOUND;
 		FreeLibrary(dnssd->module);
-		free(dnssd);
-		return NULL;
+		return -1;
 	}
 #elif USE_LIBDL
     dnssd->module = dlopen("libdns_sd.so", RTLD_LAZY);
 	if (!dnssd->module) {
 		if (error) *error = DNSSD_ERROR_LIBNOTFOUND;
-		free(dnssd);
-		return NULL;
+		return -1;
 	}
 	dnssd->DNSServiceRegister = (DNSServiceRegister_t)dlsym(dnssd->module, "DNSServiceRegister");
 	dnssd->DNSServiceRefDeallocate = (DNSServiceRefDeallocate_t)dlsym(dnssd->module, "DNSServiceRefDeallocate");
-	dnssd->TXTRecordCreate = (TXTRecordCreate_t)dlsym(dnssd->module, "TXTRecordCreate");
-	dnssd->TXTRecordSetValue = (TXTRecordSetValue_t)dlsym(dnssd->module, "TXTRecordSetValue");
-	dnssd->TXTRecordGetLength = (TXTRecordGetLength_t)dlsym(dnssd->module, "TXTRecordGetLength");
-	dnssd->TXTRecordGetBytesPtr = (TXTRecordGetBytesPtr_t)dlsym(dnssd->module, "TXTRecordGetBytesPtr");
-	dnssd->TXTRecordDeallocate = (TXTRecordDeallocate_t)dlsym(dnssd->module, "TXTRecordDeallocate");
-
-	if (!dnssd->DNSServiceRegister || !dnssd->DNSServiceRefDeallocate || !dnssd->TXTRecordCreate ||
-	    !dnssd->TXTRecordSetValue || !dnssd->TXTRecordGetLength || !dnssd->TXTRecordGetBytesPtr ||
-	    !dnssd->TXTRecordDeallocate) {
+
+	if (!dnssd->DNSServiceRegister || !dnssd->DNSServiceRefDeallocate) {
 		if (error) *error = DNSSD_ERROR_PROCNOTFOUND;
 		dlclose(dnssd->module);
-		free(dnssd);
-		return NULL;
+		return -1;
 	}
 #else
     dnssd->DNSServiceRegister = &DNSServiceRegister;
     dnssd->DNSServiceRefDeallocate = &DNSServiceRefDeallocate;
-    dnssd->TXTRecordCreate = &TXTRecordCreate;
-    dnssd->TXTRecordSetValue = &TXTRecordSetValue;
-    dnssd->TXTRecordGetLength = &TXTRecordGetLength;
-    dnssd->TXTRecordGetBytesPtr = &TXTRecordGetBytesPtr;
-    dnssd->TXTRecordDeallocate = &TXTRecordDeallocate;
 #endif
 
+    return 0;
+}
+
+dnssd_t *
+dnssd_init(const char* name, int name_len, const char* hw_addr, int hw_addr_len, int builtin, int *error)
+{
+    dnssd_t *dnssd;
+
+    if (error) *error = DNSSD_ERROR_NOERROR;
+
+    dnssd = calloc(1, sizeof(dnssd_t));
+    if (!dnssd) {
+        if (error) *error = DNSSD_ERROR_OUTOFMEM;
+        return NULL;
+    }
+    dnssd->raop_id = -1;
+    dnssd->airplay_id = -1;
+
+    if (builtin) {
+        dnssd->mdns = mdns_init(NULL);
+        if (!dnssd->mdns) {
+            if (error) *error = DNSSD_ERROR_MDNS;
+            free(dnssd);
+            return NULL;
+        }
+    } else if (dnssd_load_library(dnssd, error) < 0) {
+        free(dnssd);
+        return NULL;
+    }
+
     dnssd->name_len = name_len;
     dnssd->name = calloc(1, name_len + 1);
     if (!dnssd->name) {
@@ -234,49 +221,107 @@ dnssd_init(const char* name, int name_len, const char* hw_addr, int hw_addr_len,
 
     memcpy(dnssd->hw_addr, hw_addr, hw_addr_len);
 
+    dnssd->features = strtoul(AIRPLAY_FEATURES, NULL, 16);
+
     return dnssd;
 }
 
+/* Features above bit 31 are advertised as a second, comma separated word */
+static void
+dnssd_format_features(dnssd_t *dnssd, char *features, int size)
+{
+    uint32_t features_low = dnssd->features & 0xffffffff;
+    uint32_t features_high = dnssd->features >> 32;
+    if (features_high) {
+        snprintf(features, size, "0x%X,0x%X", features_low, features_high);
+    } else {
+        snprintf(features, size, "0x%X", features_low);
+    }
+}
+
+void
+dnssd_set_airplay_features(dnssd_t *dnssd, int bit, int val)
+{
+    assert(dnssd);
+    assert(bit >= 0 && bit < 64);
+
+    if (val) {
+        dnssd->features |= (uint64_t) 1 << bit;
+    } else {
+        dnssd->features &= ~((uint64_t) 1 << bit);
+    }
+}
+
 void
 dnssd_destroy(dnssd_t *dnssd)
 {
     if (dnssd) {
+        if (dnssd->mdns) {
+            mdns_destroy(dnssd->mdns);
+        } else {
 #ifdef WIN32
-        FreeLibrary(dnssd->module);
+            FreeLibrary(dnssd->module);
 #elif USE_LIBDL
-        dlclose(dnssd->module);
+            dlclose(dnssd->module);
 #endif
+        }
+        free(dnssd->name);
+        free(dnssd->hw_addr);
         free(dnssd);
     }
 }
 
+/* Appends a key=value string to a TXT record in wire format */
+static int
+dnssd_txt_add(unsigned char *record, int *record_len, const char *key, const char *value)
+{
+    int key_len = strlen(key);
+    int value_len = strlen(value);
+    int len = key_len + 1 + value_len;
+
+    if (len > 255 || *record_len + 1 + len > MAX_TXTRECORD) {
+        return -1;
+    }
+    record[(*record_len)++] = len;
+    memcpy(record + *record_len, key, key_len);
+    record[*record_len + key_len] = '=';
+    memcpy(record + *record_len + key_len + 1, value, value_len);
+    *record_len += len;
+    return 0;
+}
+
 int
 dnssd_register_raop(dnssd_t *dnssd, unsigned short port)
 {
     char servname[MAX_SERVNAME];
+    char features[24];
 
     assert(dnssd);
 
-    dnssd->TXTRecordCreate(&dnssd->raop_record, 0, NULL);
-    dnssd->TXTRecordSetValue(&dnssd->raop_record, "ch", strlen(RAOP_CH), RAOP_CH);
-    dnssd->TXTRecordSetValue(&dnssd->raop_record, "cn", strlen(RAOP_CN), RAOP_CN);
-    dnssd->TXTRecordSetValue(&dnssd->raop_record, "da", strlen(RAOP_DA), RAOP_DA);
-    dnssd->TXTRecordSetValue(&dnssd->raop_record, "et", strlen(RAOP_ET), RAOP_ET);
-    dnssd->TXTRecordSetValue(&dnssd->raop_record, "vv", strlen(RAOP_VV), RAOP_VV);
-    dnssd->TXTRecordSetValue(&dnssd->raop_record, "ft", strlen(RAOP_FT), RAOP_FT);
-    dnssd->TXTRecordSetValue(&dnssd->raop_record, "am", strlen(GLOBAL_MODEL), GLOBAL_MODEL);
-    dnssd->TXTRecordSetValue(&dnssd->raop_record, "md", strlen(RAOP_MD), RAOP_MD);
-    dnssd->TXTRecordSetValue(&dnssd->raop_record, "rhd", strlen(RAOP_RHD), RAOP_RHD);
-    dnssd->TXTRecordSetValue(&dnssd->raop_record, "pw", strlen("false"), "false");
-    dnssd->TXTRecordSetValue(&dnssd->raop_record, "sr", strlen(RAOP_SR), RAOP_SR);
-    dnssd->TXTRecordSetValue(&dnssd->raop_record, "ss", strlen(RAOP_SS), RAOP_SS);
-    dnssd->TXTRecordSetValue(&dnssd->raop_record, "sv", strlen(RAOP_SV), RAOP_SV);
-    dnssd->TXTRecordSetValue(&dnssd->raop_record, "tp", strlen(RAOP_TP), RAOP_TP);
-    dnssd->TXTRecordSetValue(&dnssd->raop_record, "txtvers", strlen(RAOP_TXTVERS), RAOP_TXTVERS);
-    dnssd->TXTRecordSetValue(&dnssd->raop_record, "sf", strlen(RAOP_SF), RAOP_SF);
-    dnssd->TXTRecordSetValue(&dnssd->raop_record, "vs", strlen(RAOP_VS), RAOP_VS);
-    dnssd->TXTRecordSetValue(&dnssd->raop_record, "vn", strlen(RAOP_VN), RAOP_VN);
-    dnssd->TXTRecordSetValue(&dnssd->raop_record, "pk", strlen(RAOP_PK), RAOP_PK);
+    dnssd_format_features(dnssd, features, sizeof(features));
+
+    dnssd->raop_record_len = 0;
+    if (dnssd_txt_add(dnssd->raop_record, &dnssd->raop_record_len, "ch", RAOP_CH) ||
+        dnssd_txt_add(dnssd->raop_record, &dnssd->raop_record_len, "cn", RAOP_CN) ||
+        dnssd_txt_add(dnssd->raop_record, &dnssd->raop_record_len, "da", RAOP_DA) ||
+        dnssd_txt_add(dnssd->raop_record, &dnssd->raop_record_len, "et", RAOP_ET) ||
+        dnssd_txt_add(dnssd->raop_record, &dnssd->raop_record_len, "vv", RAOP_VV) ||
+        dnssd_txt_add(dnssd->raop_record, &dnssd->raop_record_len, "ft", features) ||
+        dnssd_txt_add(dnssd->raop_record, &dnssd->raop_record_len, "am", GLOBAL_MODEL) ||
+        dnssd_txt_add(dnssd->raop_record, &dnssd->raop_record_len, "md", RAOP_MD) ||
+        dnssd_txt_add(dnssd->raop_record, &dnssd->raop_record_len, "rhd", RAOP_RHD) ||
+        dnssd_txt_add(dnssd->raop_record, &dnssd->raop_record_len, "pw", "false") ||
+        dnssd_txt_add(dnssd->raop_record, &dnssd->raop_record_len, "sr", RAOP_SR) ||
+        dnssd_txt_add(dnssd->raop_record, &dnssd->raop_record_len, "ss", RAOP_SS) ||
+        dnssd_txt_add(dnssd->raop_record, &dnssd->raop_record_len, "sv", RAOP_SV) ||
+        dnssd_txt_add(dnssd->raop_record, &dnssd->raop_record_len, "tp", RAOP_TP) ||
+        dnssd_txt_add(dnssd->raop_record, &dnssd->raop_record_len, "txtvers", RAOP_TXTVERS) ||
+        dnssd_txt_add(dnssd->raop_record, &dnssd->raop_record_len, "sf", RAOP_SF) ||
+        dnssd_txt_add(dnssd->raop_record, &dnssd->raop_record_len, "vs", RAOP_VS) ||
+        dnssd_txt_add(dnssd->raop_record, &dnssd->raop_record_len, "vn", RAOP_VN) ||
+        dnssd_txt_add(dnssd->raop_record, &dnssd->raop_record_len, "pk", RAOP_PK)) {
+        return -3;
+    }
 
     /* Convert hardware address to string */
     if (utils_hwaddr_raop(servname, sizeof(servname), dnssd->hw_addr, dnssd->hw_addr_len) < 0) {
@@ -294,12 +339,17 @@ dnssd_register_raop(dnssd_t *dnssd, unsigned short port)
     strncat(servname, dnssd->name, sizeof(servname)-strlen(servname)-1);
 
     /* Register the service */
+    if (dnssd->mdns) {
+        dnssd->raop_id = mdns_register(dnssd->mdns, servname, "_raop._tcp", port,
+                                       dnssd->raop_record, dnssd->raop_record_len);
+        return dnssd->raop_id < 0 ? -3 : 1;
+    }
     dnssd->DNSServiceRegister(&dnssd->raop_service, 0, 0,
                               servname, "_raop._tcp",
                               NULL, NULL,
                               htons(port),
-                              dnssd->TXTRecordGetLength(&dnssd->raop_record),
-                              dnssd->TXTRecordGetBytesPtr(&dnssd->raop_record),
+                              dnssd->raop_record_len,
+                              dnssd->raop_record,
                               NULL, NULL);
 
 
@@ -310,9 +360,12 @@ int
 dnssd_register_airplay(dnssd_t *dnssd, unsigned short port)
 {
     char device_id[3 * MAX_HWADDR_LEN];
+    char features[24];
 
     assert(dnssd);
 
+    dnssd_format_features(dnssd, features, sizeof(features));
+
     /* Convert hardware address to string */
     if (utils_hwaddr_airplay(device_id, sizeof(device_id), dnssd->hw_addr, dnssd->hw_addr_len) < 0) {
         /* FIXME: handle better */
@@ -320,23 +373,30 @@ dnssd_register_airplay(dnssd_t *dnssd, unsigned short port)
     }
 
 
-    dnssd->TXTRecordCreate(&dnssd->airplay_record, 0, NULL);
-    dnssd->TXTRecordSetValue(&dnssd->airplay_record, "deviceid", strlen(device_id), device_id);
-    dnssd->TXTRecordSetValue(&dnssd->airplay_record, "features", strlen(AIRPLAY_FEATURES), AIRPLAY_FEATURES);
-    dnssd->TXTRecordSetValue(&dnssd->airplay_record, "flags", strlen(AIRPLAY_FLAGS), AIRPLAY_FLAGS);
-    dnssd->TXTRecordSetValue(&dnssd->airplay_record, "model", strlen(GLOBAL_MODEL), GLOBAL_MODEL);
-    dnssd->TXTRecordSetValue(&dnssd->airplay_record, "pk", strlen(AIRPLAY_PK), AIRPLAY_PK);
-    dnssd->TXTRecordSetValue(&dnssd->airplay_record, "pi", strlen(AIRPLAY_PI), AIRPLAY_PI);
-    dnssd->TXTRecordSetValue(&dnssd->airplay_record, "srcvers", strlen(AIRPLAY_SRCVERS), AIRPLAY_SRCVERS);
-    dnssd->TXTRecordSetValue(&dnssd->airplay_record, "vv", strlen(AIRPLAY_VV), AIRPLAY_VV);
+    dnssd->airplay_record_len = 0;
+    if (dnssd_txt_add(dnssd->airplay_record, &dnssd->airplay_record_len, "deviceid", device_id) ||
+        dnssd_txt_add(dnssd->airplay_record, &dnssd->airplay_record_len, "features", features) ||
+        dnssd_txt_add(dnssd->airplay_record, &dnssd->airplay_record_len, "flags", AIRPLAY_FLAGS) ||
+        dnssd_txt_add(dnssd->airplay_record, &dnssd->airplay_record_len, "model", GLOBAL_MODEL) ||
+        dnssd_txt_add(dnssd->airplay_record, &dnssd->airplay_record_len, "pk", AIRPLAY_PK) ||
+        dnssd_txt_add(dnssd->airplay_record, &dnssd->airplay_record_len, "pi", AIRPLAY_PI) ||
+        dnssd_txt_add(dnssd->airplay_record, &dnssd->airplay_record_len, "srcvers", AIRPLAY_SRCVERS) ||
+        dnssd_txt_add(dnssd->airplay_record, &dnssd->airplay_record_len, "vv", AIRPLAY_VV)) {
+        return -3;
+    }
 
     /* Register the service */
+    if (dnssd->mdns) {
+        dnssd->airplay_id = mdns_register(dnssd->mdns, dnssd->name, "_airplay._tcp", port,
+                                          dnssd->airplay_record, dnssd->airplay_record_len);
+        return dnssd->airplay_id < 0 ? -3 : 1;
+    }
     dnssd->DNSServiceRegister(&dnssd->airplay_service, 0, 0,
                               dnssd->name, "_airplay._tcp",
                               NULL, NULL,
                               htons(port),
-                              dnssd->TXTRecordGetLength(&dnssd->airplay_record),
-                              dnssd->TXTRecordGetBytesPtr(&dnssd->airplay_record),
+                              dnssd->airplay_record_len,
+                              dnssd->airplay_record,
                               NULL, NULL);
 
     return 1;
@@ -345,8 +405,8 @@ dnssd_register_airplay(dnssd_t *dnssd, unsigned short port)
 const char *
 dnssd_get_airplay_txt(dnssd_t *dnssd, int *length)
 {
-    *length = dnssd->TXTRecordGetLength(&dnssd->airplay_record);
-    return dnssd->TXTRecordGetBytesPtr(&dnssd->airplay_record);
+    *length = dnssd->airplay_record_len;
+    return (const char *) dnssd->airplay_record;
 }
 
 const char *
@@ -368,20 +428,17 @@ dnssd_unregister_raop(dnssd_t *dnssd)
 {
     assert(dnssd);
 
+    if (dnssd->mdns) {
+        mdns_unregister(dnssd->mdns, dnssd->raop_id);
+        dnssd->raop_id = -1;
+        return;
+    }
     if (!dnssd->raop_service) {
         return;
     }
 
-    /* Deallocate TXT record */
-    dnssd->TXTRecordDeallocate(&dnssd->raop_record);
-
     dnssd->DNSServiceRefDeallocate(dnssd->raop_service);
     dnssd->raop_service = NULL;
-
-    if (dnssd->airplay_service == NULL) {
-        free(dnssd->name);
-        free(dnssd->hw_addr);
-    }
 }
 
 void
@@ -389,18 +446,15 @@ dnssd_unregister_airplay(dnssd_t *dnssd)
 {
     assert(dnssd);
 
+    if (dnssd->mdns) {
+        mdns_unregister(dnssd->mdns, dnssd->airplay_id);
+        dnssd->airplay_id = -1;
+        return;
+    }
     if (!dnssd->airplay_service) {
         return;
     }
 
-    /* Deallocate TXT record */
-    dnssd->TXTRecordDeallocate(&dnssd->airplay_record);
-
     dnssd->DNSServiceRefDeallocate(dnssd->airplay_service);
     dnssd->airplay_service = NULL;
-
-    if (dnssd->raop_service == NULL) {
-        free(dnssd->name);
-        free(dnssd->hw_addr);
-    }
 }
\ No newline at end of file
@@ -16,10 +16,12 @@ extern "C" {
 #define DNSSD_ERROR_OUTOFMEM      2
 #define DNSSD_ERROR_LIBNOTFOUND   3
 #define DNSSD_ERROR_PROCNOTFOUND  4
+#define DNSSD_ERROR_MDNS          5
 
 typedef struct dnssd_s dnssd_t;
 
-DNSSD_API dnssd_t *dnssd_init(const char *name, int name_len, const char *hw_addr, int hw_addr_len, int *error);
+/* With builtin set, services are advertised by an in-process mDNS responder instead of the system's */
+DNSSD_API dnssd_t *dnssd_init(const char *name, int name_len, const char *hw_addr, int hw_addr_len, int builtin, int *error);
 
 DNSSD_API int dnssd_register_raop(dnssd_t *dnssd, unsigned short port);
 DNSSD_API int dnssd_register_airplay(dnssd_t *dnssd, unsigned short port);
@@ -27,6 +29,8 @@ DNSSD_API int dnssd_register_airplay(dnssd_t *dnssd, unsigned short port);
 DNSSD_API void dnssd_unregister_raop(dnssd_t *dnssd);
 DNSSD_API void dnssd_unregister_airplay(dnssd_t *dnssd);
 
+DNSSD_API void dnssd_set_airplay_features(dnssd_t *dnssd, int bit, int val);
+
 DNSSD_API const char *dnssd_get_airplay_txt(dnssd_t *dnssd, int *length);
 DNSSD_API const char *dnssd_get_name(dnssd_t *dnssd, int *length);
 DNSSD_API const char *dnssd_get_hw_addr(dnssd_t *dnssd, int *length);
@@ -193,6 +193,7 @@ bool ESP32Comm::configure_serial_port(int fd, int baud_rate) {
 }
 
 bool ESP32Comm::write_to_serial(const std::string& data) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
     ssize_t bytes_written = write(serial_fd_, data.c_str(), data.length());
     if (bytes_written < 0) {
         std::cerr << "Error writing to ESP32 serial port" << std::endl;
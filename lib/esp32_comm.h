@@ -4,6 +4,7 @@
 #include <string>
 #include <thread>
 #include <atomic>
+#include <mutex>
 #include <termios.h>
 
 class ESP32Comm {
@@ -46,8 +47,10 @@ private:
     std::atomic<bool> connected_;
     struct termios old_termios_;
     
-    int iphone_width_;
-    int iphone_height_;
+    std::atomic<int> iphone_width_;
+    std::atomic<int> iphone_height_;
+    // Commands come from the touch thread and the control socket
+    std::mutex write_mutex_;
     
     // Helper functions
     bool configure_serial_port(int fd, int baud_rate);
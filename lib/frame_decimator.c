@@ -0,0 +1,203 @@
+/**
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+
+#include "frame_decimator.h"
+
+/* Frame budget in microseconds per frame and second, so the accounting stays in integers */
+#define FRAME_COST 1000000LL
+/* Unused budget is kept for one frame at most, references decoded beyond it are paid back within one frame */
+#define MAX_CREDIT FRAME_COST
+#define MAX_DEBT (-FRAME_COST)
+/* Timestamp gaps beyond this are pauses or discontinuities and restart the accounting */
+#define MAX_FRAME_GAP 1000000
+#define STATS_INTERVAL 10000000
+
+typedef enum frame_class_e {
+    FRAME_KEY,         // IDR or IRAP picture, or parameter sets
+    FRAME_REFERENCE,   // referenced by later frames
+    FRAME_DISPOSABLE   // not referenced, may be dropped
+} frame_class_t;
+
+struct frame_decimator_s {
+    logger_t *logger;
+    int max_fps;
+
+    /* Budget in FRAME_COST units, a frame is decoded if at least half a frame is available */
+    int64_t credit;
+    uint64_t last_pts;
+    /* Highest H.265 temporal layer seen, lower layers may be referenced by higher ones */
+    int max_temporal_id;
+
+    /* Statistics of the current interval */
+    uint64_t stats_start;
+    uint64_t stats_cpu_start;
+    int frames;
+    int decoded;
+    int disposable;
+    /* Whether the last interval had any disposable frames, -1 before the first one */
+    int had_disposable;
+};
+
+static uint64_t
+frame_decimator_now(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static frame_class_t
+frame_decimator_classify(frame_decimator_t *decimator, video_codec_t codec, const unsigned char *data, int data_len)
+{
+    int has_slice = 0;
+    int pos = 0;
+
+    while (pos + 4 < data_len) {
+        int nal_len = (data[pos] << 24) | (data[pos + 1] << 16) | (data[pos + 2] << 8) | data[pos + 3];
+        const unsigned char *nal = data + pos + 4;
+        if (nal_len <= 0 || nal_len > data_len - pos - 4) {
+            return FRAME_KEY;
+        }
+        pos += nal_len + 4;
+
+        if (codec == VIDEO_CODEC_H265) {
+            if (nal_len < 2) return FRAME_KEY;
+            int type = (nal[0] >> 1) & 0x3f;
+            int temporal_id = (nal[1] & 0x07) - 1;
+            if (type >= 32) {
+                // Parameter sets and SEI are not slices, but parameter sets must reach the decoder
+                if (type <= 34) return FRAME_KEY;
+                continue;
+            }
+            if (type >= 16 && type <= 23) return FRAME_KEY;
+            if (temporal_id > decimator->max_temporal_id) {
+                decimator->max_temporal_id = temporal_id;
+            }
+            // Odd types up to 14 and all reserved ones are reference pictures
+            if (type > 14 || type % 2 || temporal_id < decimator->max_temporal_id) {
+                return FRAME_REFERENCE;
+            }
+        } else {
+            int type = nal[0] & 0x1f;
+            int ref_idc = (nal[0] >> 5) & 0x03;
+            if (type == 5 || type == 7 || type == 8) return FRAME_KEY;
+            if (type != 1) continue;
+            if (ref_idc) return FRAME_REFERENCE;
+        }
+        has_slice = 1;
+    }
+    return has_slice ? FRAME_DISPOSABLE : FRAME_REFERENCE;
+}
+
+static void
+frame_decimator_log_stats(frame_decimator_t *decimator, uint64_t now)
+{
+    double seconds = (now - decimator->stats_start) / 1000000.0;
+    uint64_t cpu = frame_decimator_now(CLOCK_PROCESS_CPUTIME_ID) - decimator->stats_cpu_start;
+    double received_fps = decimator->frames / seconds;
+    int had_disposable = decimator->disposable > 0;
+
+    logger_log(decimator->logger, LOGGER_INFO,
+               "Frame decimation: %.1f fps received, %.1f fps decoded (%d%% fewer), %d%% non-reference frames, process CPU %d%%",
+               received_fps, decimator->decoded / seconds,
+               100 - 100 * decimator->decoded / decimator->frames,
+               100 * decimator->disposable / decimator->frames,
+               (int) (100 * cpu / (now - decimator->stats_start)));
+
+    // Only worth a warning if the stream is actually faster than wanted
+    if (!had_disposable && decimator->had_disposable != 0 && received_fps > decimator->max_fps + 1) {
+        logger_log(decimator->logger, LOGGER_WARNING,
+                   "Frame decimation: the sender encodes every frame as a reference, all of them have to be decoded");
+    } else if (had_disposable && decimator->had_disposable == 0) {
+        logger_log(decimator->logger, LOGGER_INFO,
+                   "Frame decimation: the sender encodes non-reference frames again, decimating to %d fps", decimator->max_fps);
+    }
+    decimator->had_disposable = had_disposable;
+}
+
+frame_decimator_t *
+frame_decimator_init(logger_t *logger, int max_fps)
+{
+    frame_decimator_t *decimator;
+
+    assert(logger);
+    assert(max_fps > 0);
+
+    decimator = calloc(1, sizeof(frame_decimator_t));
+    if (!decimator) {
+        return NULL;
+    }
+    decimator->logger = logger;
+    decimator->max_fps = max_fps;
+    decimator->had_disposable = -1;
+    frame_decimator_reset(decimator);
+    return decimator;
+}
+
+void
+frame_decimator_reset(frame_decimator_t *decimator)
+{
+    assert(decimator);
+    decimator->credit = MAX_CREDIT;
+    decimator->last_pts = 0;
+    decimator->max_temporal_id = 0;
+}
+
+int
+frame_decimator_keep(frame_decimator_t *decimator, video_codec_t codec,
+                     const unsigned char *data, int data_len, uint64_t pts)
+{
+    assert(decimator);
+
+    frame_class_t frame_class = frame_decimator_classify(decimator, codec, data, data_len);
+
+    // Every microsecond of stream time earns max_fps microseconds of budget
+    if (decimator->last_pts && pts > decimator->last_pts && pts - decimator->last_pts < MAX_FRAME_GAP) {
+        decimator->credit += (int64_t) (pts - decimator->last_pts) * decimator->max_fps;
+        if (decimator->credit > MAX_CREDIT) decimator->credit = MAX_CREDIT;
+    } else {
+        decimator->credit = MAX_CREDIT;
+    }
+    decimator->last_pts = pts;
+
+    int keep = frame_class != FRAME_DISPOSABLE || decimator->credit >= FRAME_COST / 2;
+    if (keep) {
+        decimator->credit -= FRAME_COST;
+        if (decimator->credit < MAX_DEBT) decimator->credit = MAX_DEBT;
+    }
+
+    uint64_t now = frame_decimator_now(CLOCK_MONOTONIC);
+    if (!decimator->stats_start) {
+        decimator->stats_start = now;
+        decimator->stats_cpu_start = frame_decimator_now(CLOCK_PROCESS_CPUTIME_ID);
+    }
+    decimator->frames++;
+    decimator->decoded += keep;
+    decimator->disposable += frame_class == FRAME_DISPOSABLE;
+    if (now - decimator->stats_start >= STATS_INTERVAL) {
+        frame_decimator_log_stats(decimator, now);
+        decimator->stats_start = now;
+        decimator->stats_cpu_start = frame_decimator_now(CLOCK_PROCESS_CPUTIME_ID);
+        decimator->frames = decimator->decoded = decimator->disposable = 0;
+    }
+    return keep;
+}
+
+void
+frame_decimator_destroy(frame_decimator_t *decimator)
+{
+    free(decimator);
+}
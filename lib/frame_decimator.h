@@ -0,0 +1,47 @@
+/**
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+/*
+ * Lowers the frame rate of the mirror stream before it reaches the decoder,
+ * for receivers that cannot decode or display the full rate anyway. Only
+ * frames that no other frame references are dropped, so the picture never
+ * breaks up. They are recognized from the NAL unit headers alone: nal_ref_idc
+ * for H.264 and the sub-layer non-reference NAL types for H.265. If the sender
+ * encodes every frame as a reference, nothing can be dropped and the stream
+ * passes unchanged.
+ */
+
+#ifndef FRAME_DECIMATOR_H
+#define FRAME_DECIMATOR_H
+
+#include <stdint.h>
+#include "logger.h"
+#include "stream.h"
+
+typedef struct frame_decimator_s frame_decimator_t;
+
+frame_decimator_t *frame_decimator_init(logger_t *logger, int max_fps);
+
+/* Forgets the stream structure, call with every new codec configuration */
+void frame_decimator_reset(frame_decimator_t *decimator);
+
+/**
+ * Whether the frame should be decoded. data is the access unit as sent by the
+ * sender, with a 4 byte big endian length before each NAL unit, and pts is in
+ * microseconds.
+ */
+int frame_decimator_keep(frame_decimator_t *decimator, video_codec_t codec,
+                         const unsigned char *data, int data_len, uint64_t pts);
+
+void frame_decimator_destroy(frame_decimator_t *decimator);
+
+#endif //FRAME_DECIMATOR_H
@@ -16,6 +16,8 @@
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "httpd.h"
 #include "netutils.h"
@@ -23,12 +25,22 @@
 #include "compat.h"
 #include "logger.h"
 
+/* Number of threads handling slow requests */
+#define HTTPD_WORKER_COUNT 2
+
 struct http_connection_s {
     int connected;
 
     int socket_fd;
     void *user_data;
     http_request_t *request;
+
+    /* Set while the request is handled by a worker, the socket is not read meanwhile */
+    int busy;
+
+    /* These variables only edited mutex locked */
+    int completed;
+    http_response_t *response;
 };
 typedef struct http_connection_s http_connection_t;
 
@@ -49,6 +61,18 @@ struct httpd_s {
     /* Server fds for accepting connections */
     int server_fd4;
     int server_fd6;
+
+    /* Worker threads and their queue of connections with a slow request */
+    thread_handle_t workers[HTTPD_WORKER_COUNT];
+    int workers_running;
+    mutex_handle_t worker_mutex;
+    cond_handle_t worker_cond;
+    http_connection_t **jobs;
+    int job_first;
+    int job_count;
+
+    /* Written to by workers to wake up the main thread when a response is ready */
+    int wake_fds[2];
 };
 
 httpd_t *
@@ -72,6 +96,15 @@ httpd_init(logger_t *logger, httpd_callbacks_t *callbacks, int max_connections)
         free(httpd);
         return NULL;
     }
+    /* Every connection has at most one request in flight */
+    httpd->jobs = calloc(max_connections, sizeof(http_connection_t *));
+    if (!httpd->jobs) {
+        free(httpd->connections);
+        free(httpd);
+        return NULL;
+    }
+    MUTEX_CREATE(httpd->worker_mutex);
+    COND_CREATE(httpd->worker_cond);
 
     /* Use the logger provided */
     httpd->logger = logger;
@@ -92,6 +125,9 @@ httpd_destroy(httpd_t *httpd)
     if (httpd) {
         httpd_stop(httpd);
 
+        MUTEX_DESTROY(httpd->worker_mutex);
+        COND_DESTROY(httpd->worker_cond);
+        free(httpd->jobs);
         free(httpd->connections);
         free(httpd);
     }
@@ -174,6 +210,12 @@ httpd_remove_connection(httpd_t *httpd, http_connection_t *connection)
         http_request_destroy(connection->request);
         connection->request = NULL;
     }
+    if (connection->response) {
+        http_response_destroy(connection->response);
+        connection->response = NULL;
+    }
+    connection->busy = 0;
+    connection->completed = 0;
     httpd->callbacks.conn_destroy(connection->user_data);
     shutdown(connection->socket_fd, SHUT_WR);
     closesocket(connection->socket_fd);
@@ -181,6 +223,164 @@ httpd_remove_connection(httpd_t *httpd, http_connection_t *connection)
     httpd->open_connections--;
 }
 
+static THREAD_RETVAL
+httpd_worker_thread(void *arg)
+{
+    httpd_t *httpd = arg;
+
+    assert(httpd);
+
+    while (1) {
+        http_connection_t *connection;
+        http_response_t *response = NULL;
+
+        MUTEX_LOCK(httpd->worker_mutex);
+        while (httpd->workers_running && !httpd->job_count) {
+            pthread_cond_wait(&httpd->worker_cond, &httpd->worker_mutex);
+        }
+        if (!httpd->workers_running) {
+            MUTEX_UNLOCK(httpd->worker_mutex);
+            break;
+        }
+        connection = httpd->jobs[httpd->job_first];
+        httpd->job_first = (httpd->job_first + 1) % httpd->max_connections;
+        httpd->job_count--;
+        MUTEX_UNLOCK(httpd->worker_mutex);
+
+        httpd->callbacks.conn_request(connection->user_data, connection->request, &response);
+
+        MUTEX_LOCK(httpd->worker_mutex);
+        connection->response = response;
+        connection->completed = 1;
+        MUTEX_UNLOCK(httpd->worker_mutex);
+
+        if (write(httpd->wake_fds[1], "", 1) < 0) {
+            /* The pipe is full, so the main thread is woken up anyway */
+        }
+    }
+
+    return 0;
+}
+
+static int
+httpd_start_workers(httpd_t *httpd)
+{
+    if (pipe(httpd->wake_fds) == -1) {
+        return -1;
+    }
+    fcntl(httpd->wake_fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(httpd->wake_fds[1], F_SETFL, O_NONBLOCK);
+
+    httpd->job_first = 0;
+    httpd->job_count = 0;
+    httpd->workers_running = 1;
+    for (int i = 0; i < HTTPD_WORKER_COUNT; i++) {
+        THREAD_CREATE(httpd->workers[i], httpd_worker_thread, httpd);
+    }
+    return 0;
+}
+
+/* Waits for the requests in progress, queued ones are dropped with their connection */
+static void
+httpd_stop_workers(httpd_t *httpd)
+{
+    MUTEX_LOCK(httpd->worker_mutex);
+    httpd->workers_running = 0;
+    pthread_cond_broadcast(&httpd->worker_cond);
+    MUTEX_UNLOCK(httpd->worker_mutex);
+
+    for (int i = 0; i < HTTPD_WORKER_COUNT; i++) {
+        if (httpd->workers[i]) {
+            THREAD_JOIN(httpd->workers[i]);
+        }
+    }
+    close(httpd->wake_fds[0]);
+    close(httpd->wake_fds[1]);
+}
+
+static void
+httpd_queue_request(httpd_t *httpd, http_connection_t *connection)
+{
+    connection->busy = 1;
+
+    MUTEX_LOCK(httpd->worker_mutex);
+    httpd->jobs[(httpd->job_first + httpd->job_count) % httpd->max_connections] = connection;
+    httpd->job_count++;
+    COND_SIGNAL(httpd->worker_cond);
+    MUTEX_UNLOCK(httpd->worker_mutex);
+}
+
+/* Sends the response to a finished request, returns -1 if the connection was removed */
+static int
+httpd_send_response(httpd_t *httpd, http_connection_t *connection, http_response_t *response)
+{
+    int removed = 0;
+
+    http_request_destroy(connection->request);
+    connection->request = NULL;
+
+    if (response) {
+        const char *data;
+        int datalen;
+        int written;
+        int ret;
+
+        /* Get response data and datalen */
+        data = http_response_get_data(response, &datalen);
+
+        written = 0;
+        while (written < datalen) {
+            ret = send(connection->socket_fd, data+written, datalen-written, 0);
+            if (ret == -1) {
+                logger_log(httpd->logger, LOGGER_ERR, "httpd error in sending data");
+                break;
+            }
+            written += ret;
+        }
+
+        if (http_response_get_disconnect(response)) {
+            logger_log(httpd->logger, LOGGER_INFO, "Disconnecting on software request");
+            httpd_remove_connection(httpd, connection);
+            removed = 1;
+        }
+    } else {
+        logger_log(httpd->logger, LOGGER_WARNING, "httpd didn't get response");
+    }
+    http_response_destroy(response);
+    return removed ? -1 : 0;
+}
+
+/* Sends the responses that workers have finished */
+static void
+httpd_complete_requests(httpd_t *httpd)
+{
+    char buffer[64];
+    int i;
+
+    while (read(httpd->wake_fds[0], buffer, sizeof(buffer)) > 0);
+
+    for (i=0; i<httpd->max_connections; i++) {
+        http_connection_t *connection = &httpd->connections[i];
+        http_response_t *response;
+
+        if (!connection->connected || !connection->busy) {
+            continue;
+        }
+        MUTEX_LOCK(httpd->worker_mutex);
+        if (!connection->completed) {
+            MUTEX_UNLOCK(httpd->worker_mutex);
+            continue;
+        }
+        response = connection->response;
+        connection->response = NULL;
+        connection->completed = 0;
+        MUTEX_UNLOCK(httpd->worker_mutex);
+
+        connection->busy = 0;
+        httpd_send_response(httpd, connection, response);
+    }
+}
+
 static THREAD_RETVAL
 httpd_thread(void *arg)
 {
@@ -209,6 +409,8 @@ httpd_thread(void *arg)
 
         /* Get the correct nfds value and set rfds */
         FD_ZERO(&rfds);
+        FD_SET(httpd->wake_fds[0], &rfds);
+        nfds = httpd->wake_fds[0]+1;
         if (httpd->open_connections < httpd->max_connections) {
             if (httpd->server_fd4 != -1) {
                 FD_SET(httpd->server_fd4, &rfds);
@@ -225,7 +427,7 @@ httpd_thread(void *arg)
         }
         for (i=0; i<httpd->max_connections; i++) {
             int socket_fd;
-            if (!httpd->connections[i].connected) {
+            if (!httpd->connections[i].connected || httpd->connections[i].busy) {
                 continue;
             }
             socket_fd = httpd->connections[i].socket_fd;
@@ -244,6 +446,10 @@ httpd_thread(void *arg)
             break;
         }
 
+        if (FD_ISSET(httpd->wake_fds[0], &rfds)) {
+            httpd_complete_requests(httpd);
+        }
+
         if (httpd->open_connections < httpd->max_connections &&
             httpd->server_fd4 != -1 && FD_ISSET(httpd->server_fd4, &rfds)) {
             ret = httpd_accept_connection(httpd, httpd->server_fd4, 0);
@@ -267,7 +473,7 @@ httpd_thread(void *arg)
         for (i=0; i<httpd->max_connections; i++) {
             http_connection_t *connection = &httpd->connections[i];
 
-            if (!connection->connected) {
+            if (!connection->connected || connection->busy) {
                 continue;
             }
             if (!FD_ISSET(connection->socket_fd, &rfds)) {
@@ -298,45 +504,26 @@ httpd_thread(void *arg)
 
             /* If request is finished, process and deallocate */
             if (http_request_is_complete(connection->request)) {
+                if (httpd->callbacks.conn_request_is_slow &&
+                    httpd->callbacks.conn_request_is_slow(connection->user_data, connection->request)) {
+                    /* Answered once a worker is done, so it does not hold up the other connections */
+                    httpd_queue_request(httpd, connection);
+                    continue;
+                }
+
                 http_response_t *response = NULL;
                 // Callback the received data to raop
                 httpd->callbacks.conn_request(connection->user_data, connection->request, &response);
-                http_request_destroy(connection->request);
-                connection->request = NULL;
-
-                if (response) {
-                    const char *data;
-                    int datalen;
-                    int written;
-                    int ret;
-
-                    /* Get response data and datalen */
-                    data = http_response_get_data(response, &datalen);
-
-                    written = 0;
-                    while (written < datalen) {
-                        ret = send(connection->socket_fd, data+written, datalen-written, 0);
-                        if (ret == -1) {
-                            logger_log(httpd->logger, LOGGER_ERR, "httpd error in sending data");
-                            break;
-                        }
-                        written += ret;
-                    }
-
-                    if (http_response_get_disconnect(response)) {
-                        logger_log(httpd->logger, LOGGER_INFO, "Disconnecting on software request");
-                        httpd_remove_connection(httpd, connection);
-                    }
-                } else {
-                    logger_log(httpd->logger, LOGGER_WARNING, "httpd didn't get response");
-                }
-                http_response_destroy(response);
+                httpd_send_response(httpd, connection, response);
             } else {
                 logger_log(httpd->logger, LOGGER_DEBUG, "Request not complete, waiting for more data...");
             }
         }
     }
 
+    /* Workers must be done with the connections before they are removed */
+    httpd_stop_workers(httpd);
+
     /* Remove all connections that are still connected */
     for (i=0; i<httpd->max_connections; i++) {
         http_connection_t *connection = &httpd->connections[i];
@@ -413,6 +600,14 @@ httpd_start(httpd_t *httpd, unsigned short *port)
     }
     logger_log(httpd->logger, LOGGER_INFO, "Initialized server socket(s)");
 
+    if (httpd_start_workers(httpd) == -1) {
+        logger_log(httpd->logger, LOGGER_ERR, "Error starting worker threads");
+        closesocket(httpd->server_fd4);
+        closesocket(httpd->server_fd6);
+        MUTEX_UNLOCK(httpd->run_mutex);
+        return -2;
+    }
+
     /* Set values correctly and create new thread */
     httpd->running = 1;
     httpd->joined = 0;
@@ -26,6 +26,11 @@ struct httpd_callbacks_s {
 	void* (*conn_init)(void *opaque, unsigned char *local, int locallen, unsigned char *remote, int remotelen);
 	void  (*conn_request)(void *ptr, http_request_t *request, http_response_t **response);
 	void  (*conn_destroy)(void *ptr);
+
+	/* Optional, whether conn_request may block for long on this request. Such
+	 * requests are handled on a worker thread, and the connection is not read
+	 * from until the response has been sent, so requests stay in order. */
+	int   (*conn_request_is_slow)(void *ptr, http_request_t *request);
 };
 typedef struct httpd_callbacks_s httpd_callbacks_t;
 
@@ -0,0 +1,319 @@
+/**
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#if defined(__linux__)
+#include <dirent.h>
+#endif
+
+#include "load_monitor.h"
+#include "threads.h"
+
+#define SAMPLE_INTERVAL 1000000
+/* Frames that took longer than this from the sender's capture are late */
+#define LATE_FRAME_DELAY 200000
+#define MAX_THREADS 128
+/* Leaving a level takes all measurements to drop below this share of its thresholds */
+#define HYSTERESIS_PERCENT 75
+
+typedef struct load_thresholds_s {
+    double queue_depth;    // frames
+    double late_percent;
+    double thread_cpu;     // percent of one core
+    double process_cpu;    // percent of all cores
+} load_thresholds_t;
+
+static const load_thresholds_t thresholds[] = {
+    [LOAD_LEVEL_NORMAL] = { 0, 0, 0, 0 },
+    [LOAD_LEVEL_HIGH] = { 4, 2, 80, 80 },
+    [LOAD_LEVEL_OVERLOADED] = { 8, 10, 95, 95 },
+};
+
+typedef struct thread_ticks_s {
+    int tid;
+    unsigned long ticks;
+} thread_ticks_t;
+
+struct load_monitor_s {
+    logger_t *logger;
+    raop_callbacks_t callbacks;
+
+    /* MUTEX LOCKED VARIABLES START */
+    mutex_handle_t mutex;
+    int sessions;
+    load_level_t level;
+    int frames;
+    int late_frames;
+    uint64_t next_sample;
+    int sampling;
+    /* Smoothed measurements */
+    double queue_depth;
+    double late_percent;
+    double thread_cpu;
+    double process_cpu;
+    /* MUTEX LOCKED VARIABLES END */
+
+    /* Only used by the thread that holds the sampling flag */
+    uint64_t last_sample;
+    uint64_t last_process_time;
+    thread_ticks_t threads[MAX_THREADS];
+    int thread_count;
+    char busiest_thread[16];
+};
+
+static uint64_t
+load_monitor_now(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Returns the CPU usage of the busiest thread since the last call, in percent of one core */
+static double
+load_monitor_sample_threads(load_monitor_t *monitor, uint64_t elapsed)
+{
+    unsigned long busiest = 0;
+#if defined(__linux__)
+    thread_ticks_t threads[MAX_THREADS];
+    int count = 0;
+
+    monitor->busiest_thread[0] = '\0';
+    DIR *dir = opendir("/proc/self/task");
+    if (!dir) {
+        return 0;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) && count < MAX_THREADS) {
+        char path[sizeof(entry->d_name) + 32], stat[512];
+        unsigned long utime, stime;
+        if (entry->d_name[0] == '.') continue;
+
+        snprintf(path, sizeof(path), "/proc/self/task/%s/stat", entry->d_name);
+        FILE *file = fopen(path, "r");
+        if (!file) continue;
+        size_t len = fread(stat, 1, sizeof(stat) - 1, file);
+        fclose(file);
+        stat[len] = '\0';
+
+        // The thread name may contain anything, the fields after it are the state, 10 we skip, utime and stime
+        char *name = strchr(stat, '(');
+        char *name_end = strrchr(stat, ')');
+        if (!name || !name_end || name_end < name || sscanf(name_end + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                                         &utime, &stime) != 2) {
+            continue;
+        }
+        threads[count].tid = atoi(entry->d_name);
+        threads[count].ticks = utime + stime;
+
+        for (int i = 0; i < monitor->thread_count; i++) {
+            if (monitor->threads[i].tid != threads[count].tid) continue;
+            unsigned long ticks = threads[count].ticks - monitor->threads[i].ticks;
+            if (ticks > busiest) {
+                size_t name_len = name_end - name - 1;
+                if (name_len >= sizeof(monitor->busiest_thread)) name_len = sizeof(monitor->busiest_thread) - 1;
+                memcpy(monitor->busiest_thread, name + 1, name_len);
+                monitor->busiest_thread[name_len] = '\0';
+                busiest = ticks;
+            }
+            break;
+        }
+        count++;
+    }
+    closedir(dir);
+
+    memcpy(monitor->threads, threads, count * sizeof(thread_ticks_t));
+    monitor->thread_count = count;
+    return busiest * 100.0 * 1000000.0 / sysconf(_SC_CLK_TCK) / elapsed;
+#else
+    return busiest;
+#endif
+}
+
+static int
+load_monitor_exceeds(load_monitor_t *monitor, load_level_t level, int percent)
+{
+    const load_thresholds_t *limit = &thresholds[level];
+    return monitor->queue_depth * 100 >= limit->queue_depth * percent ||
+           monitor->late_percent * 100 >= limit->late_percent * percent ||
+           monitor->thread_cpu * 100 >= limit->thread_cpu * percent ||
+           monitor->process_cpu * 100 >= limit->process_cpu * percent;
+}
+
+static void
+load_monitor_sample(load_monitor_t *monitor, uint64_t now, int frames, int late_frames)
+{
+    uint64_t process_time = load_monitor_now(CLOCK_PROCESS_CPUTIME_ID);
+    uint64_t elapsed = now - monitor->last_sample;
+
+    // After a pause in mirroring the old counters say nothing about the present
+    if (!monitor->last_sample || elapsed > 2 * SAMPLE_INTERVAL) {
+        monitor->thread_count = 0;
+        load_monitor_sample_threads(monitor, SAMPLE_INTERVAL);
+        monitor->last_sample = now;
+        monitor->last_process_time = process_time;
+        MUTEX_LOCK(monitor->mutex);
+        monitor->sampling = 0;
+        MUTEX_UNLOCK(monitor->mutex);
+        return;
+    }
+
+    double thread_cpu = load_monitor_sample_threads(monitor, elapsed);
+    double process_cpu = (process_time - monitor->last_process_time) * 100.0 / elapsed / sysconf(_SC_NPROCESSORS_ONLN);
+    double late_percent = frames ? late_frames * 100.0 / frames : 0;
+    int queue_depth = monitor->callbacks.video_get_queue_depth ?
+                      monitor->callbacks.video_get_queue_depth(monitor->callbacks.cls) : 0;
+    monitor->last_sample = now;
+    monitor->last_process_time = process_time;
+
+    MUTEX_LOCK(monitor->mutex);
+    monitor->sampling = 0;
+    monitor->queue_depth = (monitor->queue_depth + queue_depth) / 2;
+    monitor->late_percent = (monitor->late_percent + late_percent) / 2;
+    monitor->thread_cpu = (monitor->thread_cpu + thread_cpu) / 2;
+    monitor->process_cpu = (monitor->process_cpu + process_cpu) / 2;
+
+    load_level_t level = LOAD_LEVEL_NORMAL;
+    if (load_monitor_exceeds(monitor, LOAD_LEVEL_OVERLOADED, 100)) {
+        level = LOAD_LEVEL_OVERLOADED;
+    } else if (load_monitor_exceeds(monitor, LOAD_LEVEL_HIGH, 100)) {
+        level = LOAD_LEVEL_HIGH;
+    }
+    if (level < monitor->level && load_monitor_exceeds(monitor, monitor->level, HYSTERESIS_PERCENT)) {
+        level = monitor->level;
+    }
+    int changed = level != monitor->level;
+    monitor->level = level;
+    MUTEX_UNLOCK(monitor->mutex);
+
+    logger_log(monitor->logger, LOGGER_DEBUG, "Load: %d frames queued, %.0f%% late frames, %.0f%% CPU in thread %s, %.0f%% CPU overall",
+               queue_depth, late_percent, thread_cpu, monitor->busiest_thread, process_cpu);
+    if (!changed) {
+        return;
+    }
+    if (level == LOAD_LEVEL_OVERLOADED) {
+        logger_log(monitor->logger, LOGGER_WARNING, "Receiver is overloaded (%.1f frames queued, %.0f%% late frames, "
+                   "%.0f%% CPU in thread %s, %.0f%% CPU overall), refusing new sessions",
+                   monitor->queue_depth, monitor->late_percent, monitor->thread_cpu, monitor->busiest_thread, monitor->process_cpu);
+    } else if (level == LOAD_LEVEL_HIGH) {
+        logger_log(monitor->logger, LOGGER_INFO, "Receiver load is high (%.1f frames queued, %.0f%% late frames, "
+                   "%.0f%% CPU in thread %s, %.0f%% CPU overall), offering new senders a smaller display",
+                   monitor->queue_depth, monitor->late_percent, monitor->thread_cpu, monitor->busiest_thread, monitor->process_cpu);
+    } else {
+        logger_log(monitor->logger, LOGGER_INFO, "Receiver load is back to normal");
+    }
+}
+
+load_monitor_t *
+load_monitor_init(logger_t *logger, raop_callbacks_t *callbacks)
+{
+    load_monitor_t *monitor;
+
+    assert(logger);
+    assert(callbacks);
+
+    monitor = calloc(1, sizeof(load_monitor_t));
+    if (!monitor) {
+        return NULL;
+    }
+    monitor->logger = logger;
+    memcpy(&monitor->callbacks, callbacks, sizeof(raop_callbacks_t));
+    MUTEX_CREATE(monitor->mutex);
+    return monitor;
+}
+
+void
+load_monitor_session_started(load_monitor_t *monitor)
+{
+    MUTEX_LOCK(monitor->mutex);
+    monitor->sessions++;
+    MUTEX_UNLOCK(monitor->mutex);
+}
+
+void
+load_monitor_session_stopped(load_monitor_t *monitor)
+{
+    MUTEX_LOCK(monitor->mutex);
+    assert(monitor->sessions > 0);
+    monitor->sessions--;
+    if (!monitor->sessions) {
+        if (monitor->level != LOAD_LEVEL_NORMAL) {
+            logger_log(monitor->logger, LOGGER_INFO, "Receiver load is back to normal");
+        }
+        monitor->level = LOAD_LEVEL_NORMAL;
+        monitor->queue_depth = monitor->late_percent = monitor->thread_cpu = monitor->process_cpu = 0;
+        monitor->frames = monitor->late_frames = 0;
+    }
+    MUTEX_UNLOCK(monitor->mutex);
+}
+
+void
+load_monitor_frame(load_monitor_t *monitor, int64_t delay)
+{
+    uint64_t now = load_monitor_now(CLOCK_MONOTONIC);
+    int frames = 0, late_frames = 0;
+    int sample = 0;
+
+    MUTEX_LOCK(monitor->mutex);
+    monitor->frames++;
+    monitor->late_frames += delay > LATE_FRAME_DELAY;
+    // Whichever mirror thread comes first takes the sample, the others go on
+    if (!monitor->sampling && now >= monitor->next_sample) {
+        monitor->sampling = 1;
+        monitor->next_sample = now + SAMPLE_INTERVAL;
+        frames = monitor->frames;
+        late_frames = monitor->late_frames;
+        monitor->frames = monitor->late_frames = 0;
+        sample = 1;
+    }
+    MUTEX_UNLOCK(monitor->mutex);
+
+    if (sample) {
+        load_monitor_sample(monitor, now, frames, late_frames);
+    }
+}
+
+load_level_t
+load_monitor_get_level(load_monitor_t *monitor)
+{
+    uint64_t now = load_monitor_now(CLOCK_MONOTONIC);
+    int decayed = 0;
+
+    MUTEX_LOCK(monitor->mutex);
+    // Senders stop sending frames while the screen is static, so a level is only as good as the last sample
+    if (monitor->level != LOAD_LEVEL_NORMAL && !monitor->sampling && now >= monitor->next_sample + SAMPLE_INTERVAL) {
+        monitor->level = LOAD_LEVEL_NORMAL;
+        monitor->queue_depth = monitor->late_percent = monitor->thread_cpu = monitor->process_cpu = 0;
+        decayed = 1;
+    }
+    load_level_t level = monitor->sessions ? monitor->level : LOAD_LEVEL_NORMAL;
+    MUTEX_UNLOCK(monitor->mutex);
+
+    if (decayed) {
+        logger_log(monitor->logger, LOGGER_INFO, "Receiver load is back to normal");
+    }
+    return level;
+}
+
+void
+load_monitor_destroy(load_monitor_t *monitor)
+{
+    if (monitor) {
+        MUTEX_DESTROY(monitor->mutex);
+        free(monitor);
+    }
+}
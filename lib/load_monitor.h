@@ -0,0 +1,50 @@
+/**
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+/*
+ * Admission control for mirroring sessions. While mirroring, the receiver's
+ * load is sampled once per second from the mirror threads: the number of
+ * frames waiting in the video renderer, the share of frames that arrive late,
+ * and the CPU usage of the busiest thread and of the whole process. Under high
+ * load new senders are offered a smaller display, when overloaded they are
+ * turned away, so that the sessions already running keep their latency.
+ */
+
+#ifndef LOAD_MONITOR_H
+#define LOAD_MONITOR_H
+
+#include <stdint.h>
+#include "raop.h"
+#include "logger.h"
+
+typedef enum load_level_e {
+    LOAD_LEVEL_NORMAL,
+    LOAD_LEVEL_HIGH,       // new senders are asked for a lower resolution and frame rate
+    LOAD_LEVEL_OVERLOADED  // new sessions are refused
+} load_level_t;
+
+typedef struct load_monitor_s load_monitor_t;
+
+load_monitor_t *load_monitor_init(logger_t *logger, raop_callbacks_t *callbacks);
+
+void load_monitor_session_started(load_monitor_t *monitor);
+void load_monitor_session_stopped(load_monitor_t *monitor);
+
+/* Called for every video frame with the time from capture on the sender until it arrived, in microseconds */
+void load_monitor_frame(load_monitor_t *monitor, int64_t delay);
+
+/* Always LOAD_LEVEL_NORMAL while nobody is mirroring or no frame arrived for two sample intervals */
+load_level_t load_monitor_get_level(load_monitor_t *monitor);
+
+void load_monitor_destroy(load_monitor_t *monitor);
+
+#endif //LOAD_MONITOR_H
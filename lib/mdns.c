@@ -0,0 +1,781 @@
+/**
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include "mdns.h"
+
+#ifdef __linux__
+
+#include <stdint.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "threads.h"
+
+#define MDNS_PORT 5353
+#define MDNS_GROUP "224.0.0.251"
+
+#define MDNS_MAX_SERVICES   4
+#define MDNS_MAX_INTERFACES 8
+#define MDNS_MAX_NAME       256
+#define MDNS_PACKET_SIZE    1472 // Fits an Ethernet frame
+
+#define MDNS_TYPE_A   1
+#define MDNS_TYPE_PTR 12
+#define MDNS_TYPE_TXT 16
+#define MDNS_TYPE_SRV 33
+#define MDNS_TYPE_ANY 255
+#define MDNS_CLASS_IN 1
+#define MDNS_CACHE_FLUSH 0x8000
+
+#define MDNS_TTL_HOST    120
+#define MDNS_TTL_SERVICE 4500
+#define MDNS_TTL_LEGACY  10
+
+/* Announcements are repeated after 1 s, 2 s, ... */
+#define MDNS_ANNOUNCE_COUNT 3
+/* How often interfaces are checked for address changes */
+#define MDNS_RESCAN_INTERVAL 10 // s
+/* Minimum time between multicast answers on one interface */
+#define MDNS_ANSWER_INTERVAL 1000000 // us
+
+typedef struct mdns_service_s {
+    int used;
+    /* Names in DNS wire format */
+    unsigned char type[MDNS_MAX_NAME];
+    int type_len;
+    unsigned char instance[MDNS_MAX_NAME];
+    int instance_len;
+    unsigned short port;
+    unsigned char *txt;
+    int txt_len;
+} mdns_service_t;
+
+typedef struct mdns_iface_s {
+    int index;
+    struct in_addr addr;
+    uint64_t last_answer;
+
+    /* Answer to every query and announcement, with all records */
+    unsigned char packet[MDNS_PACKET_SIZE];
+    int packet_len;
+} mdns_iface_t;
+
+struct mdns_s {
+    int fd;
+    int epoll_fd;
+    int timer_fd;
+    int stop_fd;
+    thread_handle_t thread;
+
+    /* These variables only edited mutex locked */
+    mutex_handle_t mutex;
+    unsigned char host[MDNS_MAX_NAME];
+    int host_len;
+    mdns_service_t services[MDNS_MAX_SERVICES];
+    mdns_iface_t ifaces[MDNS_MAX_INTERFACES];
+    int iface_count;
+    int announce_left;
+    int announce_interval;
+};
+
+static const unsigned char mdns_services_name[] = "\x09_services\x07_dns-sd\x04_udp\x05local";
+
+static uint64_t
+mdns_now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000ull + (uint64_t) time.tv_nsec / 1000u;
+}
+
+/* Appends a label to a wire format name that is not terminated yet */
+static int
+mdns_put_label(unsigned char *name, int *name_len, const char *label, int label_len)
+{
+    if (label_len < 1 || label_len > 63 || *name_len + 1 + label_len + 1 > MDNS_MAX_NAME) {
+        return -1;
+    }
+    name[(*name_len)++] = label_len;
+    memcpy(name + *name_len, label, label_len);
+    *name_len += label_len;
+    return 0;
+}
+
+/* Appends the labels of a dotted name and terminates it */
+static int
+mdns_put_dotted(unsigned char *name, int *name_len, const char *dotted)
+{
+    while (*dotted) {
+        const char *dot = strchr(dotted, '.');
+        int label_len = dot ? (int) (dot - dotted) : (int) strlen(dotted);
+        if (mdns_put_label(name, name_len, dotted, label_len) < 0) {
+            return -1;
+        }
+        dotted += label_len + (dot ? 1 : 0);
+    }
+    name[(*name_len)++] = 0;
+    return 0;
+}
+
+static int
+mdns_name_equal(const unsigned char *a, int a_len, const unsigned char *b, int b_len)
+{
+    // Label lengths are below 64, so they are not affected by tolower
+    if (a_len != b_len) {
+        return 0;
+    }
+    for (int i = 0; i < a_len; i++) {
+        if (tolower(a[i]) != tolower(b[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int
+mdns_put_bytes(unsigned char *buf, int *pos, int cap, const void *data, int len)
+{
+    if (*pos + len > cap) {
+        return -1;
+    }
+    if (len == 0) {
+        return 0;
+    }
+    memcpy(buf + *pos, data, len);
+    *pos += len;
+    return 0;
+}
+
+static int
+mdns_put_short(unsigned char *buf, int *pos, int cap, uint16_t value)
+{
+    unsigned char data[2] = { value >> 8, value & 0xff };
+    return mdns_put_bytes(buf, pos, cap, data, sizeof(data));
+}
+
+static int
+mdns_put_header(unsigned char *buf, int *pos, int cap, uint16_t id, int question_count, int answer_count)
+{
+    *pos = 0;
+    return mdns_put_short(buf, pos, cap, id) ||
+           mdns_put_short(buf, pos, cap, 0x8400) || // Authoritative response
+           mdns_put_short(buf, pos, cap, question_count) ||
+           mdns_put_short(buf, pos, cap, answer_count) ||
+           mdns_put_short(buf, pos, cap, 0) ||
+           mdns_put_short(buf, pos, cap, 0) ? -1 : 0;
+}
+
+/* Appends a resource record, the rdata is given in up to two parts */
+static int
+mdns_put_record(unsigned char *buf, int *pos, int cap, const unsigned char *name, int name_len,
+                int type, int unique, uint32_t ttl, const void *rdata, int rdata_len,
+                const void *rdata2, int rdata2_len)
+{
+    unsigned char ttl_data[4] = { ttl >> 24, (ttl >> 16) & 0xff, (ttl >> 8) & 0xff, ttl & 0xff };
+    return mdns_put_bytes(buf, pos, cap, name, name_len) ||
+           mdns_put_short(buf, pos, cap, type) ||
+           mdns_put_short(buf, pos, cap, MDNS_CLASS_IN | (unique ? MDNS_CACHE_FLUSH : 0)) ||
+           mdns_put_bytes(buf, pos, cap, ttl_data, sizeof(ttl_data)) ||
+           mdns_put_short(buf, pos, cap, rdata_len + rdata2_len) ||
+           mdns_put_bytes(buf, pos, cap, rdata, rdata_len) ||
+           mdns_put_bytes(buf, pos, cap, rdata2, rdata2_len) ? -1 : 0;
+}
+
+/**
+ * Appends the records of one service, or of all services if service is -1,
+ * and optionally the address record of the interface. The TTLs are capped at
+ * max_ttl. Returns the number of records, -1 if they do not fit.
+ */
+static int
+mdns_put_records(mdns_t *mdns, const mdns_iface_t *iface, int service, int with_host, uint32_t max_ttl,
+                 unsigned char *buf, int *pos, int cap)
+{
+    uint32_t service_ttl = MDNS_TTL_SERVICE < max_ttl ? MDNS_TTL_SERVICE : max_ttl;
+    uint32_t host_ttl = MDNS_TTL_HOST < max_ttl ? MDNS_TTL_HOST : max_ttl;
+    int count = 0;
+
+    for (int i = 0; i < MDNS_MAX_SERVICES; i++) {
+        mdns_service_t *s = &mdns->services[i];
+        unsigned char srv[6] = { 0, 0, 0, 0, s->port >> 8, s->port & 0xff }; // Priority, weight, port
+
+        if (!s->used || (service != -1 && service != i)) {
+            continue;
+        }
+        if (mdns_put_record(buf, pos, cap, s->type, s->type_len, MDNS_TYPE_PTR, 0, service_ttl,
+                            s->instance, s->instance_len, NULL, 0) ||
+            mdns_put_record(buf, pos, cap, s->instance, s->instance_len, MDNS_TYPE_SRV, 1, host_ttl,
+                            srv, sizeof(srv), mdns->host, mdns->host_len) ||
+            mdns_put_record(buf, pos, cap, s->instance, s->instance_len, MDNS_TYPE_TXT, 1, service_ttl,
+                            s->txt, s->txt_len, NULL, 0) ||
+            mdns_put_record(buf, pos, cap, mdns_services_name, sizeof(mdns_services_name), MDNS_TYPE_PTR, 0,
+                            service_ttl, s->type, s->type_len, NULL, 0)) {
+            return -1;
+        }
+        count += 4;
+    }
+    if (with_host) {
+        if (mdns_put_record(buf, pos, cap, mdns->host, mdns->host_len, MDNS_TYPE_A, 1, host_ttl,
+                            &iface->addr, sizeof(iface->addr), NULL, 0)) {
+            return -1;
+        }
+        count++;
+    }
+    return count;
+}
+
+/* Precomputes the answer packets, called whenever services or interfaces change */
+static int
+mdns_build_packets(mdns_t *mdns)
+{
+    for (int i = 0; i < mdns->iface_count; i++) {
+        mdns_iface_t *iface = &mdns->ifaces[i];
+        int pos = 12;
+        int count = mdns_put_records(mdns, iface, -1, 1, UINT32_MAX, iface->packet, &pos, sizeof(iface->packet));
+        if (count < 0) {
+            iface->packet_len = 0;
+            return -1;
+        }
+        iface->packet_len = pos;
+        mdns_put_header(iface->packet, &pos, sizeof(iface->packet), 0, 0, count);
+    }
+    return 0;
+}
+
+static void
+mdns_send(mdns_t *mdns, const mdns_iface_t *iface, const unsigned char *packet, int packet_len)
+{
+    struct sockaddr_in addr;
+    struct ip_mreqn mreq;
+
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.imr_ifindex = iface->index;
+    setsockopt(mdns->fd, IPPROTO_IP, IP_MULTICAST_IF, &mreq, sizeof(mreq));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(MDNS_PORT);
+    inet_pton(AF_INET, MDNS_GROUP, &addr.sin_addr);
+    sendto(mdns->fd, packet, packet_len, 0, (struct sockaddr *) &addr, sizeof(addr));
+}
+
+static void
+mdns_announce(mdns_t *mdns)
+{
+    for (int i = 0; i < mdns->iface_count; i++) {
+        if (mdns->ifaces[i].packet_len) {
+            mdns_send(mdns, &mdns->ifaces[i], mdns->ifaces[i].packet, mdns->ifaces[i].packet_len);
+        }
+    }
+}
+
+/* Tells caches to drop the records of a service, the host address stays valid */
+static void
+mdns_goodbye(mdns_t *mdns, int service)
+{
+    unsigned char packet[MDNS_PACKET_SIZE];
+
+    for (int i = 0; i < mdns->iface_count; i++) {
+        int pos = 12;
+        int count = mdns_put_records(mdns, &mdns->ifaces[i], service, 0, 0, packet, &pos, sizeof(packet));
+        if (count > 0) {
+            int len = pos;
+            mdns_put_header(packet, &pos, sizeof(packet), 0, 0, count);
+            mdns_send(mdns, &mdns->ifaces[i], packet, len);
+        }
+    }
+}
+
+static void
+mdns_arm_timer(mdns_t *mdns, int seconds)
+{
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = seconds;
+    timerfd_settime(mdns->timer_fd, 0, &spec, NULL);
+}
+
+/**
+ * Joins the mDNS group on all multicast capable IPv4 interfaces. Returns 1 if
+ * the interfaces or their addresses changed since the last call.
+ */
+static int
+mdns_scan_interfaces(mdns_t *mdns)
+{
+    struct ifaddrs *ifaddrs, *ifa;
+    mdns_iface_t ifaces[MDNS_MAX_INTERFACES];
+    int count = 0;
+    int changed;
+
+    if (getifaddrs(&ifaddrs) < 0) {
+        return 0;
+    }
+    for (ifa = ifaddrs; ifa && count < MDNS_MAX_INTERFACES; ifa = ifa->ifa_next) {
+        if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != AF_INET ||
+            !(ifa->ifa_flags & IFF_UP) || !(ifa->ifa_flags & IFF_MULTICAST)) {
+            continue;
+        }
+        memset(&ifaces[count], 0, sizeof(ifaces[count]));
+        ifaces[count].index = if_nametoindex(ifa->ifa_name);
+        ifaces[count].addr = ((struct sockaddr_in *) ifa->ifa_addr)->sin_addr;
+        count++;
+    }
+    freeifaddrs(ifaddrs);
+
+    changed = count != mdns->iface_count;
+    for (int i = 0; i < count && !changed; i++) {
+        changed = ifaces[i].index != mdns->ifaces[i].index || ifaces[i].addr.s_addr != mdns->ifaces[i].addr.s_addr;
+    }
+    if (!changed) {
+        return 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        struct ip_mreqn mreq;
+        memset(&mreq, 0, sizeof(mreq));
+        inet_pton(AF_INET, MDNS_GROUP, &mreq.imr_multiaddr);
+        mreq.imr_ifindex = ifaces[i].index;
+        // Fails harmlessly for interfaces that already joined
+        setsockopt(mdns->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+    }
+    memcpy(mdns->ifaces, ifaces, count * sizeof(mdns_iface_t));
+    mdns->iface_count = count;
+    return 1;
+}
+
+/* Decompresses a name from a packet into wire format */
+static int
+mdns_read_name(const unsigned char *packet, int packet_len, int *pos, unsigned char *name, int *name_len)
+{
+    int cur = *pos, jumps = 0;
+
+    *name_len = 0;
+    while (1) {
+        if (cur >= packet_len) {
+            return -1;
+        }
+        int len = packet[cur];
+        if ((len & 0xc0) == 0xc0) {
+            if (cur + 1 >= packet_len || ++jumps > 16) {
+                return -1;
+            }
+            if (jumps == 1) {
+                *pos = cur + 2;
+            }
+            cur = ((len & 0x3f) << 8) | packet[cur + 1];
+            continue;
+        }
+        if (len > 63 || cur + 1 + len > packet_len || *name_len + 1 + len > MDNS_MAX_NAME) {
+            return -1;
+        }
+        memcpy(name + *name_len, packet + cur, 1 + len);
+        *name_len += 1 + len;
+        cur += 1 + len;
+        if (len == 0) {
+            break;
+        }
+    }
+    if (jumps == 0) {
+        *pos = cur;
+    }
+    return 0;
+}
+
+/* Whether we are authoritative for the question */
+static int
+mdns_is_ours(mdns_t *mdns, const unsigned char *name, int name_len, int type)
+{
+    int any = type == MDNS_TYPE_ANY;
+
+    if ((any || type == MDNS_TYPE_A) && mdns_name_equal(name, name_len, mdns->host, mdns->host_len)) {
+        return 1;
+    }
+    for (int i = 0; i < MDNS_MAX_SERVICES; i++) {
+        mdns_service_t *s = &mdns->services[i];
+        if (!s->used) {
+            continue;
+        }
+        if ((any || type == MDNS_TYPE_PTR) &&
+            (mdns_name_equal(name, name_len, s->type, s->type_len) ||
+             mdns_name_equal(name, name_len, mdns_services_name, sizeof(mdns_services_name)))) {
+            return 1;
+        }
+        if ((any || type == MDNS_TYPE_SRV || type == MDNS_TYPE_TXT) &&
+            mdns_name_equal(name, name_len, s->instance, s->instance_len)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void
+mdns_handle_query(mdns_t *mdns, const unsigned char *packet, int packet_len, int ifindex,
+                  const struct sockaddr_in *from)
+{
+    unsigned char name[MDNS_MAX_NAME];
+    int name_len;
+    int pos = 12, first_question_end = 0;
+    int matched = 0;
+    mdns_iface_t *iface = NULL;
+
+    // Only queries, and only standard ones
+    if (packet_len < 12 || (packet[2] & 0xf8) != 0) {
+        return;
+    }
+    int question_count = (packet[4] << 8) | packet[5];
+
+    MUTEX_LOCK(mdns->mutex);
+    for (int i = 0; i < mdns->iface_count; i++) {
+        if (mdns->ifaces[i].index == ifindex) {
+            iface = &mdns->ifaces[i];
+        }
+    }
+    for (int i = 0; iface && i < question_count && !matched; i++) {
+        if (mdns_read_name(packet, packet_len, &pos, name, &name_len) < 0 || pos + 4 > packet_len) {
+            break;
+        }
+        int type = (packet[pos] << 8) | packet[pos + 1];
+        pos += 4;
+        if (i == 0) {
+            first_question_end = pos;
+        }
+        matched = mdns_is_ours(mdns, name, name_len, type);
+    }
+
+    if (matched && ntohs(from->sin_port) != MDNS_PORT) {
+        // A one-shot query from a plain DNS resolver gets a unicast answer that echoes the question
+        unsigned char reply[MDNS_PACKET_SIZE];
+        int reply_pos = 12;
+        int count = -1;
+        if (!mdns_put_bytes(reply, &reply_pos, sizeof(reply), packet + 12, first_question_end - 12)) {
+            count = mdns_put_records(mdns, iface, -1, 1, MDNS_TTL_LEGACY, reply, &reply_pos, sizeof(reply));
+        }
+        if (count > 0) {
+            int len = reply_pos;
+            mdns_put_header(reply, &reply_pos, sizeof(reply), (packet[0] << 8) | packet[1], 1, count);
+            sendto(mdns->fd, reply, len, 0, (const struct sockaddr *) from, sizeof(*from));
+        }
+    } else if (matched && iface->packet_len) {
+        uint64_t now = mdns_now();
+        if (now - iface->last_answer >= MDNS_ANSWER_INTERVAL) {
+            iface->last_answer = now;
+            mdns_send(mdns, iface, iface->packet, iface->packet_len);
+        }
+    }
+    MUTEX_UNLOCK(mdns->mutex);
+}
+
+static void
+mdns_handle_timer(mdns_t *mdns)
+{
+    uint64_t expirations;
+    if (read(mdns->timer_fd, &expirations, sizeof(expirations)) < 0) {
+        return;
+    }
+
+    MUTEX_LOCK(mdns->mutex);
+    if (mdns_scan_interfaces(mdns)) {
+        mdns_build_packets(mdns);
+        mdns->announce_left = MDNS_ANNOUNCE_COUNT;
+        mdns->announce_interval = 1;
+    }
+    if (mdns->announce_left > 0) {
+        mdns_announce(mdns);
+        mdns->announce_left--;
+        mdns_arm_timer(mdns, mdns->announce_left ? mdns->announce_interval : MDNS_RESCAN_INTERVAL);
+        mdns->announce_interval *= 2;
+    } else {
+        mdns_arm_timer(mdns, MDNS_RESCAN_INTERVAL);
+    }
+    MUTEX_UNLOCK(mdns->mutex);
+}
+
+static THREAD_RETVAL
+mdns_thread(void *arg)
+{
+    mdns_t *mdns = arg;
+    unsigned char packet[9000];
+    struct epoll_event events[4];
+
+    assert(mdns);
+
+    while (1) {
+        int count = epoll_wait(mdns->epoll_fd, events, sizeof(events) / sizeof(events[0]), -1);
+        if (count < 0) {
+            continue;
+        }
+        for (int i = 0; i < count; i++) {
+            int fd = events[i].data.fd;
+            if (fd == mdns->stop_fd) {
+                return 0;
+            } else if (fd == mdns->timer_fd) {
+                mdns_handle_timer(mdns);
+            } else if (fd == mdns->fd) {
+                char control[CMSG_SPACE(sizeof(struct in_pktinfo))];
+                struct sockaddr_in from;
+                struct iovec iov = { packet, sizeof(packet) };
+                struct msghdr msg;
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_name = &from;
+                msg.msg_namelen = sizeof(from);
+                msg.msg_iov = &iov;
+                msg.msg_iovlen = 1;
+                msg.msg_control = control;
+                msg.msg_controllen = sizeof(control);
+
+                int len = recvmsg(mdns->fd, &msg, MSG_DONTWAIT);
+                if (len <= 0) {
+                    continue;
+                }
+                int ifindex = 0;
+                for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                    if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+                        ifindex = ((struct in_pktinfo *) CMSG_DATA(cmsg))->ipi_ifindex;
+                    }
+                }
+                mdns_handle_query(mdns, packet, len, ifindex, &from);
+            }
+        }
+    }
+}
+
+static int
+mdns_init_socket(void)
+{
+    struct sockaddr_in addr;
+    int fd, one = 1;
+    unsigned char ttl = 255;
+
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    // Shared with a system responder, if one is running anyway
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+#ifdef SO_REUSEPORT
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+#endif
+    setsockopt(fd, IPPROTO_IP, IP_PKTINFO, &one, sizeof(one));
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(MDNS_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+mdns_t *
+mdns_init(const char *hostname)
+{
+    char system_hostname[64];
+    mdns_t *mdns;
+
+    if (!hostname) {
+        if (gethostname(system_hostname, sizeof(system_hostname)) < 0) {
+            return NULL;
+        }
+        system_hostname[sizeof(system_hostname) - 1] = '\0';
+        hostname = system_hostname;
+    }
+
+    mdns = calloc(1, sizeof(mdns_t));
+    if (!mdns) {
+        return NULL;
+    }
+
+    // Only the first label of the host name, in the .local domain
+    const char *dot = strchr(hostname, '.');
+    if (mdns_put_label(mdns->host, &mdns->host_len, hostname, dot ? (int) (dot - hostname) : (int) strlen(hostname)) < 0 ||
+        mdns_put_dotted(mdns->host, &mdns->host_len, "local") < 0) {
+        free(mdns);
+        return NULL;
+    }
+
+    mdns->fd = mdns_init_socket();
+    mdns->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    mdns->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    mdns->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mdns->fd < 0 || mdns->epoll_fd < 0 || mdns->timer_fd < 0 || mdns->stop_fd < 0) {
+        if (mdns->fd >= 0) close(mdns->fd);
+        if (mdns->epoll_fd >= 0) close(mdns->epoll_fd);
+        if (mdns->timer_fd >= 0) close(mdns->timer_fd);
+        if (mdns->stop_fd >= 0) close(mdns->stop_fd);
+        free(mdns);
+        return NULL;
+    }
+
+    int fds[] = { mdns->fd, mdns->timer_fd, mdns->stop_fd };
+    for (int i = 0; i < 3; i++) {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = fds[i];
+        epoll_ctl(mdns->epoll_fd, EPOLL_CTL_ADD, fds[i], &event);
+    }
+
+    MUTEX_CREATE(mdns->mutex);
+    mdns_scan_interfaces(mdns);
+    mdns_arm_timer(mdns, MDNS_RESCAN_INTERVAL);
+    THREAD_CREATE(mdns->thread, mdns_thread, mdns);
+    return mdns;
+}
+
+int
+mdns_register(mdns_t *mdns, const char *instance, const char *type, unsigned short port,
+              const unsigned char *txt, int txt_len)
+{
+    mdns_service_t *s = NULL;
+    int id;
+
+    assert(mdns);
+    assert(txt_len >= 0);
+
+    MUTEX_LOCK(mdns->mutex);
+    for (id = 0; id < MDNS_MAX_SERVICES; id++) {
+        if (!mdns->services[id].used) {
+            s = &mdns->services[id];
+            break;
+        }
+    }
+    if (!s) {
+        MUTEX_UNLOCK(mdns->mutex);
+        return -1;
+    }
+
+    char type_domain[MDNS_MAX_NAME];
+    snprintf(type_domain, sizeof(type_domain), "%s.local", type);
+    memset(s, 0, sizeof(*s));
+    if (mdns_put_dotted(s->type, &s->type_len, type_domain) < 0 ||
+        mdns_put_label(s->instance, &s->instance_len, instance, strlen(instance)) < 0 ||
+        s->instance_len + s->type_len > MDNS_MAX_NAME) {
+        MUTEX_UNLOCK(mdns->mutex);
+        return -1;
+    }
+    memcpy(s->instance + s->instance_len, s->type, s->type_len);
+    s->instance_len += s->type_len;
+
+    // An empty TXT record still needs one empty string
+    s->txt_len = txt_len ? txt_len : 1;
+    s->txt = calloc(1, s->txt_len);
+    if (!s->txt) {
+        MUTEX_UNLOCK(mdns->mutex);
+        return -1;
+    }
+    memcpy(s->txt, txt, txt_len);
+    s->port = port;
+    s->used = 1;
+
+    if (mdns_build_packets(mdns) < 0) {
+        s->used = 0;
+        free(s->txt);
+        s->txt = NULL;
+        mdns_build_packets(mdns);
+        MUTEX_UNLOCK(mdns->mutex);
+        return -1;
+    }
+
+    // Announce right away and then a few more times in case packets got lost
+    mdns_announce(mdns);
+    mdns->announce_left = MDNS_ANNOUNCE_COUNT - 1;
+    mdns->announce_interval = 2;
+    mdns_arm_timer(mdns, 1);
+    MUTEX_UNLOCK(mdns->mutex);
+    return id;
+}
+
+void
+mdns_unregister(mdns_t *mdns, int id)
+{
+    assert(mdns);
+
+    if (id < 0 || id >= MDNS_MAX_SERVICES) {
+        return;
+    }
+    MUTEX_LOCK(mdns->mutex);
+    if (mdns->services[id].used) {
+        mdns_goodbye(mdns, id);
+        mdns->services[id].used = 0;
+        free(mdns->services[id].txt);
+        mdns->services[id].txt = NULL;
+        mdns_build_packets(mdns);
+    }
+    MUTEX_UNLOCK(mdns->mutex);
+}
+
+void
+mdns_destroy(mdns_t *mdns)
+{
+    uint64_t one = 1;
+
+    if (!mdns) {
+        return;
+    }
+
+    for (int i = 0; i < MDNS_MAX_SERVICES; i++) {
+        mdns_unregister(mdns, i);
+    }
+    if (write(mdns->stop_fd, &one, sizeof(one)) == sizeof(one) && mdns->thread) {
+        THREAD_JOIN(mdns->thread);
+    }
+    close(mdns->fd);
+    close(mdns->epoll_fd);
+    close(mdns->timer_fd);
+    close(mdns->stop_fd);
+    MUTEX_DESTROY(mdns->mutex);
+    free(mdns);
+}
+
+#else
+
+mdns_t *
+mdns_init(const char *hostname)
+{
+    return NULL;
+}
+
+int
+mdns_register(mdns_t *mdns, const char *instance, const char *type, unsigned short port,
+              const unsigned char *txt, int txt_len)
+{
+    return -1;
+}
+
+void
+mdns_unregister(mdns_t *mdns, int id)
+{
+}
+
+void
+mdns_destroy(mdns_t *mdns)
+{
+}
+
+#endif
@@ -0,0 +1,49 @@
+/**
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+/*
+ * Minimal multicast DNS responder (RFC 6762/6763) for the few services we
+ * advertise, as an alternative to a system mDNS daemon. The response packets
+ * are built once per interface when services change, and queries are answered
+ * from a single epoll thread. Only IPv4 is served, like the RTSP server itself.
+ * Probing and conflict resolution are not implemented, so the service names
+ * must be unique on the network.
+ */
+
+#ifndef MDNS_H
+#define MDNS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct mdns_s mdns_t;
+
+/* hostname is advertised as hostname.local, NULL for the system host name */
+mdns_t *mdns_init(const char *hostname);
+
+/**
+ * Advertises instance.type.local, e.g. type "_airplay._tcp", and announces it
+ * right away. txt is the TXT record in wire format.
+ * Returns an id for mdns_unregister, or -1 on error.
+ */
+int mdns_register(mdns_t *mdns, const char *instance, const char *type, unsigned short port,
+                  const unsigned char *txt, int txt_len);
+/* Withdraws the service from the network caches and stops answering for it */
+void mdns_unregister(mdns_t *mdns, int id);
+
+void mdns_destroy(mdns_t *mdns);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
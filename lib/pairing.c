@@ -27,6 +27,10 @@
 
 struct pairing_s {
     ed25519_key_t *ed;
+
+    /* Set by the test hook, every session then uses this ECDH key */
+    int has_test_ecdh;
+    unsigned char test_ecdh[X25519_KEY_SIZE];
 };
 
 typedef enum {
@@ -39,6 +43,9 @@ typedef enum {
 struct pairing_session_s {
     status_t status;
 
+    int has_test_ecdh;
+    unsigned char test_ecdh[X25519_KEY_SIZE];
+
     ed25519_key_t *ed_ours;
     ed25519_key_t *ed_theirs;
 
@@ -81,6 +88,25 @@ pairing_init_generate()
     return pairing;
 }
 
+pairing_t *
+pairing_init_seed(const unsigned char seed[ED25519_KEY_SIZE])
+{
+    pairing_t *pairing;
+
+    pairing = calloc(1, sizeof(pairing_t));
+    if (!pairing) {
+        return NULL;
+    }
+
+    pairing->ed = ed25519_key_from_private_raw(seed);
+    if (!pairing->ed) {
+        free(pairing);
+        return NULL;
+    }
+
+    return pairing;
+}
+
 void
 pairing_get_public_key(pairing_t *pairing, unsigned char public_key[ED25519_KEY_SIZE])
 {
@@ -88,6 +114,25 @@ pairing_get_public_key(pairing_t *pairing, unsigned char public_key[ED25519_KEY_
     ed25519_key_get_raw(public_key, pairing->ed);
 }
 
+void
+pairing_get_seed(pairing_t *pairing, unsigned char seed[ED25519_KEY_SIZE])
+{
+    assert(pairing);
+    ed25519_key_get_private_raw(seed, pairing->ed);
+}
+
+void
+pairing_set_test_ecdh_key(pairing_t *pairing, const unsigned char key[X25519_KEY_SIZE])
+{
+    assert(pairing);
+    pairing->has_test_ecdh = key != NULL;
+    if (key) {
+        memcpy(pairing->test_ecdh, key, X25519_KEY_SIZE);
+    } else {
+        memset(pairing->test_ecdh, 0, X25519_KEY_SIZE);
+    }
+}
+
 void
 pairing_get_ecdh_secret_key(pairing_session_t *session, unsigned char ecdh_secret[X25519_KEY_SIZE])
 {
@@ -111,6 +156,8 @@ pairing_session_init(pairing_t *pairing)
     }
 
     session->ed_ours = ed25519_key_copy(pairing->ed);
+    session->has_test_ecdh = pairing->has_test_ecdh;
+    memcpy(session->test_ecdh, pairing->test_ecdh, X25519_KEY_SIZE);
 
     session->status = STATUS_INITIAL;
 
@@ -147,7 +194,11 @@ pairing_session_handshake(pairing_session_t *session, const unsigned char ecdh_k
     session->ecdh_theirs = x25519_key_from_raw(ecdh_key);
     session->ed_theirs = ed25519_key_from_raw(ed_key);
 
-    session->ecdh_ours = x25519_key_generate();
+    if (session->has_test_ecdh) {
+        session->ecdh_ours = x25519_key_from_private_raw(session->test_ecdh);
+    } else {
+        session->ecdh_ours = x25519_key_generate();
+    }
 
     x25519_derive_secret(session->ecdh_secret, session->ecdh_ours, session->ecdh_theirs);
 
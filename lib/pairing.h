@@ -24,7 +24,11 @@ typedef struct pairing_s pairing_t;
 typedef struct pairing_session_s pairing_session_t;
 
 pairing_t *pairing_init_generate();
+pairing_t *pairing_init_seed(const unsigned char seed[ED25519_KEY_SIZE]);
 void pairing_get_public_key(pairing_t *pairing, unsigned char public_key[ED25519_KEY_SIZE]);
+void pairing_get_seed(pairing_t *pairing, unsigned char seed[ED25519_KEY_SIZE]);
+/* Test hook: all sessions use the given ECDH private key instead of a random one, NULL goes back to random keys */
+void pairing_set_test_ecdh_key(pairing_t *pairing, const unsigned char key[X25519_KEY_SIZE]);
 
 pairing_session_t *pairing_session_init(pairing_t *pairing);
 void pairing_session_set_setup_status(pairing_session_t *session);
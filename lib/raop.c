@@ -16,6 +16,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "raop.h"
 #include "raop_rtp.h"
@@ -30,6 +33,17 @@
 #include "compat.h"
 #include "raop_rtp_mirror.h"
 #include "raop_ntp.h"
+#include "session_cache.h"
+#include "load_monitor.h"
+
+/* How long the state of a dropped session is kept for a reconnect */
+#define RAOP_SESSION_CACHE_ENTRIES  8
+#define RAOP_SESSION_CACHE_LIFETIME (5 * 60 * 1000000ull) // us
+
+/* Display offered to new senders while the receiver is under high load */
+#define RAOP_DEGRADED_WIDTH  1280
+#define RAOP_DEGRADED_HEIGHT 720
+#define RAOP_DEGRADED_FPS    30
 
 struct raop_s {
     /* Callbacks for audio and video */
@@ -44,7 +58,19 @@ struct raop_s {
 
     dnssd_t *dnssd;
 
+    /* State of recently dropped sessions, by device */
+    session_cache_t *session_cache;
+
+    /* Decides whether new mirroring sessions can be taken on */
+    load_monitor_t *load_monitor;
+
     unsigned short port;
+
+    /* Whether H.265 mirroring is offered to senders */
+    int hevc;
+
+    /* Highest frame rate passed on to the video renderer, 0 for no limit */
+    int max_fps;
 };
 
 struct raop_conn_s {
@@ -61,6 +87,9 @@ struct raop_conn_s {
     unsigned char *remote;
     int remotelen;
 
+    /* Identify the sender in the session cache */
+    char *device_id;
+    char *dacp_id;
 };
 typedef struct raop_conn_s raop_conn_t;
 
@@ -150,6 +179,17 @@ conn_request(void *ptr, http_request_t *request, http_response_t **response) {
         return;
     }
 
+    // Turn away new sessions rather than letting every running stream fall behind
+    if (!strcmp(method, "SETUP") && !conn->raop_ntp &&
+        load_monitor_get_level(conn->raop->load_monitor) == LOAD_LEVEL_OVERLOADED) {
+        logger_log(conn->raop->logger, LOGGER_WARNING, "Refusing new session, the receiver is overloaded");
+        *response = http_response_init("RTSP/1.0", 453, "Not Enough Bandwidth");
+        http_response_add_header(*response, "CSeq", cseq);
+        http_response_add_header(*response, "Server", "AirTunes/220.68");
+        http_response_finish(*response, NULL, 0);
+        return;
+    }
+
     *response = http_response_init("RTSP/1.0", 200, "OK");
 
     http_response_add_header(*response, "CSeq", cseq);
@@ -218,6 +258,36 @@ conn_request(void *ptr, http_request_t *request, http_response_t **response) {
     }
 }
 
+/* Handshakes and session setup involve crypto, sockets and threads, everything else is answered inline */
+static int
+conn_request_is_slow(void *ptr, http_request_t *request) {
+    const char *method = http_request_get_method(request);
+    const char *url = http_request_get_url(request);
+
+    if (!method) {
+        return 0;
+    }
+    if (!strcmp(method, "POST") && url) {
+        return !strcmp(url, "/pair-setup") || !strcmp(url, "/pair-verify") || !strcmp(url, "/fp-setup");
+    }
+    return !strcmp(method, "SETUP");
+}
+
+/* Keeps the clock sync of the session for the case the sender comes back */
+static void
+raop_conn_cache_session(raop_conn_t *conn) {
+    raop_ntp_state_t ntp_state;
+
+    if (!conn->device_id && !conn->dacp_id) {
+        return;
+    }
+    raop_ntp_stop(conn->raop_ntp);
+    raop_ntp_get_state(conn->raop_ntp, &ntp_state);
+    if (ntp_state.sync_offset != 0) {
+        session_cache_store(conn->raop->session_cache, conn->device_id, conn->dacp_id, &ntp_state);
+    }
+}
+
 static void
 conn_destroy(void *ptr) {
     raop_conn_t *conn = ptr;
@@ -229,6 +299,7 @@ conn_destroy(void *ptr) {
     }
 
     if (conn->raop_ntp) {
+        raop_conn_cache_session(conn);
         raop_ntp_destroy(conn->raop_ntp);
     }
     if (conn->raop_rtp) {
@@ -244,11 +315,62 @@ conn_destroy(void *ptr) {
 
     free(conn->local);
     free(conn->remote);
+    free(conn->device_id);
+    free(conn->dacp_id);
     pairing_session_destroy(conn->pairing);
     fairplay_destroy(conn->fairplay);
     free(conn);
 }
 
+/**
+ * Loads the long-term identity key from keyfile, or generates one and stores it
+ * there. Senders remember the key they paired with, so keeping it stable across
+ * restarts saves them from pairing again.
+ */
+static pairing_t *
+raop_load_pairing(logger_t *logger, const char *keyfile) {
+    unsigned char seed[ED25519_KEY_SIZE];
+    pairing_t *pairing;
+    FILE *file;
+
+    file = fopen(keyfile, "rb");
+    if (file) {
+        size_t read = fread(seed, 1, sizeof(seed), file);
+        fclose(file);
+        if (read == sizeof(seed)) {
+            pairing = pairing_init_seed(seed);
+            memset(seed, 0, sizeof(seed));
+            if (pairing) {
+                logger_log(logger, LOGGER_DEBUG, "Loaded identity key from %s", keyfile);
+                return pairing;
+            }
+        }
+        logger_log(logger, LOGGER_WARNING, "Identity key file %s is invalid, generating a new key", keyfile);
+    }
+
+    pairing = pairing_init_generate();
+    if (!pairing) {
+        return NULL;
+    }
+
+    // The key must not be readable by others
+    int fd = open(keyfile, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    file = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    pairing_get_seed(pairing, seed);
+    if (!file || fwrite(seed, 1, sizeof(seed), file) != sizeof(seed)) {
+        logger_log(logger, LOGGER_WARNING, "Could not save identity key to %s: %s", keyfile, strerror(errno));
+    } else {
+        logger_log(logger, LOGGER_INFO, "Generated a new identity key in %s, senders will ask to pair again", keyfile);
+    }
+    if (file) {
+        fclose(file);
+    } else if (fd >= 0) {
+        close(fd);
+    }
+    memset(seed, 0, sizeof(seed));
+    return pairing;
+}
+
 raop_t *
 raop_init(int max_clients, raop_callbacks_t *callbacks) {
     raop_t *raop;
@@ -284,6 +406,19 @@ raop_init(int max_clients, raop_callbacks_t *callbacks) {
         free(raop);
         return NULL;
     }
+    raop->session_cache = session_cache_init(RAOP_SESSION_CACHE_ENTRIES, RAOP_SESSION_CACHE_LIFETIME);
+    if (!raop->session_cache) {
+        pairing_destroy(pairing);
+        free(raop);
+        return NULL;
+    }
+    raop->load_monitor = load_monitor_init(raop->logger, callbacks);
+    if (!raop->load_monitor) {
+        session_cache_destroy(raop->session_cache);
+        pairing_destroy(pairing);
+        free(raop);
+        return NULL;
+    }
 
     /* Set HTTP callbacks to our handlers */
     memset(&httpd_cbs, 0, sizeof(httpd_cbs));
@@ -291,10 +426,13 @@ raop_init(int max_clients, raop_callbacks_t *callbacks) {
     httpd_cbs.conn_init = &conn_init;
     httpd_cbs.conn_request = &conn_request;
     httpd_cbs.conn_destroy = &conn_destroy;
+    httpd_cbs.conn_request_is_slow = &conn_request_is_slow;
 
     /* Initialize the http daemon */
     httpd = httpd_init(raop->logger, &httpd_cbs, max_clients);
     if (!httpd) {
+        load_monitor_destroy(raop->load_monitor);
+        session_cache_destroy(raop->session_cache);
         pairing_destroy(pairing);
         free(raop);
         return NULL;
@@ -312,6 +450,8 @@ raop_destroy(raop_t *raop) {
         raop_stop(raop);
         pairing_destroy(raop->pairing);
         httpd_destroy(raop->httpd);
+        load_monitor_destroy(raop->load_monitor);
+        session_cache_destroy(raop->session_cache);
         logger_destroy(raop->logger);
         free(raop);
 
@@ -365,6 +505,53 @@ raop_set_dnssd(raop_t *raop, dnssd_t *dnssd) {
     raop->dnssd = dnssd;
 }
 
+void
+raop_set_hevc(raop_t *raop, int enabled) {
+    assert(raop);
+    raop->hevc = enabled;
+}
+
+void
+raop_set_max_fps(raop_t *raop, int max_fps) {
+    assert(raop);
+    raop->max_fps = max_fps;
+}
+
+int
+raop_set_keyfile(raop_t *raop, const char *keyfile) {
+    pairing_t *pairing;
+
+    assert(raop);
+    assert(keyfile);
+    assert(!httpd_is_running(raop->httpd));
+
+    pairing = raop_load_pairing(raop->logger, keyfile);
+    if (!pairing) {
+        return -1;
+    }
+    pairing_destroy(raop->pairing);
+    raop->pairing = pairing;
+    return 0;
+}
+
+int
+raop_set_test_keys(raop_t *raop, const unsigned char identity_seed[ED25519_KEY_SIZE],
+                   const unsigned char ecdh_key[X25519_KEY_SIZE]) {
+    pairing_t *pairing;
+
+    assert(raop);
+    assert(!httpd_is_running(raop->httpd));
+
+    pairing = pairing_init_seed(identity_seed);
+    if (!pairing) {
+        return -1;
+    }
+    pairing_set_test_ecdh_key(pairing, ecdh_key);
+    pairing_destroy(raop->pairing);
+    raop->pairing = pairing;
+    logger_log(raop->logger, LOGGER_WARNING, "Using fixed test keys, pairing is not secure");
+    return 0;
+}
 
 int
 raop_start(raop_t *raop, unsigned short *port) {
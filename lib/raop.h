@@ -26,6 +26,9 @@ extern "C" {
 #define RAOP_LOG_INFO        6       /* informational */
 #define RAOP_LOG_DEBUG       7       /* debug-level messages */
 
+/* Optional AirPlay feature bits */
+#define RAOP_FEATURE_SCREEN_MULTI_CODEC 42   /* the sender may mirror in H.265 */
+
 
 typedef struct raop_s raop_t;
 
@@ -42,11 +45,18 @@ struct raop_callbacks_s {
     void  (*conn_destroy)(void *cls);
     void  (*audio_flush)(void *cls);
     void  (*video_flush)(void *cls);
-    void  (*audio_set_volume)(void *cls, float volume);
+    /* The volume applies to the audio from pts on, in the same time base as the audio pts */
+    void  (*audio_set_volume)(void *cls, float volume, uint64_t pts);
     void  (*audio_set_metadata)(void *cls, const void *buffer, int buflen);
     void  (*audio_set_coverart)(void *cls, const void *buffer, int buflen);
     void  (*audio_remote_control_id)(void *cls, const char *dacp_id, const char *active_remote_header);
     void  (*audio_set_progress)(void *cls, unsigned int start, unsigned int curr, unsigned int end);
+    /* Measured audio output latency in microseconds, 0 if unknown */
+    uint64_t (*audio_get_latency)(void *cls);
+    /* Measured video display latency in microseconds, 0 if unknown */
+    uint64_t (*video_get_latency)(void *cls);
+    /* Frames waiting in the video renderer to be decoded or displayed, for admission control */
+    int (*video_get_queue_depth)(void *cls);
 };
 typedef struct raop_callbacks_s raop_callbacks_t;
 
@@ -61,6 +71,21 @@ RAOP_API int raop_start(raop_t *raop, unsigned short *port);
 RAOP_API int raop_is_running(raop_t *raop);
 RAOP_API void raop_stop(raop_t *raop);
 RAOP_API void raop_set_dnssd(raop_t *raop, dnssd_t *dnssd);
+RAOP_API void raop_set_hevc(raop_t *raop, int enabled);
+/* Skips non-reference frames to decode at most max_fps frames per second, 0 for all frames */
+RAOP_API void raop_set_max_fps(raop_t *raop, int max_fps);
+/**
+ * Replaces the temporary identity key with the one stored in keyfile, creating it
+ * if needed, so that senders stay paired across restarts. Call after setting the
+ * log callback, so that problems with the file are reported, and before raop_start.
+ */
+RAOP_API int raop_set_keyfile(raop_t *raop, const char *keyfile);
+/**
+ * Only for tests and benchmarks: replaces the identity key with one made from
+ * identity_seed and makes every pair-verify use the same ECDH key, so that
+ * handshakes can be computed in advance and replayed. Call before raop_start.
+ */
+RAOP_API int raop_set_test_keys(raop_t *raop, const unsigned char identity_seed[32], const unsigned char ecdh_key[32]);
 RAOP_API void raop_destroy(raop_t *raop);
 
 #ifdef __cplusplus
@@ -24,6 +24,21 @@
 typedef void (*raop_handler_t)(raop_conn_t *, http_request_t *,
                                http_response_t *, char **, int *);
 
+/* Output latency as measured by the renderers, in microseconds. Senders only ask for
+ * one, so the slower of audio and video is advertised to keep the two in sync */
+static uint64_t
+raop_get_output_latency(raop_t *raop)
+{
+    uint64_t audio_latency = 0, video_latency = 0;
+    if (raop->callbacks.audio_get_latency) {
+        audio_latency = raop->callbacks.audio_get_latency(raop->callbacks.cls);
+    }
+    if (raop->callbacks.video_get_latency) {
+        video_latency = raop->callbacks.video_get_latency(raop->callbacks.cls);
+    }
+    return audio_latency > video_latency ? audio_latency : video_latency;
+}
+
 static void
 raop_handler_info(raop_conn_t *conn,
                   http_request_t *request, http_response_t *response,
@@ -51,7 +66,11 @@ raop_handler_info(raop_conn_t *conn,
     plist_t txt_airplay_node = plist_new_data(airplay_txt, airplay_txt_len);
     plist_dict_set_item(r_node, "txtAirPlay", txt_airplay_node);
 
-    plist_t features_node = plist_new_uint((uint64_t) 0x1E << 32 | 0x5A7FFFF7);
+    uint64_t features = (uint64_t) 0x1E << 32 | 0x5A7FFFF7;
+    if (conn->raop->hevc) {
+        features |= (uint64_t) 1 << RAOP_FEATURE_SCREEN_MULTI_CODEC;
+    }
+    plist_t features_node = plist_new_uint(features);
     plist_dict_set_item(r_node, "features", features_node);
 
     plist_t name_node = plist_new_string(name);
@@ -100,9 +119,10 @@ raop_handler_info(raop_conn_t *conn,
     plist_t device_id_node = plist_new_string(hw_addr);
     plist_dict_set_item(r_node, "deviceID", device_id_node);
 
+    uint64_t audio_latency = raop_get_output_latency(conn->raop);
     plist_t audio_latencies_node = plist_new_array();
     plist_t audio_latencies_0_node = plist_new_dict();
-    plist_t audio_latencies_0_output_latency_micros_node = plist_new_uint(0);
+    plist_t audio_latencies_0_output_latency_micros_node = plist_new_uint(audio_latency);
     plist_t audio_latencies_0_type_node = plist_new_uint(100);
     plist_t audio_latencies_0_audio_type_node = plist_new_string("default");
     plist_t audio_latencies_0_input_latency_micros_node = plist_new_uint(0);
@@ -112,7 +132,7 @@ raop_handler_info(raop_conn_t *conn,
     plist_dict_set_item(audio_latencies_0_node, "inputLatencyMicros", audio_latencies_0_input_latency_micros_node);
     plist_array_append_item(audio_latencies_node, audio_latencies_0_node);
     plist_t audio_latencies_1_node = plist_new_dict();
-    plist_t audio_latencies_1_output_latency_micros_node = plist_new_uint(0);
+    plist_t audio_latencies_1_output_latency_micros_node = plist_new_uint(audio_latency);
     plist_t audio_latencies_1_type_node = plist_new_uint(101);
     plist_t audio_latencies_1_audio_type_node = plist_new_string("default");
     plist_t audio_latencies_1_input_latency_micros_node = plist_new_uint(0);
@@ -134,12 +154,18 @@ raop_handler_info(raop_conn_t *conn,
     plist_t displays_0_uuid_node = plist_new_string("e0ff8a27-6738-3d56-8a16-cc53aacee925");
     plist_t displays_0_width_physical_node = plist_new_uint(0);
     plist_t displays_0_height_physical_node = plist_new_uint(0);
-    plist_t displays_0_width_node = plist_new_uint(1920);
-    plist_t displays_0_height_node = plist_new_uint(1080);
-    plist_t displays_0_width_pixels_node = plist_new_uint(1920);
-    plist_t displays_0_height_pixels_node = plist_new_uint(1080);
+    // Under load new senders are asked for a smaller and slower stream
+    int degraded = load_monitor_get_level(conn->raop->load_monitor) != LOAD_LEVEL_NORMAL;
+    int display_width = degraded ? RAOP_DEGRADED_WIDTH : 1920;
+    int display_height = degraded ? RAOP_DEGRADED_HEIGHT : 1080;
+    int display_fps = degraded ? RAOP_DEGRADED_FPS : 60;
+    plist_t displays_0_width_node = plist_new_uint(display_width);
+    plist_t displays_0_height_node = plist_new_uint(display_height);
+    plist_t displays_0_width_pixels_node = plist_new_uint(display_width);
+    plist_t displays_0_height_pixels_node = plist_new_uint(display_height);
     plist_t displays_0_rotation_node = plist_new_bool(0);
-    plist_t displays_0_refresh_rate_node = plist_new_real(1.0 / 60.0);
+    plist_t displays_0_refresh_rate_node = plist_new_real(1.0 / display_fps);
+    plist_t displays_0_max_fps_node = plist_new_uint(display_fps);
     plist_t displays_0_overscanned_node = plist_new_bool(1);
     plist_t displays_0_features = plist_new_uint(14);
 
@@ -152,6 +178,7 @@ raop_handler_info(raop_conn_t *conn,
     plist_dict_set_item(displays_0_node, "heightPixels", displays_0_height_pixels_node);
     plist_dict_set_item(displays_0_node, "rotation", displays_0_rotation_node);
     plist_dict_set_item(displays_0_node, "refreshRate", displays_0_refresh_rate_node);
+    plist_dict_set_item(displays_0_node, "maxFPS", displays_0_max_fps_node);
     plist_dict_set_item(displays_0_node, "overscanned", displays_0_overscanned_node);
     plist_dict_set_item(displays_0_node, "features", displays_0_features);
     plist_array_append_item(displays_node, displays_0_node);
@@ -372,12 +399,30 @@ raop_handler_setup(raop_conn_t *conn,
         plist_get_uint_val(time_note, &timing_rport);
         logger_log(conn->raop->logger, LOGGER_DEBUG, "timing_rport = %llu", timing_rport);
 
+        // A sender that reconnects shortly after dropping gets its clock sync back
+        char *device_id = NULL;
+        plist_t device_id_node = plist_dict_get_item(req_root_node, "deviceID");
+        if (PLIST_IS_STRING(device_id_node)) {
+            plist_get_string_val(device_id_node, &device_id);
+        }
+        free(conn->device_id);
+        free(conn->dacp_id);
+        conn->device_id = device_id;
+        conn->dacp_id = dacp_id ? strdup(dacp_id) : NULL;
+
         unsigned short timing_lport;
+        raop_ntp_state_t ntp_state;
         conn->raop_ntp = raop_ntp_init(conn->raop->logger, conn->remote, conn->remotelen, timing_rport);
+        if ((conn->device_id || conn->dacp_id) &&
+            session_cache_lookup(conn->raop->session_cache, conn->device_id, conn->dacp_id, &ntp_state) == 0) {
+            logger_log(conn->raop->logger, LOGGER_INFO, "Resuming clock sync of previous session");
+            raop_ntp_set_state(conn->raop_ntp, &ntp_state);
+        }
         raop_ntp_start(conn->raop_ntp, &timing_lport);
 
         conn->raop_rtp = raop_rtp_init(conn->raop->logger, &conn->raop->callbacks, conn->raop_ntp, conn->remote, conn->remotelen, aeskey, aesiv, ecdh_secret);
-        conn->raop_rtp_mirror = raop_rtp_mirror_init(conn->raop->logger, &conn->raop->callbacks, conn->raop_ntp, conn->remote, conn->remotelen, aeskey, ecdh_secret);
+        conn->raop_rtp_mirror = raop_rtp_mirror_init(conn->raop->logger, &conn->raop->callbacks, conn->raop_ntp, conn->remote, conn->remotelen, aeskey, ecdh_secret,
+                                                       conn->raop->hevc, conn->raop->max_fps, conn->raop->load_monitor);
 
         plist_t res_event_port_node = plist_new_uint(conn->raop->port);
         plist_t res_timing_port_node = plist_new_uint(timing_lport);
@@ -571,6 +616,12 @@ raop_handler_record(raop_conn_t *conn,
                     char **response_data, int *response_datalen)
 {
     logger_log(conn->raop->logger, LOGGER_DEBUG, "raop_handler_record");
-    http_response_add_header(response, "Audio-Latency", "11025");
+
+    // In samples at 44.1 kHz. Without a measurement, stay with the customary quarter second
+    char audio_latency[16];
+    uint64_t latency = raop_get_output_latency(conn->raop);
+    snprintf(audio_latency, sizeof(audio_latency), "%llu", (unsigned long long) (latency ? latency * 44100 / 1000000 : 11025));
+    logger_log(conn->raop->logger, LOGGER_DEBUG, "Audio-Latency = %s", audio_latency);
+    http_response_add_header(response, "Audio-Latency", audio_latency);
     http_response_add_header(response, "Audio-Jack-Status", "connected; type=analog");
 }
@@ -27,7 +27,6 @@
 #include "netutils.h"
 #include "byteutils.h"
 
-#define RAOP_NTP_DATA_COUNT   8
 #define RAOP_NTP_PHI_PPM   15ull                   // PPM
 #define RAOP_NTP_R_RHO   ((1ull    << 32) / 1000u) // packet precision
 #define RAOP_NTP_S_RHO   ((1ull    << 32) / 1000u) // system clock precision
@@ -36,12 +35,9 @@
 
 #define RAOP_NTP_CLOCK_BASE (2208988800ull << 32)
 
-typedef struct raop_ntp_data_s {
-    uint64_t time; // The local wall clock time at time of ntp packet arrival
-    uint64_t dispersion;
-    int64_t delay; // The round trip delay
-    int64_t offset; // The difference between remote and local wall clock time
-} raop_ntp_data_t;
+// A resumed history is dropped if the first new measurement disagrees by more than this,
+// e.g. because the device rebooted in between
+#define RAOP_NTP_MAX_RESUME_DRIFT 100000ll // us
 
 struct raop_ntp_s {
     logger_t *logger;
@@ -61,6 +57,9 @@ struct raop_ntp_s {
     int64_t sync_dispersion;
     int64_t sync_delay;
 
+    // Whether the history was resumed from an earlier session and is not confirmed yet
+    int resumed;
+
     // Socket address of the AirPlay client
     struct sockaddr_storage remote_saddr;
     socklen_t remote_saddr_len;
@@ -181,6 +180,44 @@ raop_ntp_destroy(raop_ntp_t *raop_ntp)
     }
 }
 
+/**
+ * Copies the clock sync history. The history is written by the ntp thread, so
+ * this should only be called once raop_ntp_stop has returned.
+ */
+void
+raop_ntp_get_state(raop_ntp_t *raop_ntp, raop_ntp_state_t *state)
+{
+    assert(raop_ntp);
+
+    MUTEX_LOCK(raop_ntp->sync_params_mutex);
+    memcpy(state->data, raop_ntp->data, sizeof(state->data));
+    state->data_index = raop_ntp->data_index;
+    state->sync_offset = raop_ntp->sync_offset;
+    state->sync_dispersion = raop_ntp->sync_dispersion;
+    state->sync_delay = raop_ntp->sync_delay;
+    MUTEX_UNLOCK(raop_ntp->sync_params_mutex);
+}
+
+/**
+ * Seeds the clock sync with the history of an earlier session, so that remote
+ * timestamps can be converted right away instead of after the first exchanges.
+ * Must be called before raop_ntp_start.
+ */
+void
+raop_ntp_set_state(raop_ntp_t *raop_ntp, const raop_ntp_state_t *state)
+{
+    assert(raop_ntp);
+
+    MUTEX_LOCK(raop_ntp->sync_params_mutex);
+    memcpy(raop_ntp->data, state->data, sizeof(raop_ntp->data));
+    raop_ntp->data_index = state->data_index;
+    raop_ntp->sync_offset = state->sync_offset;
+    raop_ntp->sync_dispersion = state->sync_dispersion;
+    raop_ntp->sync_delay = state->sync_delay;
+    raop_ntp->resumed = 1;
+    MUTEX_UNLOCK(raop_ntp->sync_params_mutex);
+}
+
 unsigned short raop_ntp_get_port(raop_ntp_t *raop_ntp) {
     return raop_ntp->timing_lport;
 }
@@ -289,9 +326,23 @@ raop_ntp_thread(void *arg)
                 // For a little bonus confusion, they add SECONDS_FROM_1900_TO_1970 * 1000000 us.
                 // This means we have to expect some rather huge offset, but its growth or shrink over time should be small.
 
+                int64_t sample_offset = ((t1 - t0) + (t2 - t3)) / 2;
+                if (raop_ntp->resumed) {
+                    raop_ntp->resumed = 0;
+                    if (llabs(sample_offset - raop_ntp->sync_offset) > RAOP_NTP_MAX_RESUME_DRIFT) {
+                        logger_log(raop_ntp->logger, LOGGER_INFO, "raop_ntp resumed clock history is stale, starting over");
+                        for (int i = 0; i < RAOP_NTP_DATA_COUNT; ++i) {
+                            raop_ntp->data[i].offset     = 0ll;
+                            raop_ntp->data[i].delay      = RAOP_NTP_MAX_DISP;
+                            raop_ntp->data[i].dispersion = RAOP_NTP_MAX_DISP;
+                            raop_ntp->data[i].time      = t3;
+                        }
+                    }
+                }
+
                 raop_ntp->data_index = (raop_ntp->data_index + 1) % RAOP_NTP_DATA_COUNT;
                 raop_ntp->data[raop_ntp->data_index].time = t3;
-                raop_ntp->data[raop_ntp->data_index].offset     = ((t1 - t0) + (t2 - t3)) / 2;
+                raop_ntp->data[raop_ntp->data_index].offset     = sample_offset;
                 raop_ntp->data[raop_ntp->data_index].delay      = ((t3 - t0) - (t2 - t1));
                 raop_ntp->data[raop_ntp->data_index].dispersion = RAOP_NTP_R_RHO + RAOP_NTP_S_RHO +  (t3 - t0) * RAOP_NTP_PHI_PPM / 1000000u;
 
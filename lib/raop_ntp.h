@@ -22,6 +22,24 @@
 
 typedef struct raop_ntp_s raop_ntp_t;
 
+#define RAOP_NTP_DATA_COUNT   8
+
+typedef struct raop_ntp_data_s {
+    uint64_t time; // The local wall clock time at time of ntp packet arrival
+    uint64_t dispersion;
+    int64_t delay; // The round trip delay
+    int64_t offset; // The difference between remote and local wall clock time
+} raop_ntp_data_t;
+
+/* Clock sync history, kept across sessions with the same device to skip the cold start */
+typedef struct raop_ntp_state_s {
+    raop_ntp_data_t data[RAOP_NTP_DATA_COUNT];
+    int data_index;
+    int64_t sync_offset;
+    int64_t sync_dispersion;
+    int64_t sync_delay;
+} raop_ntp_state_t;
+
 raop_ntp_t *raop_ntp_init(logger_t *logger, const unsigned char *remote_addr, int remote_addr_len, unsigned short timing_rport);
 
 void raop_ntp_start(raop_ntp_t *raop_ntp, unsigned short *timing_lport);
@@ -32,6 +50,9 @@ unsigned short raop_ntp_get_port(raop_ntp_t *raop_ntp);
 
 void raop_ntp_destroy(raop_ntp_t *raop_rtp);
 
+void raop_ntp_get_state(raop_ntp_t *raop_ntp, raop_ntp_state_t *state);
+void raop_ntp_set_state(raop_ntp_t *raop_ntp, const raop_ntp_state_t *state);
+
 uint64_t raop_ntp_timestamp_to_micro_seconds(uint64_t ntp_timestamp, bool account_for_epoch_diff);
 
 uint64_t raop_ntp_get_local_time(raop_ntp_t *raop_ntp);
@@ -71,6 +71,7 @@ struct raop_rtp_s {
     int joined;
 
     float volume;
+    uint64_t volume_pts;
     int volume_changed;
     unsigned char *metadata;
     int metadata_len;
@@ -259,6 +260,7 @@ raop_rtp_process_events(raop_rtp_t *raop_rtp, void *cb_data)
 {
     int flush;
     float volume;
+    uint64_t volume_pts;
     int volume_changed;
     unsigned char *metadata;
     int metadata_len;
@@ -281,6 +283,7 @@ raop_rtp_process_events(raop_rtp_t *raop_rtp, void *cb_data)
 
     /* Read the volume level */
     volume = raop_rtp->volume;
+    volume_pts = raop_rtp->volume_pts;
     volume_changed = raop_rtp->volume_changed;
     raop_rtp->volume_changed = 0;
 
@@ -315,16 +318,16 @@ raop_rtp_process_events(raop_rtp_t *raop_rtp, void *cb_data)
 
     MUTEX_UNLOCK(raop_rtp->run_mutex);
 
-    /* Call set_volume callback if changed */
+    /* Call set_volume callback if changed, the renderer ramps to it without touching the buffered audio */
     if (volume_changed) {
-        raop_buffer_flush(raop_rtp->buffer, flush);
         if (raop_rtp->callbacks.audio_set_volume) {
-            raop_rtp->callbacks.audio_set_volume(raop_rtp->callbacks.cls, volume);
+            raop_rtp->callbacks.audio_set_volume(raop_rtp->callbacks.cls, volume, volume_pts);
         }
     }
 
     /* Handle flush if requested */
     if (flush != NO_FLUSH) {
+        raop_buffer_flush(raop_rtp->buffer, flush);
         if (raop_rtp->callbacks.audio_flush) {
             raop_rtp->callbacks.audio_flush(raop_rtp->callbacks.cls);
         }
@@ -567,9 +570,11 @@ raop_rtp_set_volume(raop_rtp_t *raop_rtp, float volume)
         volume = -144.0f;
     }
 
-    /* Set volume in thread instead */
+    /* Set volume in thread instead, but for the audio that plays from now on */
+    uint64_t pts = raop_ntp_get_local_time(raop_rtp->ntp);
     MUTEX_LOCK(raop_rtp->run_mutex);
     raop_rtp->volume = volume;
+    raop_rtp->volume_pts = pts;
     raop_rtp->volume_changed = 1;
     MUTEX_UNLOCK(raop_rtp->run_mutex);
 }
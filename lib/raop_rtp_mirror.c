@@ -28,6 +28,7 @@
 #include "logger.h"
 #include "byteutils.h"
 #include "mirror_buffer.h"
+#include "frame_decimator.h"
 #include "stream.h"
 
 
@@ -70,6 +71,18 @@ struct raop_rtp_mirror_s {
     int mirror_data_sock;
 
     unsigned short mirror_data_lport;
+
+    /* Codec announced by the last codec configuration, only used by the mirror thread */
+    video_codec_t codec;
+    /* Whether H.265 was offered to the sender, otherwise every configuration is avcC */
+    int hevc;
+
+    /* Drops frames beyond the wanted frame rate, NULL to decode all of them */
+    frame_decimator_t *decimator;
+
+    /* Shared by all sessions, told about every frame */
+    load_monitor_t *load_monitor;
+    int load_monitor_session;
 };
 
 static int
@@ -102,7 +115,8 @@ raop_rtp_parse_remote(raop_rtp_mirror_t *raop_rtp_mirror, const unsigned char *r
 #define NO_FLUSH (-42)
 raop_rtp_mirror_t *raop_rtp_mirror_init(logger_t *logger, raop_callbacks_t *callbacks, raop_ntp_t *ntp,
                                         const unsigned char *remote, int remotelen,
-                                        const unsigned char *aeskey, const unsigned char *ecdh_secret)
+                                        const unsigned char *aeskey, const unsigned char *ecdh_secret,
+                                        int hevc, int max_fps, load_monitor_t *load_monitor)
 {
     raop_rtp_mirror_t *raop_rtp_mirror;
 
@@ -115,6 +129,7 @@ raop_rtp_mirror_t *raop_rtp_mirror_init(logger_t *logger, raop_callbacks_t *call
     }
     raop_rtp_mirror->logger = logger;
     raop_rtp_mirror->ntp = ntp;
+    raop_rtp_mirror->load_monitor = load_monitor;
 
     memcpy(&raop_rtp_mirror->callbacks, callbacks, sizeof(raop_callbacks_t));
     raop_rtp_mirror->buffer = mirror_buffer_init(logger, aeskey, ecdh_secret);
@@ -129,6 +144,11 @@ raop_rtp_mirror_t *raop_rtp_mirror_init(logger_t *logger, raop_callbacks_t *call
     raop_rtp_mirror->running = 0;
     raop_rtp_mirror->joined = 1;
     raop_rtp_mirror->flush = NO_FLUSH;
+    raop_rtp_mirror->codec = VIDEO_CODEC_H264;
+    raop_rtp_mirror->hevc = hevc;
+    if (max_fps > 0) {
+        raop_rtp_mirror->decimator = frame_decimator_init(logger, max_fps);
+    }
 
     MUTEX_CREATE(raop_rtp_mirror->run_mutex);
     return raop_rtp_mirror;
@@ -140,6 +160,79 @@ raop_rtp_init_mirror_aes(raop_rtp_mirror_t *raop_rtp_mirror, uint64_t streamConn
     mirror_buffer_init_aes(raop_rtp_mirror->buffer, streamConnectionID);
 }
 
+/**
+ * Finds the HEVCDecoderConfigurationRecord in a codec configuration payload. It either comes
+ * wrapped in an hvc1 sample description, in which case we look for the hvcC box, or bare.
+ * A bare record is told apart from an avcC record by the reserved bits in its header.
+ */
+static const unsigned char *
+raop_rtp_mirror_find_hvcc(const unsigned char *payload, int payload_size, int *hvcc_len)
+{
+    for (int i = 4; i + 4 <= payload_size; i++) {
+        if (!memcmp(payload + i, "hvcC", 4)) {
+            int box_size = byteutils_get_int_be((unsigned char *) payload, i - 4);
+            *hvcc_len = payload_size - i - 4;
+            if (box_size >= 8 && box_size - 8 < *hvcc_len) {
+                *hvcc_len = box_size - 8;
+            }
+            return payload + i + 4;
+        }
+    }
+    if (payload_size > 23 && payload[0] == 1 &&
+        (payload[13] & 0xf0) == 0xf0 && (payload[15] & 0xfc) == 0xfc && (payload[16] & 0xfc) == 0xfc &&
+        (payload[17] & 0xf8) == 0xf8 && (payload[18] & 0xf8) == 0xf8) {
+        *hvcc_len = payload_size;
+        return payload;
+    }
+    return NULL;
+}
+
+/**
+ * Converts the VPS, SPS and PPS arrays of an hvcC record to NAL Byte-Stream Format.
+ * Returns the length of the newly allocated buffer or -1 if the record is malformed.
+ */
+static int
+raop_rtp_mirror_hvcc_to_annexb(const unsigned char *hvcc, int hvcc_len, unsigned char **annexb)
+{
+    int num_arrays, pos, out_len = 0;
+
+    if (hvcc_len < 23) {
+        return -1;
+    }
+    /* Every NAL grows by at most two bytes when the length is replaced by a start code */
+    *annexb = malloc(2 * hvcc_len);
+    if (!*annexb) {
+        return -1;
+    }
+
+    num_arrays = hvcc[22];
+    pos = 23;
+    for (int i = 0; i < num_arrays; i++) {
+        if (pos + 3 > hvcc_len) goto malformed;
+        int num_nalus = (hvcc[pos + 1] << 8) | hvcc[pos + 2];
+        pos += 3;
+        for (int j = 0; j < num_nalus; j++) {
+            if (pos + 2 > hvcc_len) goto malformed;
+            int nal_len = (hvcc[pos] << 8) | hvcc[pos + 1];
+            pos += 2;
+            if (pos + nal_len > hvcc_len) goto malformed;
+            (*annexb)[out_len++] = 0;
+            (*annexb)[out_len++] = 0;
+            (*annexb)[out_len++] = 0;
+            (*annexb)[out_len++] = 1;
+            memcpy(*annexb + out_len, hvcc + pos, nal_len);
+            out_len += nal_len;
+            pos += nal_len;
+        }
+    }
+    return out_len;
+
+malformed:
+    free(*annexb);
+    *annexb = NULL;
+    return -1;
+}
+
 //#define DUMP_H264
 
 #define RAOP_PACKET_LEN 32768
@@ -298,6 +391,9 @@ raop_rtp_mirror_thread(void *arg)
                 uint64_t ntp_now = raop_ntp_get_local_time(raop_rtp_mirror->ntp);
                 logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror video ntp = %llu, now = %llu, latency = %lld",
                            ntp_timestamp, ntp_now, ((int64_t) ntp_now) - ((int64_t) ntp_timestamp));
+                if (raop_rtp_mirror->load_monitor) {
+                    load_monitor_frame(raop_rtp_mirror->load_monitor, ((int64_t) ntp_now) - ((int64_t) ntp_timestamp));
+                }
 
 #ifdef DUMP_H264
                 fwrite(payload, payload_size, 1, file_source);
@@ -308,6 +404,18 @@ raop_rtp_mirror_thread(void *arg)
                 unsigned char* payload_decrypted = malloc(payload_size);
                 mirror_buffer_decrypt(raop_rtp_mirror->buffer, payload, payload_decrypted, payload_size);
 
+                // Skipped frames still had to be decrypted, the cipher stream runs across all of them
+                if (raop_rtp_mirror->decimator &&
+                    !frame_decimator_keep(raop_rtp_mirror->decimator, raop_rtp_mirror->codec,
+                                          payload_decrypted, payload_size, ntp_timestamp)) {
+                    free(payload_decrypted);
+                    free(payload);
+                    payload = NULL;
+                    memset(packet, 0, 128);
+                    readstart = 0;
+                    continue;
+                }
+
                 int nalu_type = payload[4] & 0x1f;
                 int nalu_size = 0;
                 int nalus_count = 0;
@@ -336,6 +444,7 @@ raop_rtp_mirror_thread(void *arg)
 #endif
 
                 h264_decode_struct h264_data;
+                h264_data.codec = raop_rtp_mirror->codec;
                 h264_data.data_len = payload_size;
                 h264_data.data = payload_decrypted;
                 h264_data.frame_type = 1;
@@ -345,7 +454,7 @@ raop_rtp_mirror_thread(void *arg)
                 free(payload_decrypted);
 
             } else if ((payload_type & 255) == 1) {
-                // The information in the payload contains an SPS and a PPS NAL
+                // The payload contains the codec configuration: SPS and PPS for H.264, VPS, SPS and PPS for H.265
 
                 float width_source = byteutils_get_float(packet, 40);
                 float height_source = byteutils_get_float(packet, 44);
@@ -354,52 +463,81 @@ raop_rtp_mirror_thread(void *arg)
                 logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror width_source = %f height_source = %f width = %f height = %f",
                            width_source, height_source, width, height);
 
-                // The sps_pps is not encrypted
-                h264codec_t h264;
-                h264.version = payload[0];
-                h264.profile_high = payload[1];
-                h264.compatibility = payload[2];
-                h264.level = payload[3];
-                h264.reserved_6_and_nal = payload[4];
-                h264.reserved_3_and_sps = payload[5];
-                h264.sps_size = (short) (((payload[6] & 255) << 8) + (payload[7] & 255));
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror sps size = %d", h264.sps_size);
-                h264.sequence_parameter_set = malloc(h264.sps_size);
-                memcpy(h264.sequence_parameter_set, payload + 8, h264.sps_size);
-                h264.number_of_pps = payload[h264.sps_size + 8];
-                h264.pps_size = (short) (((payload[h264.sps_size + 9] & 2040) + payload[h264.sps_size + 10]) & 255);
-                h264.picture_parameter_set = malloc(h264.pps_size);
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror pps size = %d", h264.pps_size);
-                memcpy(h264.picture_parameter_set, payload + h264.sps_size + 11, h264.pps_size);
-
-                if (h264.sps_size + h264.pps_size < 102400) {
-                    // Copy the sps and pps into a buffer to hand to the decoder
-                    int sps_pps_len = (h264.sps_size + h264.pps_size) + 8;
-                    unsigned char sps_pps[sps_pps_len];
-                    sps_pps[0] = 0;
-                    sps_pps[1] = 0;
-                    sps_pps[2] = 0;
-                    sps_pps[3] = 1;
-                    memcpy(sps_pps + 4, h264.sequence_parameter_set, h264.sps_size);
-                    sps_pps[h264.sps_size + 4] = 0;
-                    sps_pps[h264.sps_size + 5] = 0;
-                    sps_pps[h264.sps_size + 6] = 0;
-                    sps_pps[h264.sps_size + 7] = 1;
-                    memcpy(sps_pps + h264.sps_size + 8, h264.picture_parameter_set, h264.pps_size);
+                // The codec configuration is not encrypted
+                int hvcc_len = 0;
+                const unsigned char *hvcc = raop_rtp_mirror->hevc ?
+                                            raop_rtp_mirror_find_hvcc(payload, payload_size, &hvcc_len) : NULL;
+                if (hvcc) {
+                    // H.265: hand the VPS, SPS and PPS to the decoder
+                    unsigned char *vps_sps_pps = NULL;
+                    int vps_sps_pps_len = raop_rtp_mirror_hvcc_to_annexb(hvcc, hvcc_len, &vps_sps_pps);
+                    if (vps_sps_pps_len > 0) {
+                        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror hevc parameter sets size = %d", vps_sps_pps_len);
+                        raop_rtp_mirror->codec = VIDEO_CODEC_H265;
+                        if (raop_rtp_mirror->decimator) frame_decimator_reset(raop_rtp_mirror->decimator);
+
+                        h264_decode_struct h265_data;
+                        h265_data.codec = VIDEO_CODEC_H265;
+                        h265_data.data_len = vps_sps_pps_len;
+                        h265_data.data = vps_sps_pps;
+                        h265_data.frame_type = 0;
+                        h265_data.pts = 0;
+                        raop_rtp_mirror->callbacks.video_process(raop_rtp_mirror->callbacks.cls, raop_rtp_mirror->ntp, &h265_data);
+                        free(vps_sps_pps);
+                    } else {
+                        logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror malformed hvcC record");
+                    }
+                } else {
+                    raop_rtp_mirror->codec = VIDEO_CODEC_H264;
+                    if (raop_rtp_mirror->decimator) frame_decimator_reset(raop_rtp_mirror->decimator);
+
+                    h264codec_t h264;
+                    h264.version = payload[0];
+                    h264.profile_high = payload[1];
+                    h264.compatibility = payload[2];
+                    h264.level = payload[3];
+                    h264.reserved_6_and_nal = payload[4];
+                    h264.reserved_3_and_sps = payload[5];
+                    h264.sps_size = (short) (((payload[6] & 255) << 8) + (payload[7] & 255));
+                    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror sps size = %d", h264.sps_size);
+                    h264.sequence_parameter_set = malloc(h264.sps_size);
+                    memcpy(h264.sequence_parameter_set, payload + 8, h264.sps_size);
+                    h264.number_of_pps = payload[h264.sps_size + 8];
+                    h264.pps_size = (short) (((payload[h264.sps_size + 9] & 2040) + payload[h264.sps_size + 10]) & 255);
+                    h264.picture_parameter_set = malloc(h264.pps_size);
+                    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror pps size = %d", h264.pps_size);
+                    memcpy(h264.picture_parameter_set, payload + h264.sps_size + 11, h264.pps_size);
+
+                    if (h264.sps_size + h264.pps_size < 102400) {
+                        // Copy the sps and pps into a buffer to hand to the decoder
+                        int sps_pps_len = (h264.sps_size + h264.pps_size) + 8;
+                        unsigned char sps_pps[sps_pps_len];
+                        sps_pps[0] = 0;
+                        sps_pps[1] = 0;
+                        sps_pps[2] = 0;
+                        sps_pps[3] = 1;
+                        memcpy(sps_pps + 4, h264.sequence_parameter_set, h264.sps_size);
+                        sps_pps[h264.sps_size + 4] = 0;
+                        sps_pps[h264.sps_size + 5] = 0;
+                        sps_pps[h264.sps_size + 6] = 0;
+                        sps_pps[h264.sps_size + 7] = 1;
+                        memcpy(sps_pps + h264.sps_size + 8, h264.picture_parameter_set, h264.pps_size);
 
 #ifdef DUMP_H264
-                    fwrite(sps_pps, sps_pps_len, 1, file);
+                        fwrite(sps_pps, sps_pps_len, 1, file);
 #endif
 
-                    h264_decode_struct h264_data;
-                    h264_data.data_len = sps_pps_len;
-                    h264_data.data = sps_pps;
-                    h264_data.frame_type = 0;
-                    h264_data.pts = 0;
-                    raop_rtp_mirror->callbacks.video_process(raop_rtp_mirror->callbacks.cls, raop_rtp_mirror->ntp, &h264_data);
+                        h264_decode_struct h264_data;
+                        h264_data.codec = VIDEO_CODEC_H264;
+                        h264_data.data_len = sps_pps_len;
+                        h264_data.data = sps_pps;
+                        h264_data.frame_type = 0;
+                        h264_data.pts = 0;
+                        raop_rtp_mirror->callbacks.video_process(raop_rtp_mirror->callbacks.cls, raop_rtp_mirror->ntp, &h264_data);
+                    }
+                    free(h264.picture_parameter_set);
+                    free(h264.sequence_parameter_set);
                 }
-                free(h264.picture_parameter_set);
-                free(h264.sequence_parameter_set);
             }
 
             free(payload);
@@ -460,6 +598,10 @@ raop_rtp_start_mirror(raop_rtp_mirror_t *raop_rtp_mirror, int use_udp, unsigned
     raop_rtp_mirror->joined = 0;
 
     THREAD_CREATE(raop_rtp_mirror->thread_mirror, raop_rtp_mirror_thread, raop_rtp_mirror);
+    if (raop_rtp_mirror->load_monitor && !raop_rtp_mirror->load_monitor_session) {
+        load_monitor_session_started(raop_rtp_mirror->load_monitor);
+        raop_rtp_mirror->load_monitor_session = 1;
+    }
     MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
 }
 
@@ -493,8 +635,13 @@ void raop_rtp_mirror_stop(raop_rtp_mirror_t *raop_rtp_mirror) {
 void raop_rtp_mirror_destroy(raop_rtp_mirror_t *raop_rtp_mirror) {
     if (raop_rtp_mirror) {
         raop_rtp_mirror_stop(raop_rtp_mirror);
+        // The thread may also have ended on its own when the sender closed the stream
+        if (raop_rtp_mirror->load_monitor_session) {
+            load_monitor_session_stopped(raop_rtp_mirror->load_monitor);
+        }
         MUTEX_DESTROY(raop_rtp_mirror->run_mutex);
         mirror_buffer_destroy(raop_rtp_mirror->buffer);
+        if (raop_rtp_mirror->decimator) frame_decimator_destroy(raop_rtp_mirror->decimator);
         free(raop_rtp_mirror);
     }
 }
@@ -0,0 +1,153 @@
+/**
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "session_cache.h"
+#include "threads.h"
+
+#define SESSION_CACHE_KEY_SIZE 128
+
+typedef struct session_cache_entry_s {
+    char key[SESSION_CACHE_KEY_SIZE];
+    uint64_t stored; // Monotonic time of storage in us, 0 for a free slot
+    raop_ntp_state_t ntp_state;
+} session_cache_entry_t;
+
+struct session_cache_s {
+    mutex_handle_t mutex;
+    uint64_t lifetime_us;
+    int max_entries;
+    session_cache_entry_t *entries;
+};
+
+static uint64_t
+session_cache_now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000ull + (uint64_t) time.tv_nsec / 1000u;
+}
+
+static int
+session_cache_make_key(char key[SESSION_CACHE_KEY_SIZE], const char *device_id, const char *dacp_id)
+{
+    if (!device_id && !dacp_id) {
+        return -1;
+    }
+    int len = snprintf(key, SESSION_CACHE_KEY_SIZE, "%s|%s", device_id ? device_id : "", dacp_id ? dacp_id : "");
+    return (len < 0 || len >= SESSION_CACHE_KEY_SIZE) ? -1 : 0;
+}
+
+session_cache_t *
+session_cache_init(int max_entries, uint64_t lifetime_us)
+{
+    session_cache_t *cache;
+
+    assert(max_entries > 0);
+
+    cache = calloc(1, sizeof(session_cache_t));
+    if (!cache) {
+        return NULL;
+    }
+    cache->entries = calloc(max_entries, sizeof(session_cache_entry_t));
+    if (!cache->entries) {
+        free(cache);
+        return NULL;
+    }
+    cache->max_entries = max_entries;
+    cache->lifetime_us = lifetime_us;
+    MUTEX_CREATE(cache->mutex);
+    return cache;
+}
+
+void
+session_cache_destroy(session_cache_t *cache)
+{
+    if (cache) {
+        MUTEX_DESTROY(cache->mutex);
+        free(cache->entries);
+        free(cache);
+    }
+}
+
+void
+session_cache_store(session_cache_t *cache, const char *device_id, const char *dacp_id,
+                    const raop_ntp_state_t *ntp_state)
+{
+    char key[SESSION_CACHE_KEY_SIZE];
+    session_cache_entry_t *slot = NULL;
+
+    assert(cache);
+    if (session_cache_make_key(key, device_id, dacp_id) < 0) {
+        return;
+    }
+
+    MUTEX_LOCK(cache->mutex);
+    uint64_t now = session_cache_now();
+    // Reuse the entry of the same device, else a free or expired one, else the oldest
+    for (int i = 0; i < cache->max_entries && !slot; i++) {
+        if (cache->entries[i].stored && !strcmp(cache->entries[i].key, key)) {
+            slot = &cache->entries[i];
+        }
+    }
+    for (int i = 0; i < cache->max_entries && !slot; i++) {
+        if (!cache->entries[i].stored || now - cache->entries[i].stored > cache->lifetime_us) {
+            slot = &cache->entries[i];
+        }
+    }
+    if (!slot) {
+        slot = &cache->entries[0];
+        for (int i = 1; i < cache->max_entries; i++) {
+            if (cache->entries[i].stored < slot->stored) {
+                slot = &cache->entries[i];
+            }
+        }
+    }
+    memcpy(slot->key, key, sizeof(key));
+    slot->stored = now;
+    slot->ntp_state = *ntp_state;
+    MUTEX_UNLOCK(cache->mutex);
+}
+
+int
+session_cache_lookup(session_cache_t *cache, const char *device_id, const char *dacp_id,
+                     raop_ntp_state_t *ntp_state)
+{
+    char key[SESSION_CACHE_KEY_SIZE];
+    int ret = -1;
+
+    assert(cache);
+    if (session_cache_make_key(key, device_id, dacp_id) < 0) {
+        return -1;
+    }
+
+    MUTEX_LOCK(cache->mutex);
+    uint64_t now = session_cache_now();
+    for (int i = 0; i < cache->max_entries; i++) {
+        session_cache_entry_t *entry = &cache->entries[i];
+        if (entry->stored && !strcmp(entry->key, key)) {
+            if (now - entry->stored <= cache->lifetime_us) {
+                *ntp_state = entry->ntp_state;
+                ret = 0;
+            }
+            entry->stored = 0;
+            break;
+        }
+    }
+    MUTEX_UNLOCK(cache->mutex);
+    return ret;
+}
@@ -0,0 +1,38 @@
+/**
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+/*
+ * Short-lived per-device cache of session state, so that a sender that
+ * reconnects shortly after dropping (screen lock, Wi-Fi roaming) does not
+ * start over from scratch. Entries are keyed by the sender's device ID and
+ * DACP-ID and expire after a fixed lifetime.
+ */
+
+#ifndef SESSION_CACHE_H
+#define SESSION_CACHE_H
+
+#include <stdint.h>
+#include "raop_ntp.h"
+
+typedef struct session_cache_s session_cache_t;
+
+session_cache_t *session_cache_init(int max_entries, uint64_t lifetime_us);
+void session_cache_destroy(session_cache_t *cache);
+
+/* Either id may be NULL, but not both */
+void session_cache_store(session_cache_t *cache, const char *device_id, const char *dacp_id,
+                         const raop_ntp_state_t *ntp_state);
+/* Returns 0 and removes the entry if a live one was found, -1 otherwise */
+int session_cache_lookup(session_cache_t *cache, const char *device_id, const char *dacp_id,
+                         raop_ntp_state_t *ntp_state);
+
+#endif //SESSION_CACHE_H
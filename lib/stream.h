@@ -17,7 +17,13 @@
 
 #include <stdint.h>
 
+typedef enum video_codec_e {
+    VIDEO_CODEC_H264,
+    VIDEO_CODEC_H265
+} video_codec_t;
+
 typedef struct {
+    video_codec_t codec;
     int n_gop_index;
     int frame_type;
     int n_frame_poc;
@@ -66,12 +66,14 @@ void TouchHandler::set_touch_callback(TouchCallback callback) {
 }
 
 void TouchHandler::set_screen_resolution(int width, int height) {
+    std::lock_guard<std::mutex> lock(mapping_mutex_);
     screen_width_ = width;
     screen_height_ = height;
     std::cout << "Touch screen resolution set to " << width << "x" << height << std::endl;
 }
 
 void TouchHandler::set_coordinate_mapping(int rpi_width, int rpi_height, int target_width, int target_height) {
+    std::lock_guard<std::mutex> lock(mapping_mutex_);
     screen_width_ = rpi_width;
     screen_height_ = rpi_height;
     target_width_ = target_width;
@@ -228,6 +230,7 @@ void TouchHandler::process_event(const struct input_event& event) {
 }
 
 void TouchHandler::map_coordinates(int rpi_x, int rpi_y, int& target_x, int& target_y) {
+    std::lock_guard<std::mutex> lock(mapping_mutex_);
     // Map from RPi screen coordinates to iPhone screen coordinates
     target_x = (rpi_x * target_width_) / screen_width_;
     target_y = (rpi_y * target_height_) / screen_height_;
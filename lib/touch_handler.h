@@ -4,6 +4,7 @@
 #include <string>
 #include <thread>
 #include <atomic>
+#include <mutex>
 #include <functional>
 #include <linux/input.h>
 
@@ -63,6 +64,9 @@ private:
     std::thread event_thread_;
     TouchCallback touch_callback_;
     
+    // Guards the dimensions below, the mapping may change while events are processed
+    std::mutex mapping_mutex_;
+
     // Screen dimensions
     int screen_width_;
     int screen_height_;
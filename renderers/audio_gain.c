@@ -0,0 +1,236 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include "audio_gain.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include "../lib/threads.h"
+#include "audio_gain_simd.h"
+
+#if defined(AUDIO_GAIN_NEON) && defined(__arm__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+/* Gains are Q15 fixed point, so that unity is 32768 and everything below fits a 16 bit lane */
+#define GAIN_UNITY 32768
+#define RAMP_MS 20
+#define MAX_PENDING 8
+/* Changes scheduled further ahead than this are taken to be on another timeline and applied right away */
+#define MAX_SCHEDULE_AHEAD 2000000
+
+typedef int (*audio_gain_kernel_t)(int16_t *samples, int count, int32_t gain);
+
+typedef struct audio_gain_change_s {
+    uint64_t pts;
+    int32_t gain;
+} audio_gain_change_t;
+
+struct audio_gain_s {
+    int sample_rate;
+    int ramp_frames;
+    audio_gain_kernel_t kernel;   // NULL when the CPU has no vector unit we can use
+
+    /* MUTEX LOCKED VARIABLES START */
+    mutex_handle_t mutex;
+    /* Changes that are not due yet, in pts order */
+    audio_gain_change_t pending[MAX_PENDING];
+    int pending_count;
+    /* MUTEX LOCKED VARIABLES END */
+
+    /* Only used by the thread applying the gain */
+    int32_t current;
+    int32_t target;
+    int64_t ramp;       // current gain << 16 while ramping
+    int64_t ramp_step;
+    int ramp_left;      // frames
+};
+
+/* Same curve as the OpenMAX volume used before: two dB per dB of AirPlay volume, -30 dB and below is mute */
+static int32_t
+audio_gain_from_volume(float volume)
+{
+    if (volume <= -30.0f) {
+        return 0;
+    }
+    if (volume >= 0.0f) {
+        return GAIN_UNITY;
+    }
+    return (int32_t) lrintf(GAIN_UNITY * powf(10.0f, volume / 10.0f));
+}
+
+/* The kernels are built whenever the compiler can, the CPU decides which one runs */
+static audio_gain_kernel_t
+audio_gain_select_kernel(void)
+{
+#if defined(AUDIO_GAIN_NEON) && defined(__arm__)
+    // 32 bit builds also run on the ARMv6 of the Pi 1 and Zero, which have no NEON
+    if (getauxval(AT_HWCAP) & HWCAP_NEON) {
+        return audio_gain_scale_neon;
+    }
+#elif defined(AUDIO_GAIN_NEON)
+    return audio_gain_scale_neon;
+#elif defined(AUDIO_GAIN_SSSE3)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3")) {
+        return audio_gain_scale_ssse3;
+    }
+#endif
+    return NULL;
+}
+
+/* Multiplies count samples with a constant gain below unity, rounding to nearest */
+static void
+audio_gain_scale(audio_gain_kernel_t kernel, int16_t *samples, int count, int32_t gain)
+{
+    int i = 0;
+    assert(gain >= 0 && gain < GAIN_UNITY);
+
+    // The vector instructions round the same way as the scalar loop for the tail
+    if (kernel) {
+        i = kernel(samples, count, gain);
+    }
+    for (; i < count; i++) {
+        samples[i] = (int16_t) ((samples[i] * gain + (1 << 14)) >> 15);
+    }
+}
+
+/* Ramps the gain one step per frame, so all channels of a frame get the same gain */
+static void
+audio_gain_scale_ramp(audio_gain_t *gain, int16_t *samples, int frames, int channels)
+{
+    for (int i = 0; i < frames; i++) {
+        int32_t frame_gain = (int32_t) (gain->ramp >> 16);
+        for (int c = 0; c < channels; c++) {
+            int16_t *sample = samples + i * channels + c;
+            *sample = (int16_t) ((*sample * frame_gain + (1 << 14)) >> 15);
+        }
+        gain->ramp += gain->ramp_step;
+    }
+    gain->ramp_left -= frames;
+    gain->current = gain->ramp_left ? (int32_t) (gain->ramp >> 16) : gain->target;
+}
+
+static void
+audio_gain_run(audio_gain_t *gain, int16_t *samples, int frames, int channels)
+{
+    if (frames > 0 && gain->ramp_left > 0) {
+        int ramp_frames = frames < gain->ramp_left ? frames : gain->ramp_left;
+        audio_gain_scale_ramp(gain, samples, ramp_frames, channels);
+        samples += ramp_frames * channels;
+        frames -= ramp_frames;
+    }
+    if (frames > 0 && gain->current != GAIN_UNITY) {
+        audio_gain_scale(gain->kernel, samples, frames * channels, gain->current);
+    }
+}
+
+static void
+audio_gain_start_ramp(audio_gain_t *gain, int32_t target)
+{
+    if (target == gain->current) {
+        gain->ramp_left = 0;
+        return;
+    }
+    gain->target = target;
+    gain->ramp = (int64_t) gain->current << 16;
+    gain->ramp_step = (((int64_t) target << 16) - gain->ramp) / gain->ramp_frames;
+    gain->ramp_left = gain->ramp_frames;
+}
+
+audio_gain_t *
+audio_gain_init(int sample_rate)
+{
+    audio_gain_t *gain;
+
+    assert(sample_rate > 0);
+
+    gain = calloc(1, sizeof(audio_gain_t));
+    if (!gain) {
+        return NULL;
+    }
+    gain->sample_rate = sample_rate;
+    gain->ramp_frames = sample_rate * RAMP_MS / 1000;
+    gain->current = gain->target = GAIN_UNITY;
+    gain->kernel = audio_gain_select_kernel();
+    MUTEX_CREATE(gain->mutex);
+    return gain;
+}
+
+void
+audio_gain_set_volume(audio_gain_t *gain, float volume, uint64_t pts)
+{
+    audio_gain_change_t change = { pts, audio_gain_from_volume(volume) };
+
+    MUTEX_LOCK(gain->mutex);
+    // A newer change replaces those scheduled at or after its own time
+    while (gain->pending_count > 0 && gain->pending[gain->pending_count - 1].pts >= pts) {
+        gain->pending_count--;
+    }
+    if (gain->pending_count == MAX_PENDING) {
+        // Only the end point matters while the slider is being dragged
+        gain->pending[MAX_PENDING - 1].gain = change.gain;
+    } else {
+        gain->pending[gain->pending_count++] = change;
+    }
+    MUTEX_UNLOCK(gain->mutex);
+}
+
+void
+audio_gain_apply(audio_gain_t *gain, int16_t *samples, int frames, int channels, uint64_t pts)
+{
+    audio_gain_change_t due[MAX_PENDING];
+    int due_count = 0;
+    uint64_t end = pts + (uint64_t) frames * 1000000 / gain->sample_rate;
+
+    MUTEX_LOCK(gain->mutex);
+    while (due_count < gain->pending_count &&
+           (gain->pending[due_count].pts < end || gain->pending[due_count].pts - end > MAX_SCHEDULE_AHEAD)) {
+        due_count++;
+    }
+    memcpy(due, gain->pending, due_count * sizeof(audio_gain_change_t));
+    gain->pending_count -= due_count;
+    memmove(gain->pending, gain->pending + due_count, gain->pending_count * sizeof(audio_gain_change_t));
+    MUTEX_UNLOCK(gain->mutex);
+
+    // Every change starts its ramp at the frame it was scheduled for, earlier ones at the first frame
+    int pos = 0;
+    for (int i = 0; i < due_count; i++) {
+        int start = pos;
+        if (due[i].pts > pts && due[i].pts < end) {
+            start = (int) ((due[i].pts - pts) * gain->sample_rate / 1000000);
+            if (start < pos) start = pos;
+        }
+        audio_gain_run(gain, samples + pos * channels, start - pos, channels);
+        pos = start;
+        audio_gain_start_ramp(gain, due[i].gain);
+    }
+    audio_gain_run(gain, samples + pos * channels, frames - pos, channels);
+}
+
+void
+audio_gain_destroy(audio_gain_t *gain)
+{
+    if (gain) {
+        MUTEX_DESTROY(gain->mutex);
+        free(gain);
+    }
+}
@@ -0,0 +1,57 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Software volume for decoded 16 bit PCM. Volume changes are scheduled at a
+ * timestamp on the audio timeline and take effect at exactly that sample,
+ * ramping over a few milliseconds so that they do not click. Until a change
+ * is due the samples keep the previous gain, so nothing has to be flushed.
+ * Unity gain leaves the samples untouched.
+*/
+
+#ifndef AUDIO_GAIN_H
+#define AUDIO_GAIN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+typedef struct audio_gain_s audio_gain_t;
+
+audio_gain_t *audio_gain_init(int sample_rate);
+
+/**
+ * Schedules a change to the AirPlay volume, from 0 dB down to -30 dB and
+ * -144 dB for mute, at the given pts in microseconds. May be called from any
+ * thread.
+ */
+void audio_gain_set_volume(audio_gain_t *gain, float volume, uint64_t pts);
+
+/* Applies the gain in place to interleaved samples, pts is that of the first frame */
+void audio_gain_apply(audio_gain_t *gain, int16_t *samples, int frames, int channels, uint64_t pts);
+
+void audio_gain_destroy(audio_gain_t *gain);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //AUDIO_GAIN_H
@@ -0,0 +1,51 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include "audio_gain_simd.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+
+int
+audio_gain_scale_neon(int16_t *samples, int count, int32_t gain)
+{
+    int i = 0;
+    int16x8_t gain_vector = vdupq_n_s16((int16_t) gain);
+    for (; i + 8 <= count; i += 8) {
+        vst1q_s16(samples + i, vqrdmulhq_s16(vld1q_s16(samples + i), gain_vector));
+    }
+    return i;
+}
+#endif
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+
+int
+audio_gain_scale_ssse3(int16_t *samples, int count, int32_t gain)
+{
+    int i = 0;
+    __m128i gain_vector = _mm_set1_epi16((short) gain);
+    for (; i + 8 <= count; i += 8) {
+        __m128i s = _mm_loadu_si128((const __m128i *) (samples + i));
+        _mm_storeu_si128((__m128i *) (samples + i), _mm_mulhrs_epi16(s, gain_vector));
+    }
+    return i;
+}
+#endif
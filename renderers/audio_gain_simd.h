@@ -0,0 +1,39 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Vector kernels for the gain stage. They are compiled with the instruction
+ * set flags they need, so audio_gain.c only calls them after checking that
+ * the CPU rpiplay runs on has those instructions.
+ */
+
+#ifndef AUDIO_GAIN_SIMD_H
+#define AUDIO_GAIN_SIMD_H
+
+#include <stdint.h>
+
+/*
+ * Multiply the samples with a Q15 gain below unity, rounding to nearest, in
+ * blocks of eight. Return how many samples were done, the rest are left for
+ * the caller.
+ */
+int audio_gain_scale_neon(int16_t *samples, int count, int32_t gain);
+int audio_gain_scale_ssse3(int16_t *samples, int count, int32_t gain);
+
+#endif //AUDIO_GAIN_SIMD_H
@@ -41,6 +41,7 @@ typedef enum audio_renderer_type_e {
 typedef struct audio_renderer_config_s {
     audio_device_t device;
     bool low_latency;
+    renderer_probe_t const *probe; // NULL in normal operation
 } audio_renderer_config_t;
 
 typedef struct audio_renderer_s audio_renderer_t;
@@ -48,9 +49,25 @@ typedef struct audio_renderer_s audio_renderer_t;
 typedef struct audio_renderer_funcs_s {
     void (*start)(audio_renderer_t *renderer);
     void (*render_buffer)(audio_renderer_t *renderer, raop_ntp_t *ntp, unsigned char *data, int data_len, uint64_t pts);
-    void (*set_volume)(audio_renderer_t *renderer, float volume);
+    /**
+     * Changes the volume from the given pts on, without disturbing the audio
+     * queued before it. volume is the AirPlay volume in dB, 0 to -30 and -144
+     * for mute.
+     */
+    void (*set_volume)(audio_renderer_t *renderer, float volume, uint64_t pts);
     void (*flush)(audio_renderer_t *renderer);
     void (*destroy)(audio_renderer_t *renderer);
+    /**
+     * Measured time from render_buffer until the samples are played, in
+     * microseconds. 0 if the renderer cannot tell (yet).
+     */
+    uint64_t (*get_latency)(audio_renderer_t *renderer);
+    /**
+     * Switch the output device of the running renderer, AUDIO_DEVICE_NONE
+     * mutes it. Returns false if the renderer cannot switch. May be called from
+     * any thread.
+     */
+    bool (*set_device)(audio_renderer_t *renderer, audio_device_t device);
 } audio_renderer_funcs_t;
 
 typedef struct audio_renderer_s {
@@ -50,7 +50,7 @@ static void audio_renderer_dummy_start(audio_renderer_t *renderer) {
 static void audio_renderer_dummy_render_buffer(audio_renderer_t *renderer, raop_ntp_t *ntp, unsigned char *data, int data_len, uint64_t pts) {
 }
 
-static void audio_renderer_dummy_set_volume(audio_renderer_t *renderer, float volume) {
+static void audio_renderer_dummy_set_volume(audio_renderer_t *renderer, float volume, uint64_t pts) {
 }
 
 static void audio_renderer_dummy_flush(audio_renderer_t *renderer) {
@@ -62,10 +62,20 @@ static void audio_renderer_dummy_destroy(audio_renderer_t *renderer) {
     }
 }
 
+static uint64_t audio_renderer_dummy_get_latency(audio_renderer_t *renderer) {
+    return 0;
+}
+
+static bool audio_renderer_dummy_set_device(audio_renderer_t *renderer, audio_device_t device) {
+    return true;
+}
+
 static const audio_renderer_funcs_t audio_renderer_dummy_funcs = {
     .start = audio_renderer_dummy_start,
     .render_buffer = audio_renderer_dummy_render_buffer,
     .set_volume = audio_renderer_dummy_set_volume,
     .flush = audio_renderer_dummy_flush,
     .destroy = audio_renderer_dummy_destroy,
+    .get_latency = audio_renderer_dummy_get_latency,
+    .set_device = audio_renderer_dummy_set_device,
 };
@@ -18,8 +18,9 @@
  */
 
 #include "audio_renderer.h"
+#include "gstreamer_latency.h"
+#include "audio_gain.h"
 #include <assert.h>
-#include <math.h>
 #include <gst/app/gstappsrc.h>
 
 typedef struct audio_renderer_gstreamer_s {
@@ -27,10 +28,81 @@ typedef struct audio_renderer_gstreamer_s {
     GstElement *appsrc;
     GstElement *pipeline;
     GstElement *volume;
+    GstElement *sink;
+    gstreamer_latency_t *latency;
+    audio_gain_t *gain;
+    /* autoaudiosink plays wherever the system default points, this is only what was asked for */
+    audio_device_t device;
 } audio_renderer_gstreamer_t;
 
 static const audio_renderer_funcs_t audio_renderer_gstreamer_funcs;
 
+static GstPadProbeReturn audio_queued_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    renderer_probe_t const *probe = user_data;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstMapInfo map;
+
+    if (gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        probe->audio_queued(probe->cls, GST_BUFFER_PTS(buffer), map.data, map.size);
+        gst_buffer_unmap(buffer, &map);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn audio_decoded_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    renderer_probe_t const *probe = user_data;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    GstMapInfo map;
+    gint channels = 0;
+
+    if (caps) {
+        gst_structure_get_int(gst_caps_get_structure(caps, 0), "channels", &channels);
+        gst_caps_unref(caps);
+    }
+    // The caps filter after audioconvert guarantees interleaved S16LE
+    if (channels && gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        probe->audio_decoded(probe->cls, GST_BUFFER_PTS(buffer), (const int16_t *) map.data,
+                             map.size / (sizeof(int16_t) * channels), channels);
+        gst_buffer_unmap(buffer, &map);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn audio_gain_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    audio_gain_t *gain = user_data;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    GstMapInfo map;
+    gint channels = 0;
+
+    if (caps) {
+        gst_structure_get_int(gst_caps_get_structure(caps, 0), "channels", &channels);
+        gst_caps_unref(caps);
+    }
+    if (!channels) {
+        return GST_PAD_PROBE_OK;
+    }
+    // The samples are scaled in place, so the buffer must not be shared
+    buffer = gst_buffer_make_writable(buffer);
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+    if (gst_buffer_map(buffer, &map, GST_MAP_READWRITE)) {
+        audio_gain_apply(gain, (int16_t *) map.data, map.size / (sizeof(int16_t) * channels), channels,
+                         GST_BUFFER_PTS(buffer));
+        gst_buffer_unmap(buffer, &map);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+static void add_buffer_probe(GstElement *pipeline, const char *name, const char *pad_name,
+                             GstPadProbeCallback callback, gconstpointer user_data) {
+    GstElement *element = gst_bin_get_by_name(GST_BIN(pipeline), name);
+    GstPad *pad = gst_element_get_static_pad(element, pad_name);
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, callback, (gpointer) user_data, NULL);
+    gst_object_unref(pad);
+    gst_object_unref(element);
+}
+
 static gboolean check_plugins(void)
 {
     int i;
@@ -64,6 +136,7 @@ audio_renderer_t *audio_renderer_gstreamer_init(logger_t *logger, video_renderer
     renderer->base.logger = logger;
     renderer->base.funcs = &audio_renderer_gstreamer_funcs;
     renderer->base.type = AUDIO_RENDERER_GSTREAMER;
+    renderer->device = config->device;
     
     // If the video renderer is not a gstreamer renderer, we need to initialize gstreamer
     if (!video_renderer || video_renderer->type != VIDEO_RENDERER_GSTREAMER) {
@@ -72,12 +145,34 @@ audio_renderer_t *audio_renderer_gstreamer_init(logger_t *logger, video_renderer
 
     assert(check_plugins());
 
-    renderer->pipeline = gst_parse_launch("appsrc name=audio_source stream-type=0 format=GST_FORMAT_TIME is-live=true ! queue ! decodebin !"
-    "audioconvert ! volume name=volume ! level ! autoaudiosink sync=false", &error);
+    // The volume element only mutes, the volume itself is applied by the gain stage on its sink pad
+    const char *sink = config->probe ? "fakesink name=audio_sink sync=false" :
+                                       "audioconvert ! autoaudiosink name=audio_sink sync=false";
+    gchar *launch = g_strdup_printf("appsrc name=audio_source stream-type=0 format=GST_FORMAT_TIME is-live=true ! "
+                                    "queue name=audio_queue ! decodebin ! audioconvert ! "
+                                    "audio/x-raw,format=S16LE,layout=interleaved ! volume name=volume ! level ! %s", sink);
+    renderer->pipeline = gst_parse_launch(launch, &error);
+    g_free(launch);
     g_assert(renderer->pipeline);
 
     renderer->appsrc = gst_bin_get_by_name(GST_BIN(renderer->pipeline), "audio_source");
     renderer->volume = gst_bin_get_by_name(GST_BIN(renderer->pipeline), "volume");
+    renderer->sink = gst_bin_get_by_name(GST_BIN(renderer->pipeline), "audio_sink");
+
+    renderer->latency = gstreamer_latency_init();
+    assert(renderer->latency);
+    gstreamer_latency_attach(renderer->latency, renderer->pipeline, renderer->sink);
+
+    renderer->gain = audio_gain_init(44100);
+    assert(renderer->gain);
+    add_buffer_probe(renderer->pipeline, "volume", "sink", audio_gain_probe, renderer->gain);
+
+    if (config->probe && config->probe->audio_queued) {
+        add_buffer_probe(renderer->pipeline, "audio_queue", "src", audio_queued_probe, config->probe);
+    }
+    if (config->probe && config->probe->audio_decoded) {
+        add_buffer_probe(renderer->pipeline, "audio_sink", "sink", audio_decoded_probe, config->probe);
+    }
 
     gchar eld_conf[] = {0xF8, 0xE8, 0x50, 0x00};
     GstBuffer *codec_data = gst_buffer_new_and_alloc(sizeof(eld_conf));
@@ -119,19 +214,17 @@ void audio_renderer_gstreamer_render_buffer(audio_renderer_t *renderer, raop_ntp
 
     buffer = gst_buffer_new_and_alloc(data_len);
     assert(buffer != NULL);
-    GST_BUFFER_DTS(buffer) = (GstClockTime)pts;
+    // The PTS lets the latency probe recognize the frame once it is decoded
+    GST_BUFFER_PTS(buffer) = GST_BUFFER_DTS(buffer) = (GstClockTime)pts;
     gst_buffer_fill(buffer, 0, data, data_len);
+    gstreamer_latency_push(r->latency, (GstClockTime)pts);
     gst_app_src_push_buffer(GST_APP_SRC(r->appsrc), buffer);
 
 }
 
-void audio_renderer_gstreamer_set_volume(audio_renderer_t *renderer, float volume) {
+void audio_renderer_gstreamer_set_volume(audio_renderer_t *renderer, float volume, uint64_t pts) {
     audio_renderer_gstreamer_t *r = (audio_renderer_gstreamer_t *)renderer;
-    float avol;
-    if (fabs(volume) < 28) {
-        avol = floorf(((28-fabs(volume))/28)*10)/10;
-        g_object_set(r->volume, "volume", avol, NULL);
-    }
+    audio_gain_set_volume(r->gain, volume, pts);
 }
 
 void audio_renderer_gstreamer_flush(audio_renderer_t *renderer) {
@@ -144,15 +237,35 @@ void audio_renderer_gstreamer_destroy(audio_renderer_t *renderer) {
     gst_object_unref(r->pipeline);
     gst_object_unref(r->appsrc);
     gst_object_unref(r->volume);
+    gst_object_unref(r->sink);
+    gstreamer_latency_destroy(r->latency);
+    audio_gain_destroy(r->gain);
     if (renderer) {
         free(renderer);
     }
 }
 
+uint64_t audio_renderer_gstreamer_get_latency(audio_renderer_t *renderer) {
+    audio_renderer_gstreamer_t *r = (audio_renderer_gstreamer_t *)renderer;
+    return gstreamer_latency_get(r->latency);
+}
+
+bool audio_renderer_gstreamer_set_device(audio_renderer_t *renderer, audio_device_t device) {
+    audio_renderer_gstreamer_t *r = (audio_renderer_gstreamer_t *)renderer;
+    // autoaudiosink always plays on the system default output, so all we can do is mute it
+    if (device != AUDIO_DEVICE_NONE && device != r->device) {
+        return false;
+    }
+    g_object_set(r->volume, "mute", device == AUDIO_DEVICE_NONE, NULL);
+    return true;
+}
+
 static const audio_renderer_funcs_t audio_renderer_gstreamer_funcs = {
     .start = audio_renderer_gstreamer_start,
     .render_buffer = audio_renderer_gstreamer_render_buffer,
     .set_volume = audio_renderer_gstreamer_set_volume,
     .flush = audio_renderer_gstreamer_flush,
     .destroy = audio_renderer_gstreamer_destroy,
+    .get_latency = audio_renderer_gstreamer_get_latency,
+    .set_device = audio_renderer_gstreamer_set_device,
 };
@@ -34,6 +34,7 @@
 
 #include "bcm_host.h"
 #include "ilclient.h"
+#include "audio_gain.h"
 #include "../lib/threads.h"
 
 #define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
@@ -45,8 +46,13 @@ typedef struct audio_renderer_rpi_s {
     audio_renderer_t base;
     video_renderer_t *video_renderer;
     audio_renderer_config_t const *config;
+    /* Changed by the control socket, buffers are dropped while it is AUDIO_DEVICE_NONE. The mutex
+     * guards it and keeps the destination from changing while a buffer is handed to the renderer */
+    mutex_handle_t mutex;
+    audio_device_t device;
 
     HANDLE_AACDECODER audio_decoder;
+    audio_gain_t *gain;
 
     ILCLIENT_T *client;
     COMPONENT_T *audio_renderer;
@@ -109,6 +115,22 @@ static void audio_renderer_rpi_destroy_renderer(audio_renderer_rpi_t *renderer)
     }
 }
 
+static bool audio_renderer_rpi_set_destination(audio_renderer_rpi_t *renderer, audio_device_t device) {
+    const char *device_name = device == AUDIO_DEVICE_HDMI ? "hdmi" : "local";
+    OMX_CONFIG_BRCMAUDIODESTINATIONTYPE audio_destination;
+    memset(&audio_destination, 0, sizeof(OMX_CONFIG_BRCMAUDIODESTINATIONTYPE));
+    audio_destination.nSize = sizeof(OMX_CONFIG_BRCMAUDIODESTINATIONTYPE);
+    audio_destination.nVersion.nVersion = OMX_VERSION;
+    strcpy((char *)audio_destination.sName, device_name);
+
+    if (OMX_SetConfig(ilclient_get_handle(renderer->audio_renderer), OMX_IndexConfigBrcmAudioDestination,
+                      &audio_destination) != OMX_ErrorNone) {
+        logger_log(renderer->base.logger, LOGGER_DEBUG, "Could not set audio device");
+        return false;
+    }
+    return true;
+}
+
 static int audio_renderer_rpi_init_renderer(audio_renderer_rpi_t *renderer, video_renderer_t *video_renderer) {
     memset(renderer->components, 0, sizeof(renderer->components));
 
@@ -217,16 +239,7 @@ static int audio_renderer_rpi_init_renderer(audio_renderer_rpi_t *renderer, vide
     }
 
     // Set audio device
-    const char *device_name = renderer->config->device == AUDIO_DEVICE_HDMI ? "hdmi" : "local";
-    OMX_CONFIG_BRCMAUDIODESTINATIONTYPE audio_destination;
-    memset(&audio_destination, 0, sizeof(OMX_CONFIG_BRCMAUDIODESTINATIONTYPE));
-    audio_destination.nSize = sizeof(OMX_CONFIG_BRCMAUDIODESTINATIONTYPE);
-    audio_destination.nVersion.nVersion = OMX_VERSION;
-    strcpy((char *)audio_destination.sName, device_name);
-
-    if (OMX_SetConfig(ilclient_get_handle(renderer->audio_renderer), OMX_IndexConfigBrcmAudioDestination,
-                      &audio_destination) != OMX_ErrorNone) {
-        logger_log(renderer->base.logger, LOGGER_DEBUG, "Could not set audio device");
+    if (!audio_renderer_rpi_set_destination(renderer, renderer->config->device)) {
         audio_renderer_rpi_destroy_renderer(renderer);
         return -14;
     }
@@ -252,21 +265,26 @@ audio_renderer_t *audio_renderer_rpi_init(logger_t *logger, video_renderer_t *vi
     }
     renderer->video_renderer = video_renderer;
     renderer->config = config;
+    renderer->device = config->device;
 
     renderer->first_packet_time = 0;
     renderer->input_frames = 0;
 
     if (audio_renderer_rpi_init_decoder(renderer) != 1) {
         free(renderer);
-        renderer = NULL;
+        return NULL;
     }
 
     if (audio_renderer_rpi_init_renderer(renderer, video_renderer) != 1) {
         audio_renderer_rpi_destroy_decoder(renderer);
         free(renderer);
-        renderer = NULL;
+        return NULL;
     }
 
+    renderer->gain = audio_gain_init(44100);
+    assert(renderer->gain);
+    MUTEX_CREATE(renderer->mutex);
+
     return &renderer->base;
 }
 
@@ -290,6 +308,11 @@ static void audio_renderer_rpi_render_buffer(audio_renderer_t *renderer, raop_nt
     if (data_len == 0) return;
     
     audio_renderer_rpi_t *r = (audio_renderer_rpi_t *)renderer;
+    MUTEX_LOCK(r->mutex);
+    if (r->device == AUDIO_DEVICE_NONE) {
+        MUTEX_UNLOCK(r->mutex);
+        return;
+    }
 
     logger_log(renderer->logger, LOGGER_DEBUG, "Got AAC data of %d bytes", data_len);
     r->input_frames++;
@@ -313,6 +336,8 @@ static void audio_renderer_rpi_render_buffer(audio_renderer_t *renderer, raop_nt
         logger_log(renderer->logger, LOGGER_ERR, "aacDecoder_DecodeFrame error : 0x%x", error);
     }
 
+    audio_gain_apply(r->gain, (int16_t *) p_time_data, time_data_size / 4, 2, pts);
+
 #ifdef DUMP_AUDIO
     if (file_pcm == NULL) {
         file_pcm = fopen("/home/pi/Airplay.pcm", "wb");
@@ -352,26 +377,13 @@ static void audio_renderer_rpi_render_buffer(audio_renderer_t *renderer, raop_nt
     }
 
     free(p_time_data);
+    MUTEX_UNLOCK(r->mutex);
 }
 
-static void audio_renderer_rpi_set_volume(audio_renderer_t *renderer, float volume) {
+static void audio_renderer_rpi_set_volume(audio_renderer_t *renderer, float volume, uint64_t pts) {
     audio_renderer_rpi_t *r = (audio_renderer_rpi_t *)renderer;
-    OMX_AUDIO_CONFIG_VOLUMETYPE audio_volume;
-    memset(&audio_volume, 0, sizeof(audio_volume));
-    audio_volume.nSize = sizeof(OMX_AUDIO_CONFIG_VOLUMETYPE);
-    audio_volume.nVersion.nVersion = OMX_VERSION;
-
-    audio_volume.bLinear = OMX_FALSE;
-    audio_volume.nPortIndex = 100;
-    // Factor 100 for dB -> mB (millibel)
-    // It's not clear where the additional factor of 2 comes from,
-    // but without it, volume is too high.
-    audio_volume.sVolume.nValue = volume * 200.0;
-
-    if (OMX_SetConfig(ilclient_get_handle(r->audio_renderer), OMX_IndexConfigAudioVolume,
-                      &audio_volume) != OMX_ErrorNone) {
-        logger_log(renderer->logger, LOGGER_DEBUG, "Could not set audio volume");
-    }
+    // Applied to the decoded samples, the OpenMAX volume would change the audio already queued too
+    audio_gain_set_volume(r->gain, volume, pts);
 }
 
 static void audio_renderer_rpi_flush(audio_renderer_t *renderer) {
@@ -384,14 +396,47 @@ static void audio_renderer_rpi_destroy(audio_renderer_t *renderer) {
         audio_renderer_rpi_flush(renderer);
         audio_renderer_rpi_destroy_decoder(r);
         audio_renderer_rpi_destroy_renderer(r);
+        audio_gain_destroy(r->gain);
+        MUTEX_DESTROY(r->mutex);
         free(renderer);
     }
 }
 
+static uint64_t audio_renderer_rpi_get_latency(audio_renderer_t *renderer) {
+    audio_renderer_rpi_t *r = (audio_renderer_rpi_t *)renderer;
+    OMX_PARAM_U32TYPE latency;
+    memset(&latency, 0, sizeof(latency));
+    latency.nSize = sizeof(OMX_PARAM_U32TYPE);
+    latency.nVersion.nVersion = OMX_VERSION;
+    latency.nPortIndex = 100;
+
+    // Reported in samples still queued in the renderer
+    if (OMX_GetConfig(ilclient_get_handle(r->audio_renderer), OMX_IndexConfigAudioRenderingLatency,
+                      &latency) != OMX_ErrorNone) {
+        logger_log(renderer->logger, LOGGER_DEBUG, "Could not get audio rendering latency");
+        return 0;
+    }
+    return (uint64_t) latency.nU32 * 1000000 / 44100;
+}
+
+static bool audio_renderer_rpi_set_device(audio_renderer_t *renderer, audio_device_t device) {
+    audio_renderer_rpi_t *r = (audio_renderer_rpi_t *)renderer;
+    MUTEX_LOCK(r->mutex);
+    if (device != AUDIO_DEVICE_NONE && !audio_renderer_rpi_set_destination(r, device)) {
+        MUTEX_UNLOCK(r->mutex);
+        return false;
+    }
+    r->device = device;
+    MUTEX_UNLOCK(r->mutex);
+    return true;
+}
+
 static const audio_renderer_funcs_t audio_renderer_rpi_funcs = {
     .start = audio_renderer_rpi_start,
     .render_buffer = audio_renderer_rpi_render_buffer,
     .set_volume = audio_renderer_rpi_set_volume,
     .flush = audio_renderer_rpi_flush,
     .destroy = audio_renderer_rpi_destroy,
+    .get_latency = audio_renderer_rpi_get_latency,
+    .set_device = audio_renderer_rpi_set_device,
 };
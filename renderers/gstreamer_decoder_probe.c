@@ -0,0 +1,277 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include "gstreamer_decoder_probe.h"
+#include "h264_synth.h"
+#include <stdlib.h>
+#include <string.h>
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+
+/* The display size offered to senders, rounded up to whole macroblocks */
+#define PROBE_WIDTH 1920
+#define PROBE_HEIGHT 1088
+#define PROBE_PACED_FRAMES 30
+#define PROBE_BURST_FRAMES 120
+#define PROBE_TOTAL_FRAMES (PROBE_PACED_FRAMES + PROBE_BURST_FRAMES)
+#define PROBE_FRAME_DURATION (GST_SECOND / 60)
+#define PROBE_TARGET_FPS 60.0
+#define PROBE_TIMEOUT (20 * GST_SECOND)
+
+#define CACHE_GROUP "decoder"
+
+// Launch descriptions of the decoders worth trying, roughly in order of preference
+static const char *candidates[] = {
+    "v4l2h264dec",
+    "omxh264dec",
+    "vah264dec",
+    "vaapih264dec",
+    "nvh264dec",
+    "avdec_h264 max-threads=1",
+    "avdec_h264 max-threads=2",
+    "avdec_h264 max-threads=4",
+    "openh264dec",
+    NULL
+};
+
+typedef struct probe_result_s {
+    gboolean ok;
+    double fps;
+    double latency_ms;
+} probe_result_t;
+
+typedef struct probe_state_s {
+    GMutex mutex;
+    gint64 push_time[PROBE_TOTAL_FRAMES];
+    gint64 latency_sum;
+    int latency_count;
+    int decoded;
+    gint64 last_output;
+} probe_state_t;
+
+static gboolean candidate_available(const char *candidate) {
+    gchar **tokens = g_strsplit(candidate, " ", 2);
+    GstElementFactory *factory = gst_element_factory_find(tokens[0]);
+    gboolean available = factory != NULL;
+    if (factory) gst_object_unref(factory);
+
+    // More decoding threads than cores only adds frame delay
+    if (available && tokens[1] && g_str_has_prefix(tokens[1], "max-threads=")) {
+        int threads = atoi(tokens[1] + strlen("max-threads="));
+        available = threads <= 1 || threads <= (int) g_get_num_processors();
+    }
+    g_strfreev(tokens);
+    return available;
+}
+
+static void probe_handoff(GstElement *sink, GstBuffer *buffer, GstPad *pad, gpointer user_data) {
+    probe_state_t *state = user_data;
+    gint64 now = g_get_monotonic_time();
+
+    g_mutex_lock(&state->mutex);
+    if (GST_BUFFER_PTS_IS_VALID(buffer)) {
+        guint64 index = (GST_BUFFER_PTS(buffer) + PROBE_FRAME_DURATION / 2) / PROBE_FRAME_DURATION;
+        if (index < PROBE_PACED_FRAMES && state->push_time[index]) {
+            state->latency_sum += now - state->push_time[index];
+            state->latency_count++;
+        }
+    }
+    state->decoded++;
+    state->last_output = now;
+    g_mutex_unlock(&state->mutex);
+}
+
+static void push_frame(GstElement *appsrc, h264_synth_t *synth, int index, probe_state_t *state) {
+    const unsigned char *headers, *frame;
+    int headers_len = index == 0 ? h264_synth_get_headers(synth, &headers) : 0;
+    // Like a mirroring stream, one IDR picture and then only P pictures
+    int frame_len = index == 0 ? h264_synth_next_frame(synth, &frame) : h264_synth_next_predicted_frame(synth, &frame);
+
+    GstBuffer *buffer = gst_buffer_new_and_alloc(headers_len + frame_len);
+    if (headers_len) gst_buffer_fill(buffer, 0, headers, headers_len);
+    gst_buffer_fill(buffer, headers_len, frame, frame_len);
+    GST_BUFFER_PTS(buffer) = GST_BUFFER_DTS(buffer) = index * PROBE_FRAME_DURATION;
+    GST_BUFFER_DURATION(buffer) = PROBE_FRAME_DURATION;
+
+    g_mutex_lock(&state->mutex);
+    state->push_time[index] = g_get_monotonic_time();
+    g_mutex_unlock(&state->mutex);
+    gst_app_src_push_buffer(GST_APP_SRC(appsrc), buffer);
+}
+
+static probe_result_t probe_candidate(logger_t *logger, const char *candidate) {
+    probe_result_t result = { FALSE, 0.0, 0.0 };
+    probe_state_t state;
+    GError *error = NULL;
+
+    gchar *launch = g_strdup_printf("appsrc name=probe_source format=GST_FORMAT_TIME "
+                                    "caps=video/x-h264,stream-format=byte-stream ! "
+                                    "h264parse ! %s ! fakesink name=probe_sink sync=false signal-handoffs=true",
+                                    candidate);
+    GstElement *pipeline = gst_parse_launch(launch, &error);
+    g_free(launch);
+    if (error) {
+        logger_log(logger, LOGGER_DEBUG, "Decoder probe: could not create pipeline for %s: %s", candidate, error->message);
+        g_error_free(error);
+        if (pipeline) gst_object_unref(pipeline);
+        return result;
+    }
+
+    h264_synth_t *synth = h264_synth_init(PROBE_WIDTH, PROBE_HEIGHT);
+    GstElement *appsrc = gst_bin_get_by_name(GST_BIN(pipeline), "probe_source");
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "probe_sink");
+    GstBus *bus = gst_element_get_bus(pipeline);
+
+    memset(&state, 0, sizeof(state));
+    g_mutex_init(&state.mutex);
+    g_signal_connect(sink, "handoff", G_CALLBACK(probe_handoff), &state);
+
+    if (synth && gst_element_set_state(pipeline, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE) {
+        // Paced at the mirroring frame rate so that the latency is not inflated by queueing
+        gint64 start = g_get_monotonic_time();
+        for (int i = 0; i < PROBE_PACED_FRAMES; i++) {
+            push_frame(appsrc, synth, i, &state);
+            gint64 delay = start + (i + 1) * (gint64) (PROBE_FRAME_DURATION / GST_USECOND) - g_get_monotonic_time();
+            if (delay > 0) g_usleep(delay);
+        }
+
+        // Then as fast as the decoder will take them
+        gint64 burst_start = g_get_monotonic_time();
+        for (int i = PROBE_PACED_FRAMES; i < PROBE_TOTAL_FRAMES; i++) {
+            push_frame(appsrc, synth, i, &state);
+        }
+        gst_app_src_end_of_stream(GST_APP_SRC(appsrc));
+
+        GstMessage *msg = gst_bus_timed_pop_filtered(bus, PROBE_TIMEOUT, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+        if (msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS) {
+            g_mutex_lock(&state.mutex);
+            if (state.decoded == PROBE_TOTAL_FRAMES && state.latency_count > 0 && state.last_output > burst_start) {
+                result.ok = TRUE;
+                result.fps = PROBE_BURST_FRAMES * 1000000.0 / (double) (state.last_output - burst_start);
+                result.latency_ms = state.latency_sum / 1000.0 / state.latency_count;
+            }
+            g_mutex_unlock(&state.mutex);
+        } else if (msg) {
+            gst_message_parse_error(msg, &error, NULL);
+            logger_log(logger, LOGGER_DEBUG, "Decoder probe: %s failed: %s", candidate, error->message);
+            g_error_free(error);
+        } else {
+            logger_log(logger, LOGGER_DEBUG, "Decoder probe: %s timed out", candidate);
+        }
+        if (msg) gst_message_unref(msg);
+    }
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(bus);
+    gst_object_unref(sink);
+    gst_object_unref(appsrc);
+    gst_object_unref(pipeline);
+    g_mutex_clear(&state.mutex);
+    h264_synth_destroy(synth);
+    return result;
+}
+
+static gchar *get_cache_path(void) {
+    return g_build_filename(g_get_user_cache_dir(), "rpiplay", "decoder.cache", NULL);
+}
+
+static gchar *load_cached_decoder(const gchar *path, const gchar *key) {
+    GKeyFile *file = g_key_file_new();
+    gchar *decoder = NULL;
+    if (g_key_file_load_from_file(file, path, G_KEY_FILE_NONE, NULL)) {
+        gchar *cached_key = g_key_file_get_string(file, CACHE_GROUP, "key", NULL);
+        if (cached_key && !strcmp(cached_key, key)) {
+            decoder = g_key_file_get_string(file, CACHE_GROUP, "decoder", NULL);
+        }
+        g_free(cached_key);
+    }
+    g_key_file_free(file);
+    return decoder;
+}
+
+static void store_cached_decoder(logger_t *logger, const gchar *path, const gchar *key,
+                                 const gchar *decoder, const probe_result_t *result) {
+    GKeyFile *file = g_key_file_new();
+    GError *error = NULL;
+    gchar *dir = g_path_get_dirname(path);
+
+    g_key_file_set_string(file, CACHE_GROUP, "key", key);
+    g_key_file_set_string(file, CACHE_GROUP, "decoder", decoder);
+    g_key_file_set_double(file, CACHE_GROUP, "fps", result->fps);
+    g_key_file_set_double(file, CACHE_GROUP, "latency_ms", result->latency_ms);
+    if (g_mkdir_with_parents(dir, 0755) != 0 || !g_key_file_save_to_file(file, path, &error)) {
+        logger_log(logger, LOGGER_WARNING, "Decoder probe: could not write cache %s", path);
+        if (error) g_error_free(error);
+    }
+    g_free(dir);
+    g_key_file_free(file);
+}
+
+char *gstreamer_decoder_probe_select(logger_t *logger) {
+    GString *key = g_string_new(NULL);
+    gchar *version = gst_version_string();
+    gchar *path = get_cache_path();
+    gchar *decoder;
+
+    // The result only holds as long as the software, the hardware and the test clip stay the same
+    g_string_append_printf(key, "%s;cpus=%u;clip=%dx%d,p", version, g_get_num_processors(), PROBE_WIDTH, PROBE_HEIGHT);
+    for (int i = 0; candidates[i]; i++) {
+        if (candidate_available(candidates[i])) g_string_append_printf(key, ";%s", candidates[i]);
+    }
+    g_free(version);
+
+    decoder = load_cached_decoder(path, key->str);
+    if (decoder) {
+        logger_log(logger, LOGGER_INFO, "Using cached decoder selection: %s", decoder);
+        g_string_free(key, TRUE);
+        g_free(path);
+        return decoder;
+    }
+
+    logger_log(logger, LOGGER_INFO, "Probing H.264 decoders, this is only done once");
+    probe_result_t best = { FALSE, 0.0, 0.0 };
+    for (int i = 0; candidates[i]; i++) {
+        if (!candidate_available(candidates[i])) continue;
+
+        probe_result_t result = probe_candidate(logger, candidates[i]);
+        if (!result.ok) continue;
+        logger_log(logger, LOGGER_INFO, "Decoder probe: %s: %.1f fps, %.1f ms latency",
+                   candidates[i], result.fps, result.latency_ms);
+
+        // Among the decoders that keep up with the stream the one with the lowest latency wins,
+        // otherwise the one that comes closest
+        gboolean fast = result.fps >= PROBE_TARGET_FPS, best_fast = best.fps >= PROBE_TARGET_FPS;
+        if (!best.ok || (fast && (!best_fast || result.latency_ms < best.latency_ms)) ||
+            (!fast && !best_fast && result.fps > best.fps)) {
+            best = result;
+            g_free(decoder);
+            decoder = g_strdup(candidates[i]);
+        }
+    }
+
+    if (decoder) {
+        logger_log(logger, LOGGER_INFO, "Selected decoder: %s", decoder);
+        store_cached_decoder(logger, path, key->str, decoder, &best);
+    } else {
+        logger_log(logger, LOGGER_WARNING, "Decoder probe: no candidate could decode the test clip");
+    }
+    g_string_free(key, TRUE);
+    g_free(path);
+    return decoder;
+}
@@ -0,0 +1,48 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Startup benchmark of the H.264 decoders GStreamer can offer on this machine.
+ * Each candidate decodes a synthesized clip, once paced at 60 fps to measure
+ * the per-frame pipeline latency and once as fast as possible to measure
+ * throughput. The winner is cached on disk so the probe only runs again when
+ * the GStreamer version, CPU count or set of installed decoders changes.
+*/
+
+#ifndef GSTREAMER_DECODER_PROBE_H
+#define GSTREAMER_DECODER_PROBE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "../lib/logger.h"
+
+/**
+ * Returns the launch description of the best decoder, e.g. "avdec_h264 max-threads=2",
+ * or NULL if no candidate could decode the clip. Free the result with g_free.
+ * gst_init must have been called.
+ */
+char *gstreamer_decoder_probe_select(logger_t *logger);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //GSTREAMER_DECODER_PROBE_H
@@ -0,0 +1,172 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+
+#include "gstreamer_latency.h"
+#include <stdlib.h>
+
+#define LATENCY_RING_SIZE 64
+
+typedef struct latency_entry_s {
+    GstClockTime pts;
+    gint64 push_time;
+} latency_entry_t;
+
+struct gstreamer_latency_s {
+    GMutex mutex;
+    latency_entry_t ring[LATENCY_RING_SIZE];
+    unsigned int head; // Next entry to write
+    unsigned int tail; // Oldest entry not yet seen at the sink
+
+    gint64 average; // Exponentially weighted, in microseconds
+
+    GstElement *pipeline;
+    GstPad *sink_pad;
+    gulong probe_id;
+};
+
+static GstPadProbeReturn latency_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    gstreamer_latency_t *latency = user_data;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    gint64 now = g_get_monotonic_time();
+
+    g_mutex_lock(&latency->mutex);
+    if (latency->tail != latency->head) {
+        // Prefer an exact match, buffers the decoder dropped are skipped that way
+        unsigned int match = latency->tail;
+        if (GST_BUFFER_PTS_IS_VALID(buffer)) {
+            for (unsigned int i = latency->tail; i != latency->head; i++) {
+                if (latency->ring[i % LATENCY_RING_SIZE].pts == GST_BUFFER_PTS(buffer)) {
+                    match = i;
+                    break;
+                }
+            }
+        }
+
+        gint64 sample = now - latency->ring[match % LATENCY_RING_SIZE].push_time;
+        latency->average = latency->average ? (latency->average * 7 + sample) / 8 : sample;
+        latency->tail = match + 1;
+    }
+    g_mutex_unlock(&latency->mutex);
+    return GST_PAD_PROBE_OK;
+}
+
+static void latency_detach(gstreamer_latency_t *latency) {
+    if (latency->sink_pad) {
+        gst_pad_remove_probe(latency->sink_pad, latency->probe_id);
+        gst_object_unref(latency->sink_pad);
+        latency->sink_pad = NULL;
+    }
+    if (latency->pipeline) {
+        gst_object_unref(latency->pipeline);
+        latency->pipeline = NULL;
+    }
+}
+
+gstreamer_latency_t *gstreamer_latency_init(void) {
+    gstreamer_latency_t *latency = calloc(1, sizeof(gstreamer_latency_t));
+    if (!latency) {
+        return NULL;
+    }
+    g_mutex_init(&latency->mutex);
+    return latency;
+}
+
+void gstreamer_latency_attach(gstreamer_latency_t *latency, GstElement *pipeline, GstElement *sink) {
+    g_mutex_lock(&latency->mutex);
+    latency_detach(latency);
+    latency->tail = latency->head;
+    latency->pipeline = gst_object_ref(pipeline);
+    latency->sink_pad = gst_element_get_static_pad(sink, "sink");
+    if (latency->sink_pad) {
+        latency->probe_id = gst_pad_add_probe(latency->sink_pad, GST_PAD_PROBE_TYPE_BUFFER, latency_probe, latency, NULL);
+    }
+    g_mutex_unlock(&latency->mutex);
+}
+
+void gstreamer_latency_push(gstreamer_latency_t *latency, GstClockTime pts) {
+    g_mutex_lock(&latency->mutex);
+    // Drop the oldest entry if the sink has fallen that far behind
+    if (latency->head - latency->tail == LATENCY_RING_SIZE) {
+        latency->tail++;
+    }
+    latency_entry_t *entry = &latency->ring[latency->head % LATENCY_RING_SIZE];
+    entry->pts = pts;
+    entry->push_time = g_get_monotonic_time();
+    latency->head++;
+    g_mutex_unlock(&latency->mutex);
+}
+
+uint64_t gstreamer_latency_get(gstreamer_latency_t *latency) {
+    GstClockTime total = 0, upstream = 0;
+    gboolean live;
+    GstElement *pipeline = NULL;
+    GstPad *sink_pad = NULL;
+    gint64 average;
+
+    g_mutex_lock(&latency->mutex);
+    average = latency->average;
+    if (latency->pipeline) {
+        pipeline = gst_object_ref(latency->pipeline);
+        sink_pad = latency->sink_pad ? gst_object_ref(latency->sink_pad) : NULL;
+    }
+    g_mutex_unlock(&latency->mutex);
+    if (!average) {
+        if (pipeline) gst_object_unref(pipeline);
+        if (sink_pad) gst_object_unref(sink_pad);
+        return 0;
+    }
+
+    // The probe sees buffers as they enter the sink, so only the sink's share of the
+    // reported latency is still missing. Queried outside the lock, the streaming
+    // threads must not be blocked on it.
+    if (pipeline && sink_pad) {
+        GstQuery *query = gst_query_new_latency();
+        if (gst_element_query(pipeline, query)) {
+            gst_query_parse_latency(query, &live, &total, NULL);
+        }
+        gst_query_unref(query);
+        query = gst_query_new_latency();
+        if (gst_pad_peer_query(sink_pad, query)) {
+            gst_query_parse_latency(query, &live, &upstream, NULL);
+        }
+        gst_query_unref(query);
+    }
+    if (pipeline) gst_object_unref(pipeline);
+    if (sink_pad) gst_object_unref(sink_pad);
+
+    uint64_t sink_latency = GST_CLOCK_TIME_IS_VALID(total) && GST_CLOCK_TIME_IS_VALID(upstream) && total > upstream ?
+                            GST_TIME_AS_USECONDS(total - upstream) : 0;
+    return (uint64_t) average + sink_latency;
+}
+
+int gstreamer_latency_get_pending(gstreamer_latency_t *latency) {
+    g_mutex_lock(&latency->mutex);
+    int pending = latency->head - latency->tail;
+    g_mutex_unlock(&latency->mutex);
+    return pending;
+}
+
+void gstreamer_latency_destroy(gstreamer_latency_t *latency) {
+    if (latency) {
+        latency_detach(latency);
+        g_mutex_clear(&latency->mutex);
+        free(latency);
+    }
+}
@@ -0,0 +1,60 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Measures how long buffers take from the appsrc of a renderer pipeline to
+ * its sink. Every pushed buffer is remembered together with the time it was
+ * pushed, and a probe on the sink pad matches it up again by timestamp, or in
+ * order if the decoder rewrote the timestamps. The sink's own latency, e.g. the
+ * audio device buffer, is added from a latency query.
+*/
+
+#ifndef GSTREAMER_LATENCY_H
+#define GSTREAMER_LATENCY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <gst/gst.h>
+
+typedef struct gstreamer_latency_s gstreamer_latency_t;
+
+gstreamer_latency_t *gstreamer_latency_init(void);
+
+/* Starts watching the given sink of the pipeline. Call again whenever the pipeline is rebuilt. */
+void gstreamer_latency_attach(gstreamer_latency_t *latency, GstElement *pipeline, GstElement *sink);
+
+/* Records that a buffer with the given timestamp is being pushed into the pipeline */
+void gstreamer_latency_push(gstreamer_latency_t *latency, GstClockTime pts);
+
+/* Returns the smoothed latency in microseconds, or 0 if nothing was measured yet */
+uint64_t gstreamer_latency_get(gstreamer_latency_t *latency);
+
+/* Returns the number of buffers pushed that have not reached the sink yet */
+int gstreamer_latency_get_pending(gstreamer_latency_t *latency);
+
+void gstreamer_latency_destroy(gstreamer_latency_t *latency);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //GSTREAMER_LATENCY_H
@@ -0,0 +1,576 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include "h264_synth.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define NAL_SEI 0x06
+#define NAL_SLICE 0x61
+#define NAL_SLICE_IDR 0x65
+#define NAL_SPS 0x67
+#define NAL_PPS 0x68
+
+#define MB_TYPE_I16x16_DC 3
+#define MB_TYPE_P_L0_16x16 0
+#define MB_TYPE_P_INTRA_OFFSET 5
+#define CBP_INTER_NONE 0 // codeNum of coded_block_pattern 0 in inter macroblocks
+#define CBP_INTER_LUMA 11 // codeNum of coded_block_pattern 15, all luma and no chroma
+
+/* Every eighth macroblock of a P picture is intra, every fourth of the others carries a residual */
+#define P_INTRA_PERIOD 8
+#define P_RESIDUAL_PERIOD 4
+/* Largest motion vector component of P pictures, in quarter samples */
+#define P_MAX_MOTION 64
+
+#define SEI_USER_DATA_UNREGISTERED 5
+#define SEI_MARKER_SIZE (16 + 4 + 8)
+
+// Sync pattern and sequence number, one bit per macroblock of the top row
+#define MARKER_SYNC 0xa
+#define MARKER_SYNC_BITS 4
+#define MARKER_BITS (MARKER_SYNC_BITS + 32)
+#define MARKER_QP_DELTA 25 // From the slice QP of 26 up to 51
+#define MARKER_DARK 64
+#define MARKER_BRIGHT 192
+
+static const unsigned char marker_uuid[16] = {
+    0x52, 0x50, 0x69, 0x50, 0x6c, 0x61, 0x79, 0x2d, 0x8c, 0x3e, 0x4a, 0x1b, 0x9d, 0x05, 0x6f, 0x27
+};
+
+typedef struct motion_vector_s {
+    int x, y;
+    int intra;
+} motion_vector_t;
+
+typedef struct bit_writer_s {
+    unsigned char *data;
+    int size;
+    int pos;
+} bit_writer_t;
+
+struct h264_synth_s {
+    int width_mbs;
+    int height_mbs;
+
+    bit_writer_t rbsp;
+
+    unsigned char *headers;
+    int headers_len;
+
+    unsigned char *frame;
+    int frame_size;
+
+    uint32_t frame_count;
+    uint32_t seed;
+
+    /* frame_num of the last picture and the motion vectors it was coded with */
+    int frame_num;
+    motion_vector_t *motion;
+};
+
+static void
+bw_reset(bit_writer_t *bw)
+{
+    memset(bw->data, 0, bw->size);
+    bw->pos = 0;
+}
+
+static void
+bw_put_bits(bit_writer_t *bw, uint32_t value, int count)
+{
+    for (int i = count - 1; i >= 0; i--) {
+        assert((bw->pos >> 3) < bw->size);
+        if ((value >> i) & 1) {
+            bw->data[bw->pos >> 3] |= 0x80 >> (bw->pos & 7);
+        }
+        bw->pos++;
+    }
+}
+
+static void
+bw_put_ue(bit_writer_t *bw, uint32_t value)
+{
+    uint32_t code = value + 1;
+    int len = 0;
+    while ((code >> len) > 1) {
+        len++;
+    }
+    bw_put_bits(bw, 0, len);
+    bw_put_bits(bw, code, len + 1);
+}
+
+static void
+bw_put_se(bit_writer_t *bw, int32_t value)
+{
+    bw_put_ue(bw, value > 0 ? 2 * value - 1 : -2 * value);
+}
+
+static void
+bw_put_trailing_bits(bit_writer_t *bw)
+{
+    bw_put_bits(bw, 1, 1);
+    while (bw->pos & 7) {
+        bw->pos++;
+    }
+}
+
+/* Appends the RBSP as an Annex B NAL unit, inserting emulation prevention bytes */
+static int
+write_nal(const bit_writer_t *bw, unsigned char *out)
+{
+    int len = bw->pos >> 3;
+    int zeros = 0;
+    int out_len = 0;
+
+    out[out_len++] = 0;
+    out[out_len++] = 0;
+    out[out_len++] = 0;
+    out[out_len++] = 1;
+    for (int i = 0; i < len; i++) {
+        if (zeros == 2 && bw->data[i] <= 3) {
+            out[out_len++] = 3;
+            zeros = 0;
+        }
+        out[out_len++] = bw->data[i];
+        zeros = bw->data[i] == 0 ? zeros + 1 : 0;
+    }
+    return out_len;
+}
+
+/**
+ * Codes a block of 16 coefficients holding a single one at the given position in scan
+ * order. As no block ever holds more than one coefficient, nC stays below 2 and the
+ * same coeff_token table applies everywhere.
+ */
+static void
+write_residual_block(bit_writer_t *bw, int level, int position)
+{
+    // total_zeros for TotalCoeff 1, the codes pair up from 1 on and get one bit longer every pair
+    static const unsigned char total_zeros_bits[16] = { 1, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 1 };
+    static const unsigned char total_zeros_len[16] = { 1, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 9 };
+
+    if (level == 0) {
+        bw_put_bits(bw, 1, 1); // coeff_token: TotalCoeff 0
+        return;
+    }
+    if (level == 1 || level == -1) {
+        bw_put_bits(bw, 1, 2); // coeff_token: TotalCoeff 1, TrailingOnes 1
+        bw_put_bits(bw, level < 0, 1);
+    } else {
+        bw_put_bits(bw, 5, 6); // coeff_token: TotalCoeff 1, TrailingOnes 0
+        // suffixLength 0, first level after less than three trailing ones
+        int code = (level > 0 ? 2 * level - 2 : -2 * level - 1) - 2;
+        if (code < 14) {
+            bw_put_bits(bw, 1, code + 1);
+        } else if (code < 30) {
+            bw_put_bits(bw, 1, 15);
+            bw_put_bits(bw, code - 14, 4);
+        } else {
+            bw_put_bits(bw, 1, 16);
+            bw_put_bits(bw, code - 30, 12);
+        }
+    }
+    bw_put_bits(bw, total_zeros_bits[position], total_zeros_len[position]);
+}
+
+/**
+ * Picks the DC level that brings a top row macroblock closest to the target
+ * brightness. Only the left neighbour is available for DC prediction there,
+ * so the value of the previous macroblock is all that needs to be tracked.
+ */
+static int
+marker_dc_level(int *value, int target)
+{
+    int diff = target - *value;
+    int level = (diff + (diff < 0 ? -7 : 7)) / 14;
+
+    // At QP 51 the dequantized DC adds (level * 896 + 32) >> 6 to every sample
+    int scaled = level * 896 + 32;
+    int residual = scaled >= 0 ? scaled >> 6 : -((-scaled + 63) >> 6);
+    *value += residual;
+    if (*value < 0) *value = 0;
+    if (*value > 255) *value = 255;
+    return level;
+}
+
+static void
+write_sps(h264_synth_t *synth)
+{
+    bit_writer_t *bw = &synth->rbsp;
+    bw_reset(bw);
+    bw_put_bits(bw, NAL_SPS, 8);
+    bw_put_bits(bw, 66, 8);   // profile_idc: baseline
+    bw_put_bits(bw, 0xc0, 8); // constraint_set0_flag, constraint_set1_flag
+    bw_put_bits(bw, synth->width_mbs * synth->height_mbs > 3600 ? 40 : 31, 8); // level_idc, 4 from 1080p on
+    bw_put_ue(bw, 0);         // seq_parameter_set_id
+    bw_put_ue(bw, 0);         // log2_max_frame_num_minus4
+    bw_put_ue(bw, 2);         // pic_order_cnt_type
+    bw_put_ue(bw, 1);         // max_num_ref_frames
+    bw_put_bits(bw, 0, 1);    // gaps_in_frame_num_value_allowed_flag
+    bw_put_ue(bw, synth->width_mbs - 1);
+    bw_put_ue(bw, synth->height_mbs - 1);
+    bw_put_bits(bw, 1, 1);    // frame_mbs_only_flag
+    bw_put_bits(bw, 1, 1);    // direct_8x8_inference_flag
+    bw_put_bits(bw, 0, 1);    // frame_cropping_flag
+    bw_put_bits(bw, 0, 1);    // vui_parameters_present_flag
+    bw_put_trailing_bits(bw);
+}
+
+static void
+write_pps(h264_synth_t *synth)
+{
+    bit_writer_t *bw = &synth->rbsp;
+    bw_reset(bw);
+    bw_put_bits(bw, NAL_PPS, 8);
+    bw_put_ue(bw, 0);      // pic_parameter_set_id
+    bw_put_ue(bw, 0);      // seq_parameter_set_id
+    bw_put_bits(bw, 0, 1); // entropy_coding_mode_flag: CAVLC
+    bw_put_bits(bw, 0, 1); // bottom_field_pic_order_in_frame_present_flag
+    bw_put_ue(bw, 0);      // num_slice_groups_minus1
+    bw_put_ue(bw, 0);      // num_ref_idx_l0_default_active_minus1
+    bw_put_ue(bw, 0);      // num_ref_idx_l1_default_active_minus1
+    bw_put_bits(bw, 0, 1); // weighted_pred_flag
+    bw_put_bits(bw, 0, 2); // weighted_bipred_idc
+    bw_put_se(bw, 0);      // pic_init_qp_minus26
+    bw_put_se(bw, 0);      // pic_init_qs_minus26
+    bw_put_se(bw, 0);      // chroma_qp_index_offset
+    bw_put_bits(bw, 1, 1); // deblocking_filter_control_present_flag
+    bw_put_bits(bw, 0, 1); // constrained_intra_pred_flag
+    bw_put_bits(bw, 0, 1); // redundant_pic_cnt_present_flag
+    bw_put_trailing_bits(bw);
+}
+
+static void
+write_marker_sei(h264_synth_t *synth, uint32_t seq, uint64_t timestamp)
+{
+    bit_writer_t *bw = &synth->rbsp;
+    bw_reset(bw);
+    bw_put_bits(bw, NAL_SEI, 8);
+    bw_put_bits(bw, SEI_USER_DATA_UNREGISTERED, 8); // payloadType
+    bw_put_bits(bw, SEI_MARKER_SIZE, 8);            // payloadSize
+    for (int i = 0; i < 16; i++) {
+        bw_put_bits(bw, marker_uuid[i], 8);
+    }
+    bw_put_bits(bw, seq, 32);
+    bw_put_bits(bw, (uint32_t) (timestamp >> 32), 32);
+    bw_put_bits(bw, (uint32_t) timestamp, 32);
+    bw_put_trailing_bits(bw);
+}
+
+static void
+write_idr_slice(h264_synth_t *synth, int marked, uint32_t seq)
+{
+    bit_writer_t *bw = &synth->rbsp;
+    bw_reset(bw);
+    bw_put_bits(bw, NAL_SLICE_IDR, 8);
+    bw_put_ue(bw, 0);                       // first_mb_in_slice
+    bw_put_ue(bw, 7);                       // slice_type: I, all slices
+    bw_put_ue(bw, 0);                       // pic_parameter_set_id
+    bw_put_bits(bw, 0, 4);                  // frame_num
+    bw_put_ue(bw, synth->frame_count & 1);  // idr_pic_id, must differ between consecutive IDRs
+    bw_put_bits(bw, 0, 1);                  // no_output_of_prior_pics_flag
+    bw_put_bits(bw, 0, 1);                  // long_term_reference_flag
+    bw_put_se(bw, 0);                       // slice_qp_delta
+    bw_put_ue(bw, 1);                       // disable_deblocking_filter_idc
+
+    int marker_value = 128; // DC prediction of the first macroblock
+    for (int mb = 0; mb < synth->width_mbs * synth->height_mbs; mb++) {
+        // Cheap LCG so that every picture has different content
+        synth->seed = synth->seed * 1103515245 + 12345;
+        int level = (int) ((synth->seed >> 16) % 5) - 2;
+        int qp_delta = 0;
+
+        if (marked && mb < synth->width_mbs) {
+            int bit = 0;
+            if (mb < MARKER_SYNC_BITS) {
+                bit = (MARKER_SYNC >> (MARKER_SYNC_BITS - 1 - mb)) & 1;
+            } else if (mb < MARKER_BITS) {
+                bit = (seq >> (MARKER_BITS - 1 - mb)) & 1;
+            }
+            level = marker_dc_level(&marker_value, bit ? MARKER_BRIGHT : MARKER_DARK);
+            qp_delta = mb == 0 ? MARKER_QP_DELTA : 0;
+        } else if (marked && mb == synth->width_mbs) {
+            qp_delta = -MARKER_QP_DELTA;
+        }
+
+        bw_put_ue(bw, MB_TYPE_I16x16_DC);
+        bw_put_ue(bw, 0);        // intra_chroma_pred_mode: DC
+        bw_put_se(bw, qp_delta); // mb_qp_delta
+        write_residual_block(bw, level, 0);
+        synth->motion[mb].intra = 1;
+    }
+    bw_put_trailing_bits(bw);
+    synth->frame_num = 0;
+}
+
+static int
+median(int a, int b, int c)
+{
+    int max = a > b ? a : b, min = a < b ? a : b;
+    return c > max ? max : c < min ? min : c;
+}
+
+/* Motion vector prediction for a 16x16 partition referencing the only reference picture */
+static void
+predict_motion(h264_synth_t *synth, int mb_x, int mb_y, int *pred_x, int *pred_y)
+{
+    static const motion_vector_t unavailable = { 0, 0, 1 };
+    const motion_vector_t *current = synth->motion + mb_y * synth->width_mbs + mb_x;
+    const motion_vector_t *a = mb_x > 0 ? current - 1 : &unavailable;
+    const motion_vector_t *b = mb_y > 0 ? current - synth->width_mbs : &unavailable;
+    const motion_vector_t *c = mb_y > 0 && mb_x + 1 < synth->width_mbs ? current - synth->width_mbs + 1 :
+                               mb_y > 0 && mb_x > 0 ? current - synth->width_mbs - 1 : &unavailable;
+
+    // In the top row only the left neighbour exists and stands in for the others
+    if (mb_y == 0 && mb_x > 0) {
+        b = c = a;
+    }
+    // Intra neighbours count as not referencing the picture, with a zero vector
+    int refs = !a->intra + !b->intra + !c->intra;
+    if (refs == 1) {
+        const motion_vector_t *only = !a->intra ? a : !b->intra ? b : c;
+        *pred_x = only->x;
+        *pred_y = only->y;
+        return;
+    }
+    *pred_x = median(a->intra ? 0 : a->x, b->intra ? 0 : b->x, c->intra ? 0 : c->x);
+    *pred_y = median(a->intra ? 0 : a->y, b->intra ? 0 : b->y, c->intra ? 0 : c->y);
+}
+
+/**
+ * Writes a P slice made to cost a decoder about what screen content does: sub-sample
+ * motion all over the picture, a residual in a quarter of the macroblocks, some intra
+ * macroblocks and the deblocking filter.
+ */
+static void
+write_p_slice(h264_synth_t *synth)
+{
+    bit_writer_t *bw = &synth->rbsp;
+    bw_reset(bw);
+    synth->frame_num = (synth->frame_num + 1) & 15;
+    bw_put_bits(bw, NAL_SLICE, 8);
+    bw_put_ue(bw, 0);                  // first_mb_in_slice
+    bw_put_ue(bw, 5);                  // slice_type: P, all slices
+    bw_put_ue(bw, 0);                  // pic_parameter_set_id
+    bw_put_bits(bw, synth->frame_num, 4);
+    bw_put_bits(bw, 0, 1);             // num_ref_idx_active_override_flag
+    bw_put_bits(bw, 0, 1);             // ref_pic_list_modification_flag_l0
+    bw_put_bits(bw, 0, 1);             // adaptive_ref_pic_marking_mode_flag
+    bw_put_se(bw, 0);                  // slice_qp_delta
+    bw_put_ue(bw, 0);                  // disable_deblocking_filter_idc
+    bw_put_se(bw, 0);                  // slice_alpha_c0_offset_div2
+    bw_put_se(bw, 0);                  // slice_beta_offset_div2
+
+    // The whole picture pans, every macroblock with a little motion of its own on top
+    int pan_x = (int) (synth->frame_count % 32) - 16, pan_y = (int) (synth->frame_count % 24) - 12;
+    for (int mb = 0; mb < synth->width_mbs * synth->height_mbs; mb++) {
+        motion_vector_t *motion = synth->motion + mb;
+        synth->seed = synth->seed * 1103515245 + 12345;
+        uint32_t random = synth->seed >> 8;
+
+        bw_put_ue(bw, 0); // mb_skip_run
+        if (random % P_INTRA_PERIOD == 0) {
+            bw_put_ue(bw, MB_TYPE_P_INTRA_OFFSET + MB_TYPE_I16x16_DC);
+            bw_put_ue(bw, 0); // intra_chroma_pred_mode: DC
+            bw_put_se(bw, 0); // mb_qp_delta
+            write_residual_block(bw, (int) ((random >> 3) % 5) - 2, 0);
+            motion->intra = 1;
+            continue;
+        }
+
+        int pred_x, pred_y;
+        predict_motion(synth, mb % synth->width_mbs, mb / synth->width_mbs, &pred_x, &pred_y);
+        motion->intra = 0;
+        motion->x = pan_x + (int) ((random >> 3) % 17) - 8;
+        motion->y = pan_y + (int) ((random >> 8) % 17) - 8;
+        assert(motion->x >= -P_MAX_MOTION && motion->x <= P_MAX_MOTION);
+        assert(motion->y >= -P_MAX_MOTION && motion->y <= P_MAX_MOTION);
+        bw_put_ue(bw, MB_TYPE_P_L0_16x16);
+        bw_put_se(bw, motion->x - pred_x); // mvd_l0
+        bw_put_se(bw, motion->y - pred_y);
+
+        if ((random >> 20) % P_RESIDUAL_PERIOD) {
+            bw_put_ue(bw, CBP_INTER_NONE);
+            continue;
+        }
+        bw_put_ue(bw, CBP_INTER_LUMA);
+        bw_put_se(bw, 0); // mb_qp_delta
+        for (int block = 0; block < 16; block++) {
+            synth->seed = synth->seed * 1103515245 + 12345;
+            int level = (int) ((synth->seed >> 16) % 7) - 3;
+            write_residual_block(bw, level, (int) ((synth->seed >> 24) % 16));
+        }
+    }
+    bw_put_trailing_bits(bw);
+}
+
+h264_synth_t *
+h264_synth_init(int width, int height)
+{
+    h264_synth_t *synth;
+
+    assert(width > 0 && width % 16 == 0);
+    assert(height > 0 && height % 16 == 0);
+
+    synth = calloc(1, sizeof(h264_synth_t));
+    if (!synth) {
+        return NULL;
+    }
+    synth->width_mbs = width / 16;
+    synth->height_mbs = height / 16;
+    synth->seed = 1;
+
+    // Worst case per macroblock is 1 + 7 + 2 * 17 + 9 + 1 bits and 16 blocks of 6 + 4 + 9 bits in P pictures
+    synth->rbsp.size = synth->width_mbs * synth->height_mbs * 48 + 64;
+    synth->rbsp.data = malloc(synth->rbsp.size);
+    synth->frame_size = synth->rbsp.size * 3 / 2 + 4 + 64; // Room for the marker SEI
+    synth->frame = malloc(synth->frame_size);
+    synth->headers = malloc(128);
+    synth->motion = calloc(synth->width_mbs * synth->height_mbs, sizeof(motion_vector_t));
+    if (!synth->rbsp.data || !synth->frame || !synth->headers || !synth->motion) {
+        h264_synth_destroy(synth);
+        return NULL;
+    }
+
+    write_sps(synth);
+    synth->headers_len = write_nal(&synth->rbsp, synth->headers);
+    write_pps(synth);
+    synth->headers_len += write_nal(&synth->rbsp, synth->headers + synth->headers_len);
+
+    return synth;
+}
+
+int
+h264_synth_get_headers(h264_synth_t *synth, const unsigned char **data)
+{
+    assert(synth);
+    *data = synth->headers;
+    return synth->headers_len;
+}
+
+int
+h264_synth_next_frame(h264_synth_t *synth, const unsigned char **data)
+{
+    assert(synth);
+    write_idr_slice(synth, 0, 0);
+    synth->frame_count++;
+    *data = synth->frame;
+    return write_nal(&synth->rbsp, synth->frame);
+}
+
+int
+h264_synth_next_predicted_frame(h264_synth_t *synth, const unsigned char **data)
+{
+    assert(synth);
+    assert(synth->frame_count > 0);
+    write_p_slice(synth);
+    synth->frame_count++;
+    *data = synth->frame;
+    return write_nal(&synth->rbsp, synth->frame);
+}
+
+int
+h264_synth_next_marked_frame(h264_synth_t *synth, uint32_t seq, uint64_t timestamp, const unsigned char **data)
+{
+    int len;
+
+    assert(synth);
+    assert(synth->width_mbs * 16 >= H264_SYNTH_MARKER_MIN_WIDTH && synth->height_mbs > 1);
+    write_marker_sei(synth, seq, timestamp);
+    len = write_nal(&synth->rbsp, synth->frame);
+    write_idr_slice(synth, 1, seq);
+    synth->frame_count++;
+    *data = synth->frame;
+    return len + write_nal(&synth->rbsp, synth->frame + len);
+}
+
+int
+h264_synth_read_marker(const unsigned char *luma, int stride, int width, int height, uint32_t *seq)
+{
+    uint32_t bits = 0;
+    uint32_t value = 0;
+
+    if (width < H264_SYNTH_MARKER_MIN_WIDTH || height < 16) {
+        return -1;
+    }
+    // Sample the centre of each macroblock, away from any scaling at the edges
+    for (int mb = 0; mb < MARKER_BITS; mb++) {
+        int bit = luma[8 * stride + mb * 16 + 8] >= (MARKER_DARK + MARKER_BRIGHT) / 2;
+        if (mb < MARKER_SYNC_BITS) {
+            bits = (bits << 1) | bit;
+        } else {
+            value = (value << 1) | bit;
+        }
+    }
+    if (bits != MARKER_SYNC) {
+        return -1;
+    }
+    *seq = value;
+    return 0;
+}
+
+int
+h264_synth_parse_sei(const unsigned char *data, int data_len, uint32_t *seq, uint64_t *timestamp)
+{
+    for (int i = 0; i + 3 < data_len; i++) {
+        if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1 || data[i + 3] != NAL_SEI) {
+            continue;
+        }
+
+        // Undo the emulation prevention, the message is short enough to copy
+        unsigned char rbsp[2 + SEI_MARKER_SIZE];
+        int rbsp_len = 0, zeros = 0;
+        for (int j = i + 4; j < data_len && rbsp_len < (int) sizeof(rbsp); j++) {
+            if (zeros == 2 && data[j] == 3) {
+                zeros = 0;
+                continue;
+            }
+            rbsp[rbsp_len++] = data[j];
+            zeros = data[j] == 0 ? zeros + 1 : 0;
+        }
+        if (rbsp_len < (int) sizeof(rbsp) || rbsp[0] != SEI_USER_DATA_UNREGISTERED || rbsp[1] != SEI_MARKER_SIZE ||
+            memcmp(rbsp + 2, marker_uuid, sizeof(marker_uuid)) != 0) {
+            continue;
+        }
+
+        const unsigned char *payload = rbsp + 2 + sizeof(marker_uuid);
+        *seq = (uint32_t) payload[0] << 24 | (uint32_t) payload[1] << 16 | (uint32_t) payload[2] << 8 | payload[3];
+        *timestamp = 0;
+        for (int j = 4; j < 12; j++) {
+            *timestamp = (*timestamp << 8) | payload[j];
+        }
+        return 0;
+    }
+    return -1;
+}
+
+void
+h264_synth_destroy(h264_synth_t *synth)
+{
+    if (synth) {
+        free(synth->rbsp.data);
+        free(synth->frame);
+        free(synth->headers);
+        free(synth->motion);
+        free(synth);
+    }
+}
@@ -0,0 +1,91 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Tiny generator for a valid H.264 Annex B elementary stream.
+ * Produces a constrained baseline stream made up of IDR pictures in which
+ * every macroblock is Intra 16x16 DC with a single luma DC coefficient, and
+ * optionally P pictures with sub-sample motion, residuals and deblocking that
+ * cost a decoder about as much as real content does. Used to exercise and
+ * benchmark decoders without shipping a binary sample clip.
+ *
+ * Marked frames additionally carry a sequence number that survives decoding:
+ * the top row of macroblocks is coded at the highest QP, each one either dark
+ * or bright, so the bits can be read back from the decoded luma plane. The
+ * sequence number and a timestamp are also sent in a user data unregistered
+ * SEI message ahead of the slice.
+ */
+
+#ifndef H264_SYNTH_H
+#define H264_SYNTH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define H264_SYNTH_MARKER_MIN_WIDTH (36 * 16)
+
+typedef struct h264_synth_s h264_synth_t;
+
+/* width and height must be multiples of 16 */
+h264_synth_t *h264_synth_init(int width, int height);
+
+/* Returns the SPS and PPS NAL units. The buffer is owned by the generator. */
+int h264_synth_get_headers(h264_synth_t *synth, const unsigned char **data);
+
+/**
+ * Generates the next picture as a single IDR access unit. The buffer is owned
+ * by the generator and stays valid until the next call.
+ */
+int h264_synth_next_frame(h264_synth_t *synth, const unsigned char **data);
+
+/**
+ * Generates the next picture as a P picture predicted from the previous one.
+ * Needs an IDR picture first. The buffer is owned by the generator and stays
+ * valid until the next call.
+ */
+int h264_synth_next_predicted_frame(h264_synth_t *synth, const unsigned char **data);
+
+/**
+ * Like h264_synth_next_frame, but marks the picture with the given sequence
+ * number and timestamp. The width must be at least H264_SYNTH_MARKER_MIN_WIDTH.
+ */
+int h264_synth_next_marked_frame(h264_synth_t *synth, uint32_t seq, uint64_t timestamp, const unsigned char **data);
+
+/**
+ * Reads the sequence number back from a decoded 8 bit luma plane.
+ * Returns 0 on success, -1 if the picture carries no marker.
+ */
+int h264_synth_read_marker(const unsigned char *luma, int stride, int width, int height, uint32_t *seq);
+
+/**
+ * Finds the marker SEI message in an Annex B access unit.
+ * Returns 0 on success, -1 if there is none.
+ */
+int h264_synth_parse_sei(const unsigned char *data, int data_len, uint32_t *seq, uint64_t *timestamp);
+
+void h264_synth_destroy(h264_synth_t *synth);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //H264_SYNTH_H
@@ -0,0 +1,60 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+
+/*
+ * Interface of renderer backends that are built as loadable modules. Each
+ * module is a shared object named renderer_<name>.so that exports a
+ * renderer_module_t called renderer_module. The renderer functions themselves
+ * are reached through the usual funcs tables.
+*/
+
+#ifndef RENDERER_MODULE_H
+#define RENDERER_MODULE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "video_renderer.h"
+#include "audio_renderer.h"
+
+/**
+ * Bumped whenever the renderer interfaces or config structs change:
+ * 2 added get_queue_depth, 3 reconfigure and set_device, 4 the pts of set_volume
+ */
+#define RENDERER_MODULE_VERSION 4
+
+#define RENDERER_MODULE_PREFIX "renderer_"
+#define RENDERER_MODULE_SUFFIX ".so"
+#define RENDERER_MODULE_SYMBOL "renderer_module"
+
+typedef struct renderer_module_s {
+    int version;
+    const char *video_description; // Listed in the help, NULL if the module has no video renderer
+    video_renderer_t *(*video_init)(logger_t *logger, video_renderer_config_t const *config);
+    const char *audio_description; // Listed in the help, NULL if the module has no audio renderer
+    audio_renderer_t *(*audio_init)(logger_t *logger, video_renderer_t *video_renderer, audio_renderer_config_t const *config);
+} renderer_module_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //RENDERER_MODULE_H
@@ -0,0 +1,29 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+
+#include "renderer_module.h"
+
+const renderer_module_t renderer_module = {
+    .version = RENDERER_MODULE_VERSION,
+    .video_description = "Raspberry Pi OpenMAX accelerated H.264 renderer",
+    .video_init = video_renderer_rpi_init,
+    .audio_description = "AAC renderer using fdk-aac for decoding and OpenMAX for rendering",
+    .audio_init = audio_renderer_rpi_init,
+};
@@ -34,6 +34,7 @@ extern "C" {
 #include <stdbool.h>
 #include "../lib/logger.h"
 #include "../lib/raop_ntp.h"
+#include "../lib/stream.h"
 
 typedef enum background_mode_e {
     BACKGROUND_MODE_ON,   // Always show background
@@ -54,11 +55,30 @@ typedef enum flip_mode_e {
     FLIP_BOTH
 } flip_mode_t;
 
+/**
+ * Taps into the renderer pipelines for latency measurements. All callbacks are
+ * optional and are called from the streaming threads. Renderers that support
+ * it render into a fakesink when a probe is set, so no display is needed.
+ */
+typedef struct renderer_probe_s {
+    void *cls;
+    /* An encoded video frame leaves the input queue for the decoder */
+    void (*video_queued)(void *cls, uint64_t pts, const unsigned char *data, int data_len);
+    /* A decoded picture reaches the sink, as its 8 bit luma plane */
+    void (*video_decoded)(void *cls, uint64_t pts, const unsigned char *luma, int stride, int width, int height);
+    /* An encoded audio frame leaves the input queue for the decoder */
+    void (*audio_queued)(void *cls, uint64_t pts, const unsigned char *data, int data_len);
+    /* Decoded samples reach the sink, interleaved signed 16 bit */
+    void (*audio_decoded)(void *cls, uint64_t pts, const int16_t *samples, int frames, int channels);
+} renderer_probe_t;
+
 typedef struct video_renderer_config_s {
     background_mode_t background_mode;
     bool low_latency;
     int rotation;
     flip_mode_t flip;
+    const char *decoder; // NULL for the renderer's default, "auto" to benchmark the available decoders
+    renderer_probe_t const *probe; // NULL in normal operation
 } video_renderer_config_t;
 
 typedef struct video_renderer_s video_renderer_t;
@@ -77,6 +97,33 @@ typedef struct video_renderer_funcs_s {
      *       -1: a connection lost
      */
     void (*update_background)(video_renderer_t *renderer, int type);
+    /**
+     * Whether the renderer is able to decode the given codec. Only codecs the
+     * renderer supports are offered to senders.
+     */
+    bool (*supports_codec)(video_renderer_t *renderer, video_codec_t codec);
+    /**
+     * Switch to the given codec. Called with every codec configuration, before
+     * its parameter sets are passed to render_buffer.
+     */
+    void (*set_codec)(video_renderer_t *renderer, video_codec_t codec);
+    /**
+     * Measured time from render_buffer until the frame is displayed, in
+     * microseconds. 0 if the renderer cannot tell (yet).
+     */
+    uint64_t (*get_latency)(video_renderer_t *renderer);
+    /**
+     * Number of frames passed to render_buffer that are not displayed yet.
+     * A growing queue means the decoder cannot keep up.
+     */
+    int (*get_queue_depth)(video_renderer_t *renderer);
+    /**
+     * Apply the rotation, flip and background mode of config to the running
+     * renderer, the other fields are ignored. Returns false if the renderer
+     * cannot change them without being recreated, it keeps its settings then.
+     * May be called from any thread.
+     */
+    bool (*reconfigure)(video_renderer_t *renderer, video_renderer_config_t const *config);
 } video_renderer_funcs_t;
 
 typedef struct video_renderer_s {
@@ -63,10 +63,34 @@ static void video_renderer_dummy_update_background(video_renderer_t *renderer, i
 
 }
 
+static bool video_renderer_dummy_supports_codec(video_renderer_t *renderer, video_codec_t codec) {
+    return true;
+}
+
+static void video_renderer_dummy_set_codec(video_renderer_t *renderer, video_codec_t codec) {
+}
+
+static uint64_t video_renderer_dummy_get_latency(video_renderer_t *renderer) {
+    return 0;
+}
+
+static int video_renderer_dummy_get_queue_depth(video_renderer_t *renderer) {
+    return 0;
+}
+
+static bool video_renderer_dummy_reconfigure(video_renderer_t *renderer, video_renderer_config_t const *config) {
+    return true;
+}
+
 static const video_renderer_funcs_t video_renderer_dummy_funcs = {
     .start = video_renderer_dummy_start,
     .render_buffer = video_renderer_dummy_render_buffer,
     .flush = video_renderer_dummy_flush,
     .destroy = video_renderer_dummy_destroy,
     .update_background = video_renderer_dummy_update_background,
+    .supports_codec = video_renderer_dummy_supports_codec,
+    .set_codec = video_renderer_dummy_set_codec,
+    .get_latency = video_renderer_dummy_get_latency,
+    .get_queue_depth = video_renderer_dummy_get_queue_depth,
+    .reconfigure = video_renderer_dummy_reconfigure,
 };
@@ -18,18 +18,57 @@
  */
 
 #include "video_renderer.h"
+#include "gstreamer_decoder_probe.h"
+#include "gstreamer_latency.h"
 #include <assert.h>
 #include <gst/gst.h>
 #include <gst/app/gstappsrc.h>
 #include <stdio.h>
+#include <string.h>
 
 typedef struct video_renderer_gstreamer_s {
     video_renderer_t base;
     GstElement *appsrc, *pipeline, *sink;
+    /* Guards the pipeline and the orientation, which the control socket may change */
+    GMutex mutex;
+    int rotation;
+    flip_mode_t flip;
+    /* Only kept to refuse changes, the background is left to the window system */
+    background_mode_t background_mode;
+    gchar *decoder;
+    /* Codec of the incoming stream and codec the current pipeline decodes, which only
+     * differ while a switch has failed and frames are being dropped */
+    video_codec_t codec, pipeline_codec;
+    gstreamer_latency_t *latency;
+    renderer_probe_t const *probe;
 } video_renderer_gstreamer_t;
 
 static const video_renderer_funcs_t video_renderer_gstreamer_funcs;
 
+/* videoflip method for every rotation (0, 90, 180 and 270 degrees) followed by every flip mode */
+static const char *const videoflip_methods[4][4] = {
+    [0] = {
+        [FLIP_NONE] = "none", [FLIP_HORIZONTAL] = "horizontal-flip",
+        [FLIP_VERTICAL] = "vertical-flip", [FLIP_BOTH] = "rotate-180"
+    },
+    [1] = {
+        [FLIP_NONE] = "clockwise", [FLIP_HORIZONTAL] = "upper-left-diagonal",
+        [FLIP_VERTICAL] = "upper-right-diagonal", [FLIP_BOTH] = "counterclockwise"
+    },
+    [2] = {
+        [FLIP_NONE] = "rotate-180", [FLIP_HORIZONTAL] = "vertical-flip",
+        [FLIP_VERTICAL] = "horizontal-flip", [FLIP_BOTH] = "none"
+    },
+    [3] = {
+        [FLIP_NONE] = "counterclockwise", [FLIP_HORIZONTAL] = "upper-right-diagonal",
+        [FLIP_VERTICAL] = "upper-left-diagonal", [FLIP_BOTH] = "clockwise"
+    },
+};
+
+static const char *video_renderer_gstreamer_videoflip_method(int rotation, flip_mode_t flip) {
+    return videoflip_methods[(rotation % 360 + 360) % 360 / 90][flip];
+}
+
 static gboolean check_plugins(void)
 {
     int i;
@@ -52,9 +91,118 @@ static gboolean check_plugins(void)
     return ret;
 }
 
+static GstPadProbeReturn video_queued_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    renderer_probe_t const *probe = user_data;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstMapInfo map;
+
+    if (gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        probe->video_queued(probe->cls, GST_BUFFER_PTS(buffer), map.data, map.size);
+        gst_buffer_unmap(buffer, &map);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn video_decoded_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    renderer_probe_t const *probe = user_data;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    GstMapInfo map;
+    gint width = 0, height = 0;
+
+    if (caps) {
+        GstStructure *structure = gst_caps_get_structure(caps, 0);
+        gst_structure_get_int(structure, "width", &width);
+        gst_structure_get_int(structure, "height", &height);
+        gst_caps_unref(caps);
+    }
+    // The caps filter in front of the sink guarantees I420, so the luma plane comes first
+    if (width && height && gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        probe->video_decoded(probe->cls, GST_BUFFER_PTS(buffer), map.data, GST_ROUND_UP_4(width), width, height);
+        gst_buffer_unmap(buffer, &map);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+static void add_buffer_probe(GstElement *pipeline, const char *name, const char *pad_name,
+                             GstPadProbeCallback callback, renderer_probe_t const *probe) {
+    GstElement *element = gst_bin_get_by_name(GST_BIN(pipeline), name);
+    GstPad *pad = gst_element_get_static_pad(element, pad_name);
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, callback, (gpointer) probe, NULL);
+    gst_object_unref(pad);
+    gst_object_unref(element);
+}
+
+/* Builds a pipeline for the given codec and only replaces the current one once that succeeded */
+static gboolean video_renderer_gstreamer_create_pipeline(video_renderer_gstreamer_t *renderer, video_codec_t codec) {
+    GError *error = NULL;
+    GstElement *pipeline;
+
+    // Begin the video pipeline
+    GString *launch = g_string_new("appsrc name=video_source stream-type=0 format=GST_FORMAT_TIME is-live=true ");
+    if (codec == VIDEO_CODEC_H265) {
+        g_string_append(launch, "caps=video/x-h265,stream-format=byte-stream ! queue name=video_queue ! decodebin ! ");
+    } else if (renderer->decoder) {
+        g_string_append_printf(launch, "caps=video/x-h264,stream-format=byte-stream ! queue name=video_queue ! "
+                                       "h264parse ! %s ! ", renderer->decoder);
+    } else {
+        g_string_append(launch, "! queue name=video_queue ! decodebin ! ");
+    }
+    g_string_append(launch, "videoconvert ! ");
+
+    // Rotation and flip are merged into one element, so that they can be changed while playing
+    g_string_append_printf(launch, "videoflip name=video_flip method=%s ! ",
+                           video_renderer_gstreamer_videoflip_method(renderer->rotation, renderer->flip));
+
+    // Finish the pipeline
+    if (renderer->probe) {
+        g_string_append(launch, "video/x-raw,format=I420 ! fakesink name=video_sink sync=false");
+    } else {
+        g_string_append(launch, "autovideosink name=video_sink sync=false");
+    }
+
+    pipeline = gst_parse_launch(launch->str, &error);
+    g_string_free(launch, TRUE);
+    if (error) {
+        logger_log(renderer->base.logger, LOGGER_ERR, "Could not create video pipeline: %s", error->message);
+        g_error_free(error);
+        if (pipeline) gst_object_unref(pipeline);
+        return FALSE;
+    }
+    g_assert(pipeline);
+
+    if (renderer->pipeline) {
+        gst_element_set_state(renderer->pipeline, GST_STATE_NULL);
+        gst_object_unref(renderer->appsrc);
+        gst_object_unref(renderer->sink);
+        gst_object_unref(renderer->pipeline);
+        renderer->appsrc = renderer->sink = NULL;
+    }
+    renderer->pipeline = pipeline;
+    renderer->pipeline_codec = codec;
+    renderer->appsrc = gst_bin_get_by_name(GST_BIN(renderer->pipeline), "video_source");
+    renderer->sink = gst_bin_get_by_name(GST_BIN(renderer->pipeline), "video_sink");
+    gstreamer_latency_attach(renderer->latency, renderer->pipeline, renderer->sink);
+
+    if (renderer->probe && renderer->probe->video_queued) {
+        add_buffer_probe(renderer->pipeline, "video_queue", "src", video_queued_probe, renderer->probe);
+    }
+    if (renderer->probe && renderer->probe->video_decoded) {
+        add_buffer_probe(renderer->pipeline, "video_sink", "sink", video_decoded_probe, renderer->probe);
+    }
+    return TRUE;
+}
+
 video_renderer_t *video_renderer_gstreamer_init(logger_t *logger, video_renderer_config_t const *config) {
     video_renderer_gstreamer_t *renderer;
-    GError *error = NULL;
+
+    switch (config->rotation) {
+    case 0: case 90: case -90: case 180: case -180: case 270: case -270:
+        break;
+    default:
+        printf("Error: Rotation must be +/- 0,90,180,270\n");
+        return NULL;
+    }
 
     renderer = calloc(1, sizeof(video_renderer_gstreamer_t));
     assert(renderer);
@@ -64,62 +212,34 @@ video_renderer_t *video_renderer_gstreamer_init(logger_t *logger, video_renderer
     renderer->base.logger = logger;
     renderer->base.funcs = &video_renderer_gstreamer_funcs;
     renderer->base.type = VIDEO_RENDERER_GSTREAMER;
+    renderer->rotation = config->rotation;
+    renderer->flip = config->flip;
+    renderer->background_mode = config->background_mode;
+    g_mutex_init(&renderer->mutex);
+    renderer->codec = VIDEO_CODEC_H264;
+    renderer->probe = config->probe;
+    renderer->latency = gstreamer_latency_init();
+    assert(renderer->latency);
 
     assert(check_plugins());
 
-    // Begin the video pipeline
-    GString *launch = g_string_new("appsrc name=video_source stream-type=0 format=GST_FORMAT_TIME is-live=true !"
-                                   "queue ! decodebin ! videoconvert ! ");
-    // Setup rotation
-    if (config->rotation != 0) {
-        switch (config->rotation) {
-        case 90:
-        case -270:
-            g_string_append(launch, "videoflip method=clockwise ! ");
-            break;
-        case -90:
-        case 270:
-            g_string_append(launch, "videoflip method=counterclockwise ! ");
-            break;
-        case 180:
-        case -180:
-            g_string_append(launch, "videoflip method=rotate-180 ! ");
-            break;
-        default:
-            printf("Error: Rotation must be +/- 0,90,180,270\n");
-            g_string_free(launch, TRUE);
-            free(renderer);
-            return NULL;
-        }
+    // Pick the decoder, either the one given or the fastest one found on this machine
+    if (config->decoder && !strcmp(config->decoder, "auto")) {
+        renderer->decoder = gstreamer_decoder_probe_select(logger);
+    } else if (config->decoder) {
+        renderer->decoder = g_strdup(config->decoder);
     }
-
-    // Setup flip
-    if (config->flip != FLIP_NONE) {
-        switch (config->flip) {
-        case FLIP_HORIZONTAL:
-            g_string_append(launch, "videoflip method=horizontal-flip ! ");
-            break;
-        case FLIP_VERTICAL:
-            g_string_append(launch, "videoflip method=vertical-flip ! ");
-            break;
-        case FLIP_BOTH:
-            g_string_append(launch, "videoflip method=rotate-180 ! ");
-            break;
-        case FLIP_NONE:
-        default:
-            break;
-        }
+    if (renderer->decoder) {
+        logger_log(logger, LOGGER_INFO, "Using H.264 decoder %s", renderer->decoder);
     }
 
-    // Finish the pipeline
-    g_string_append(launch, "autovideosink name=video_sink sync=false");
-
-    renderer->pipeline = gst_parse_launch(launch->str, &error);
-    g_assert(renderer->pipeline);
-    g_string_free(launch, TRUE);
-
-    renderer->appsrc = gst_bin_get_by_name(GST_BIN(renderer->pipeline), "video_source");
-    renderer->sink = gst_bin_get_by_name(GST_BIN(renderer->pipeline), "video_sink");
+    if (!video_renderer_gstreamer_create_pipeline(renderer, renderer->codec)) {
+        g_mutex_clear(&renderer->mutex);
+        gstreamer_latency_destroy(renderer->latency);
+        g_free(renderer->decoder);
+        free(renderer);
+        return NULL;
+    }
 
     return &renderer->base;
 }
@@ -137,9 +257,23 @@ static void video_renderer_gstreamer_render_buffer(video_renderer_t *renderer, r
 
     buffer = gst_buffer_new_and_alloc(data_len);
     assert(buffer != NULL);
-    GST_BUFFER_DTS(buffer) = (GstClockTime)pts;
+    // The PTS lets the latency probe recognize the frame once it is decoded
+    GST_BUFFER_PTS(buffer) = GST_BUFFER_DTS(buffer) = (GstClockTime)pts;
     gst_buffer_fill(buffer, 0, data, data_len);
+
+    g_mutex_lock(&r->mutex);
+    if (r->codec != r->pipeline_codec) {
+        // The pipeline could not be switched to this codec, so it would only choke on the frame
+        g_mutex_unlock(&r->mutex);
+        gst_buffer_unref(buffer);
+        return;
+    }
+    if (type != 0) {
+        // Codec configuration is merged into the next frame and never reaches the sink on its own
+        gstreamer_latency_push(r->latency, (GstClockTime)pts);
+    }
     gst_app_src_push_buffer(GST_APP_SRC(r->appsrc), buffer);
+    g_mutex_unlock(&r->mutex);
 }
 
 void video_renderer_gstreamer_flush(video_renderer_t *renderer) {
@@ -151,6 +285,9 @@ void video_renderer_gstreamer_destroy(video_renderer_t *renderer) {
     gst_app_src_end_of_stream(GST_APP_SRC(r->appsrc));
     gst_element_set_state(r->pipeline, GST_STATE_NULL);
     gst_object_unref(r->pipeline);
+    gstreamer_latency_destroy(r->latency);
+    g_free(r->decoder);
+    g_mutex_clear(&r->mutex);
     if (renderer) {
         free(renderer);
     }
@@ -160,10 +297,86 @@ void video_renderer_gstreamer_update_background(video_renderer_t *renderer, int
 
 }
 
+static bool video_renderer_gstreamer_supports_codec(video_renderer_t *renderer, video_codec_t codec) {
+    if (codec == VIDEO_CODEC_H264) {
+        return true;
+    }
+
+    // H.265 goes through decodebin, so any decoder in the registry will do
+    GstCaps *caps = gst_caps_from_string("video/x-h265");
+    GList *decoders = gst_element_factory_list_get_elements(GST_ELEMENT_FACTORY_TYPE_DECODER |
+                                                            GST_ELEMENT_FACTORY_TYPE_MEDIA_VIDEO, GST_RANK_MARGINAL);
+    GList *h265_decoders = gst_element_factory_list_filter(decoders, caps, GST_PAD_SINK, FALSE);
+    bool supported = h265_decoders != NULL;
+    gst_plugin_feature_list_free(h265_decoders);
+    gst_plugin_feature_list_free(decoders);
+    gst_caps_unref(caps);
+    return supported;
+}
+
+static void video_renderer_gstreamer_set_codec(video_renderer_t *renderer, video_codec_t codec) {
+    video_renderer_gstreamer_t *r = (video_renderer_gstreamer_t *)renderer;
+    if (codec == r->codec) {
+        return;
+    }
+
+    const char *name = codec == VIDEO_CODEC_H265 ? "H.265" : "H.264";
+    g_mutex_lock(&r->mutex);
+    r->codec = codec;
+    if (codec == r->pipeline_codec) {
+        // An earlier switch failed and the stream is back to what the pipeline decodes
+        logger_log(renderer->logger, LOGGER_INFO, "Resuming %s video", name);
+    } else {
+        // decodebin does not switch decoders mid-stream, so start over with a fresh pipeline
+        logger_log(renderer->logger, LOGGER_INFO, "Switching video pipeline to %s", name);
+        if (video_renderer_gstreamer_create_pipeline(r, codec)) {
+            gst_element_set_state(r->pipeline, GST_STATE_PLAYING);
+        } else {
+            // Keep the old pipeline, the stream may switch back to its codec later
+            logger_log(renderer->logger, LOGGER_ERR, "Could not switch video pipeline to %s, dropping video", name);
+        }
+    }
+    g_mutex_unlock(&r->mutex);
+}
+
+static uint64_t video_renderer_gstreamer_get_latency(video_renderer_t *renderer) {
+    video_renderer_gstreamer_t *r = (video_renderer_gstreamer_t *)renderer;
+    return gstreamer_latency_get(r->latency);
+}
+
+static int video_renderer_gstreamer_get_queue_depth(video_renderer_t *renderer) {
+    video_renderer_gstreamer_t *r = (video_renderer_gstreamer_t *)renderer;
+    return gstreamer_latency_get_pending(r->latency);
+}
+
+static bool video_renderer_gstreamer_reconfigure(video_renderer_t *renderer, video_renderer_config_t const *config) {
+    video_renderer_gstreamer_t *r = (video_renderer_gstreamer_t *)renderer;
+    if (config->rotation % 90 || config->background_mode != r->background_mode) {
+        return false;
+    }
+
+    // The background is left to the window system here, so only the orientation can change
+    g_mutex_lock(&r->mutex);
+    r->rotation = config->rotation;
+    r->flip = config->flip;
+    GstElement *flip = gst_bin_get_by_name(GST_BIN(r->pipeline), "video_flip");
+    if (flip) {
+        gst_util_set_object_arg(G_OBJECT(flip), "method", video_renderer_gstreamer_videoflip_method(r->rotation, r->flip));
+        gst_object_unref(flip);
+    }
+    g_mutex_unlock(&r->mutex);
+    return flip != NULL;
+}
+
 static const video_renderer_funcs_t video_renderer_gstreamer_funcs = {
     .start = video_renderer_gstreamer_start,
     .render_buffer = video_renderer_gstreamer_render_buffer,
     .flush = video_renderer_gstreamer_flush,
     .destroy = video_renderer_gstreamer_destroy,
     .update_background = video_renderer_gstreamer_update_background,
+    .supports_codec = video_renderer_gstreamer_supports_codec,
+    .set_codec = video_renderer_gstreamer_set_codec,
+    .get_latency = video_renderer_gstreamer_get_latency,
+    .get_queue_depth = video_renderer_gstreamer_get_queue_depth,
+    .reconfigure = video_renderer_gstreamer_reconfigure,
 };
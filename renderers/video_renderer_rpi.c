@@ -43,8 +43,10 @@
 
 typedef struct video_renderer_rpi_s {
     video_renderer_t base;
-    video_renderer_config_t const *config;
+    video_renderer_config_t config;
 
+    /* Guards the background and the orientation, which the control socket may change */
+    mutex_handle_t mutex;
     uint16_t background_visits;
     DISPMANX_ELEMENT_HANDLE_T background_element;
 
@@ -59,6 +61,7 @@ typedef struct video_renderer_rpi_s {
 
     uint64_t first_packet_time;
     uint64_t input_frames;
+    uint64_t pipeline_delay;
 } video_renderer_rpi_t;
 
 static const video_renderer_funcs_t video_renderer_rpi_funcs;
@@ -112,6 +115,7 @@ static void video_renderer_rpi_remove_background(video_renderer_rpi_t *renderer)
 
 static void video_renderer_rpi_update_background(video_renderer_t *renderer, int type) {
     video_renderer_rpi_t *r = (video_renderer_rpi_t *)renderer;
+    MUTEX_LOCK(r->mutex);
     if (type < 0) {
         r->background_visits--;
     } else if (type > 0) {
@@ -121,16 +125,19 @@ static void video_renderer_rpi_update_background(video_renderer_t *renderer, int
         r->background_visits = 0;
     }
 
-    if (r->config->background_mode == BACKGROUND_MODE_ON) {
+    if (r->config.background_mode == BACKGROUND_MODE_ON) {
         video_renderer_rpi_render_background(r);
-    } else if (r->config->background_mode == BACKGROUND_MODE_AUTO) {
+    } else if (r->config.background_mode == BACKGROUND_MODE_AUTO) {
         // Show background when connection is made and hide background when all connections are gone
         if (r->background_visits > 0) {
             video_renderer_rpi_render_background(r);
         } else {
             video_renderer_rpi_remove_background(r);
         }
+    } else {
+        video_renderer_rpi_remove_background(r);
     }
+    MUTEX_UNLOCK(r->mutex);
 }
 
 static void video_renderer_rpi_destroy_decoder(video_renderer_rpi_t *renderer) {
@@ -153,6 +160,47 @@ static void omx_event_handler(void *userdata, COMPONENT_T *comp, OMX_U32 data) {
     logger_log(renderer->base.logger, LOGGER_DEBUG, "Video renderer config change: %p: %d", comp, data);
 }
 
+static bool video_renderer_rpi_set_orientation(video_renderer_rpi_t *renderer) {
+    OMX_CONFIG_ROTATIONTYPE omx_rotation;
+    memset(&omx_rotation, 0, sizeof(OMX_CONFIG_ROTATIONTYPE));
+    omx_rotation.nSize = sizeof(OMX_CONFIG_ROTATIONTYPE);
+    omx_rotation.nRotation = renderer->config.rotation;
+    omx_rotation.nPortIndex = 90;
+    omx_rotation.nVersion.nVersion = OMX_VERSION;
+    OMX_ERRORTYPE error = OMX_SetConfig(ilclient_get_handle(renderer->video_renderer), OMX_IndexConfigCommonRotate,
+                                        &omx_rotation);
+    if (error != OMX_ErrorNone) {
+        printf("Error: %x\n", error);
+        return false;
+    }
+
+    OMX_CONFIG_MIRRORTYPE omx_mirror;
+    memset(&omx_mirror, 0, sizeof(OMX_CONFIG_MIRRORTYPE));
+    omx_mirror.nSize = sizeof(OMX_CONFIG_MIRRORTYPE);
+    switch (renderer->config.flip) {
+    case FLIP_HORIZONTAL:
+        omx_mirror.eMirror = OMX_MirrorHorizontal;
+        break;
+    case FLIP_VERTICAL:
+        omx_mirror.eMirror = OMX_MirrorVertical;
+        break;
+    case FLIP_BOTH:
+        omx_mirror.eMirror = OMX_MirrorBoth;
+        break;
+    default:
+        omx_mirror.eMirror = OMX_MirrorNone;
+        break;
+    }
+    omx_mirror.nPortIndex = 90;
+    omx_mirror.nVersion.nVersion = OMX_VERSION;
+    error = OMX_SetConfig(ilclient_get_handle(renderer->video_renderer), OMX_IndexConfigCommonMirror, &omx_mirror);
+    if (error != OMX_ErrorNone) {
+        printf("Error: %x\n", error);
+        return false;
+    }
+    return true;
+}
+
 static int video_renderer_rpi_init_decoder(video_renderer_rpi_t *renderer) {
     memset(renderer->components, 0, sizeof(renderer->components));
     memset(renderer->tunnels, 0, sizeof(renderer->tunnels));
@@ -270,58 +318,17 @@ static int video_renderer_rpi_init_decoder(video_renderer_rpi_t *renderer) {
         return -15;
     }
 
-    // Setup rotation
-    if (renderer->config->rotation != 0) {
-        int rotation = renderer->config->rotation;
-        OMX_CONFIG_ROTATIONTYPE omx_rotation;
-        memset(&omx_rotation, 0, sizeof(OMX_CONFIG_ROTATIONTYPE));
-        omx_rotation.nSize = sizeof(OMX_CONFIG_ROTATIONTYPE);
-        // Check the rotation here
-        if (rotation != 90 && rotation != -90 && rotation != 180 && rotation != -180 && rotation != 270 && rotation != -270) {
-            printf("Error: Rotation must be +/- 0,90,180,270\n");
-            video_renderer_rpi_destroy_decoder(renderer);
-            return -15;
-        }
-        omx_rotation.nRotation = rotation;
-        omx_rotation.nPortIndex = 90;
-        omx_rotation.nVersion.nVersion = OMX_VERSION;
-        OMX_ERRORTYPE error = OMX_SetConfig(ilclient_get_handle(renderer->video_renderer), OMX_IndexConfigCommonRotate,
-                                            &omx_rotation);
-        if (error != OMX_ErrorNone) {
-            printf("Error: %x\n", error);
-            video_renderer_rpi_destroy_decoder(renderer);
-            return -15;
-        }
+    // Setup rotation and flipping
+    int rotation = renderer->config.rotation;
+    if (rotation != 0 && rotation != 90 && rotation != -90 && rotation != 180 && rotation != -180 &&
+        rotation != 270 && rotation != -270) {
+        printf("Error: Rotation must be +/- 0,90,180,270\n");
+        video_renderer_rpi_destroy_decoder(renderer);
+        return -15;
     }
-
-    // Setup flipping
-    if (renderer->config->flip != FLIP_NONE) {
-        OMX_CONFIG_MIRRORTYPE omx_mirror;
-        memset(&omx_mirror, 0, sizeof(OMX_CONFIG_MIRRORTYPE));
-        omx_mirror.nSize = sizeof(OMX_CONFIG_MIRRORTYPE);
-        switch (renderer->config->flip) {
-        case FLIP_HORIZONTAL:
-            omx_mirror.eMirror = OMX_MirrorHorizontal;
-            break;
-        case FLIP_VERTICAL:
-            omx_mirror.eMirror = OMX_MirrorVertical;
-            break;
-        case FLIP_BOTH:
-            omx_mirror.eMirror = OMX_MirrorBoth;
-            break;
-        default:
-            omx_mirror.eMirror = OMX_MirrorNone;
-            break;
-        }
-        omx_mirror.nPortIndex = 90;
-        omx_mirror.nVersion.nVersion = OMX_VERSION;
-        OMX_ERRORTYPE error = OMX_SetConfig(ilclient_get_handle(renderer->video_renderer), OMX_IndexConfigCommonMirror,
-                                            &omx_mirror);
-        if (error != OMX_ErrorNone) {
-            printf("Error: %x\n", error);
-            video_renderer_rpi_destroy_decoder(renderer);
-            return -15;
-        }
+    if (!video_renderer_rpi_set_orientation(renderer)) {
+        video_renderer_rpi_destroy_decoder(renderer);
+        return -15;
     }
 
     // Set decoder format
@@ -355,12 +362,14 @@ video_renderer_t *video_renderer_rpi_init(logger_t *logger, video_renderer_confi
     renderer->base.logger = logger;
     renderer->base.funcs = &video_renderer_rpi_funcs;
     renderer->base.type = VIDEO_RENDERER_RPI;
-    renderer->config = config;
+    renderer->config = *config;
+    MUTEX_CREATE(renderer->mutex);
 
     renderer->first_packet_time = 0;
     renderer->input_frames = 0;
 
     if (video_renderer_rpi_init_decoder(renderer) != 1) {
+        MUTEX_DESTROY(renderer->mutex);
         free(renderer);
         renderer = NULL;
     }
@@ -435,6 +444,7 @@ static void video_renderer_rpi_render_buffer(video_renderer_t *renderer, raop_nt
         uint64_t time_diff = raop_ntp_get_local_time(ntp) - r->first_packet_time;
         logger_log(renderer->logger, LOGGER_DEBUG, "Video pipeline delay is %llu frames or %llu us",
                    r->input_frames, time_diff);
+        r->pipeline_delay = time_diff;
 
         if (ilclient_setup_tunnel(&r->tunnels[0], 0, 0) != 0) {
             logger_log(renderer->logger, LOGGER_ERR, "Could not setup decoder tunnel");
@@ -470,11 +480,11 @@ static void video_renderer_rpi_render_buffer(video_renderer_t *renderer, raop_nt
         buffer->nFilledLen = chunk_size;
         buffer->nOffset = 0;
 
-        if (!r->config->low_latency) buffer->nTimeStamp = ilclient_ticks_from_s64(pts);
+        if (!r->config.low_latency) buffer->nTimeStamp = ilclient_ticks_from_s64(pts);
         if (r->first_packet_time == 0) {
             buffer->nFlags = OMX_BUFFERFLAG_STARTTIME;
             r->first_packet_time = raop_ntp_get_local_time(ntp);
-            if (!r->config->low_latency) buffer->nTimeStamp = ilclient_ticks_from_s64(r->first_packet_time);
+            if (!r->config.low_latency) buffer->nTimeStamp = ilclient_ticks_from_s64(r->first_packet_time);
         }
 
         // Mark the last buffer if we had to split the data (probably not necessary)
@@ -522,14 +532,55 @@ static void video_renderer_rpi_destroy(video_renderer_t *renderer) {
         // Only flush if data was sent through, gets stuck otherwise
         if (r->first_packet_time) video_renderer_rpi_flush(renderer);
         video_renderer_rpi_destroy_decoder(r);
+        MUTEX_DESTROY(r->mutex);
         free(renderer);
     }
 }
 
+static bool video_renderer_rpi_supports_codec(video_renderer_t *renderer, video_codec_t codec) {
+    // The VideoCore IV decoder has no H.265 support
+    return codec == VIDEO_CODEC_H264;
+}
+
+static void video_renderer_rpi_set_codec(video_renderer_t *renderer, video_codec_t codec) {
+    if (codec != VIDEO_CODEC_H264) {
+        logger_log(renderer->logger, LOGGER_ERR, "Video decoder only supports H.264, the stream will not be displayed");
+    }
+}
+
+static uint64_t video_renderer_rpi_get_latency(video_renderer_t *renderer) {
+    video_renderer_rpi_t *r = (video_renderer_rpi_t *)renderer;
+    // The decoder only tells us when its first picture comes out, the later ones take just as long
+    return r->pipeline_delay;
+}
+
+static int video_renderer_rpi_get_queue_depth(video_renderer_t *renderer) {
+    // render_buffer waits for a free decoder input buffer, so frames back up in front of the
+    // renderer instead, where they show up as late frames
+    return 0;
+}
+
+static bool video_renderer_rpi_reconfigure(video_renderer_t *renderer, video_renderer_config_t const *config) {
+    video_renderer_rpi_t *r = (video_renderer_rpi_t *)renderer;
+    MUTEX_LOCK(r->mutex);
+    r->config.rotation = config->rotation;
+    r->config.flip = config->flip;
+    r->config.background_mode = config->background_mode;
+    bool ok = video_renderer_rpi_set_orientation(r);
+    MUTEX_UNLOCK(r->mutex);
+    video_renderer_rpi_update_background(renderer, 0);
+    return ok;
+}
+
 static const video_renderer_funcs_t video_renderer_rpi_funcs = {
     .start = video_renderer_rpi_start,
     .render_buffer = video_renderer_rpi_render_buffer,
     .flush = video_renderer_rpi_flush,
     .destroy = video_renderer_rpi_destroy,
     .update_background = video_renderer_rpi_update_background,
+    .supports_codec = video_renderer_rpi_supports_codec,
+    .set_codec = video_renderer_rpi_set_codec,
+    .get_latency = video_renderer_rpi_get_latency,
+    .get_queue_depth = video_renderer_rpi_get_queue_depth,
+    .reconfigure = video_renderer_rpi_reconfigure,
 };
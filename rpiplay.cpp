@@ -19,13 +19,20 @@
 
 #include <stddef.h>
 #include <cstring>
+#include <cerrno>
+#include <cstdlib>
 #include <signal.h>
 #include <unistd.h>
 #include <string>
 #include <vector>
+#include <map>
 #include <fstream>
+#include <chrono>
+#include <mutex>
+#include <sstream>
 
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <ifaddrs.h>
 #ifdef __linux__
 #include <netpacket/packet.h>
@@ -38,11 +45,19 @@
 #include "lib/stream.h"
 #include "lib/logger.h"
 #include "lib/dnssd.h"
+#include "lib/control_socket.h"
 #include "lib/esp32_comm.h"
 #include "lib/touch_handler.h"
 #include "renderers/video_renderer.h"
 #include "renderers/audio_renderer.h"
 
+#if defined(HAS_RENDERER_MODULES)
+#include <dlfcn.h>
+#include <dirent.h>
+#include <algorithm>
+#include "renderers/renderer_module.h"
+#endif
+
 #define VERSION "1.2"
 
 #define DEFAULT_NAME "RPiPlay"
@@ -52,9 +67,14 @@
 #define DEFAULT_DEBUG_LOG false
 #define DEFAULT_ROTATE 0
 #define DEFAULT_FLIP FLIP_NONE
+#define DEFAULT_DECODER NULL
+#define DEFAULT_HEVC false
+#define DEFAULT_BUILTIN_MDNS false
+#define DEFAULT_MAX_FPS 0
+#define DEFAULT_CONTROL_SOCKET ""
 #define DEFAULT_HW_ADDRESS { (char) 0x48, (char) 0x5d, (char) 0x60, (char) 0x7c, (char) 0xee, (char) 0x22 }
 
-int start_server(std::vector<char> hw_addr, std::string name, bool debug_log,
+int start_server(std::vector<char> hw_addr, std::string name, bool debug_log, bool hevc, bool builtin_mdns, int max_fps,
                  video_renderer_config_t const *video_config, audio_renderer_config_t const *audio_config);
 
 int stop_server();
@@ -84,6 +104,18 @@ static audio_renderer_t *audio_renderer = NULL;
 static logger_t *render_logger = NULL;
 static ESP32Comm *esp32_comm = NULL;
 static TouchHandler *touch_handler = NULL;
+/* Keeps touch events from being sent while the control socket changes the touch mapping */
+static std::mutex touch_mutex;
+static std::chrono::steady_clock::time_point startup_time;
+static control_socket_t *control_socket = NULL;
+
+// Settings the control socket may change, only touched on its thread once the server runs
+typedef struct control_settings_s {
+    video_renderer_config_t *video_config;
+    audio_renderer_config_t *audio_config;
+    int rpi_width, rpi_height;
+    int iphone_width, iphone_height;
+} control_settings_t;
 
 static const video_renderer_list_entry_t video_renderers[] = {
 #if defined(HAS_RPI_RENDERER)
@@ -175,12 +207,100 @@ static std::string find_mac () {
     return mac_address;
 }
 
+// The identity key lives next to the other per-user state, so senders stay paired across restarts
+static std::string find_keyfile() {
+    std::string dir;
+    const char *config_home = getenv("XDG_CONFIG_HOME");
+    const char *home = getenv("HOME");
+    if (config_home && *config_home) {
+        dir = config_home;
+    } else if (home && *home) {
+        dir = std::string(home) + "/.config";
+    } else {
+        return "";
+    }
+    mkdir(dir.c_str(), 0755);
+    dir += "/rpiplay";
+    if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+        LOGW("Could not create %s, senders will have to pair again after a restart", dir.c_str());
+        return "";
+    }
+    return dir + "/pairing.key";
+}
+
+#if defined(HAS_RENDERER_MODULES)
+static std::string find_module_dir() {
+    const char *dir = getenv("RPIPLAY_MODULE_DIR");
+    return dir && *dir ? dir : RENDERER_MODULE_DIR;
+}
+
+// Lists the renderer modules that are installed, best first, without loading them
+static std::vector<std::string> find_renderer_modules() {
+    static const char *preferred[] = { "rpi", "gstreamer" };
+    std::string prefix = RENDERER_MODULE_PREFIX, suffix = RENDERER_MODULE_SUFFIX;
+    std::vector<std::string> names;
+
+    DIR *dir = opendir(find_module_dir().c_str());
+    if (!dir) return names;
+    while (struct dirent *entry = readdir(dir)) {
+        std::string file = entry->d_name;
+        if (file.size() > prefix.size() + suffix.size() && !file.compare(0, prefix.size(), prefix) &&
+            !file.compare(file.size() - suffix.size(), suffix.size(), suffix)) {
+            names.push_back(file.substr(prefix.size(), file.size() - prefix.size() - suffix.size()));
+        }
+    }
+    closedir(dir);
+
+    std::sort(names.begin(), names.end(), [](const std::string &a, const std::string &b) {
+        int rank_a = 2, rank_b = 2;
+        for (int i = 0; i < 2; i++) {
+            if (a == preferred[i]) rank_a = i;
+            if (b == preferred[i]) rank_b = i;
+        }
+        return rank_a != rank_b ? rank_a < rank_b : a < b;
+    });
+    return names;
+}
+
+// Modules stay loaded until exit, the renderers they create live that long
+static const renderer_module_t *load_renderer_module(const char *name) {
+    static std::map<std::string, const renderer_module_t *> loaded;
+
+    std::vector<std::string> names = find_renderer_modules();
+    if (std::find(names.begin(), names.end(), name) == names.end()) {
+        return NULL;
+    }
+    if (loaded.count(name)) {
+        return loaded[name];
+    }
+
+    std::string path = find_module_dir() + "/" + RENDERER_MODULE_PREFIX + name + RENDERER_MODULE_SUFFIX;
+    void *handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        fprintf(stderr, "Error: Could not load renderer module: %s\n", dlerror());
+        return NULL;
+    }
+    const renderer_module_t *module = (const renderer_module_t *) dlsym(handle, RENDERER_MODULE_SYMBOL);
+    if (!module || module->version != RENDERER_MODULE_VERSION) {
+        fprintf(stderr, "Error: %s is not a renderer module for this version of RPiPlay\n", path.c_str());
+        dlclose(handle);
+        return NULL;
+    }
+    loaded[name] = module;
+    return module;
+}
+#endif
+
 static video_init_func_t find_video_init_func(const char *name) {
     for (int i = 0; i < sizeof(video_renderers)/sizeof(video_renderers[0]); i++) {
         if (!strcmp(name, video_renderers[i].name)) {
             return video_renderers[i].init_func;
         }
     }
+#if defined(HAS_RENDERER_MODULES)
+    const renderer_module_t *module = load_renderer_module(name);
+    if (module) return module->video_init;
+#endif
     return NULL;
 }
 
@@ -190,15 +310,49 @@ static audio_init_func_t find_audio_init_func(const char *name) {
             return audio_renderers[i].init_func;
         }
     }
+#if defined(HAS_RENDERER_MODULES)
+    const renderer_module_t *module = load_renderer_module(name);
+    if (module) return module->audio_init;
+#endif
     return NULL;
 }
 
+// Installed modules take precedence over the dummy renderers that are linked in
+static video_init_func_t find_default_video_init_func() {
+#if defined(HAS_RENDERER_MODULES)
+    for (const std::string &name : find_renderer_modules()) {
+        video_init_func_t init_func = find_video_init_func(name.c_str());
+        if (init_func) return init_func;
+    }
+#endif
+    return video_renderers[0].init_func;
+}
+
+static audio_init_func_t find_default_audio_init_func() {
+#if defined(HAS_RENDERER_MODULES)
+    for (const std::string &name : find_renderer_modules()) {
+        audio_init_func_t init_func = find_audio_init_func(name.c_str());
+        if (init_func) return init_func;
+    }
+#endif
+    return audio_renderers[0].init_func;
+}
+
+// Resident set size in kB, -1 if unknown
+static long get_resident_memory() {
+    long pages = -1;
+    std::ifstream statm("/proc/self/statm");
+    if (!(statm >> pages >> pages)) return -1;
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
 // Touch event callback
 void handle_touch_event(const TouchEvent& event) {
     if (!esp32_comm || !esp32_comm->is_connected()) {
         return;
     }
     
+    std::lock_guard<std::mutex> lock(touch_mutex);
     switch (event.type) {
         case TouchEvent::TOUCH_DOWN:
             LOGI("Touch down at (%d, %d)", event.x, event.y);
@@ -232,9 +386,119 @@ void handle_touch_event(const TouchEvent& event) {
     }
 }
 
+static bool parse_resolution(const std::string &str, int &width, int &height) {
+    char end;
+    return sscanf(str.c_str(), "%dx%d%c", &width, &height, &end) == 2 && width > 0 && height > 0;
+}
+
+static const char *flip_name(flip_mode_t flip) {
+    return flip == FLIP_HORIZONTAL ? "horiz" : flip == FLIP_VERTICAL ? "vert" : flip == FLIP_BOTH ? "both" : "none";
+}
+
+static const char *background_name(background_mode_t mode) {
+    return mode == BACKGROUND_MODE_OFF ? "off" : mode == BACKGROUND_MODE_AUTO ? "auto" : "on";
+}
+
+static const char *audio_device_name(audio_device_t device) {
+    return device == AUDIO_DEVICE_HDMI ? "hdmi" : device == AUDIO_DEVICE_ANALOG ? "analog" : "off";
+}
+
+// Applies one command from the control socket, the settings only change if the renderers took them
+extern "C" void control_command(void *cls, const char *command, char *reply, size_t reply_len) {
+    control_settings_t *settings = (control_settings_t *) cls;
+    std::istringstream args(command);
+    std::string name, value, extra;
+    args >> name >> value;
+
+    if (name == "status") {
+        snprintf(reply, reply_len, "ok rotation %d flip %s background %s audio %s touch %dx%d %dx%d",
+                 settings->video_config->rotation, flip_name(settings->video_config->flip),
+                 background_name(settings->video_config->background_mode),
+                 audio_renderer ? audio_device_name(settings->audio_config->device) : "off",
+                 settings->rpi_width, settings->rpi_height, settings->iphone_width, settings->iphone_height);
+        return;
+    }
+
+    video_renderer_config_t video_config = *settings->video_config;
+    if (name == "rotation") {
+        char *end;
+        long rotation = strtol(value.c_str(), &end, 10);
+        if (value.empty() || *end || rotation % 90 || rotation < -270 || rotation > 270) {
+            snprintf(reply, reply_len, "error rotation must be +/- 0,90,180,270");
+            return;
+        }
+        video_config.rotation = (int) rotation;
+    } else if (name == "flip") {
+        if (value != "none" && value != "horiz" && value != "vert" && value != "both") {
+            snprintf(reply, reply_len, "error flip must be none, horiz, vert or both");
+            return;
+        }
+        video_config.flip = value == "horiz" ? FLIP_HORIZONTAL :
+                            value == "vert" ? FLIP_VERTICAL :
+                            value == "both" ? FLIP_BOTH :
+                            FLIP_NONE;
+    } else if (name == "background") {
+        if (value != "on" && value != "auto" && value != "off") {
+            snprintf(reply, reply_len, "error background must be on, auto or off");
+            return;
+        }
+        video_config.background_mode = value == "off" ? BACKGROUND_MODE_OFF :
+                                       value == "auto" ? BACKGROUND_MODE_AUTO :
+                                       BACKGROUND_MODE_ON;
+    } else if (name == "audio") {
+        if (value != "hdmi" && value != "analog" && value != "off") {
+            snprintf(reply, reply_len, "error audio must be hdmi, analog or off");
+            return;
+        }
+        if (!audio_renderer) {
+            snprintf(reply, reply_len, "error audio was disabled at startup");
+            return;
+        }
+        audio_device_t device = value == "hdmi" ? AUDIO_DEVICE_HDMI :
+                                value == "analog" ? AUDIO_DEVICE_ANALOG :
+                                AUDIO_DEVICE_NONE;
+        if (!audio_renderer->funcs->set_device(audio_renderer, device)) {
+            snprintf(reply, reply_len, "error the audio renderer cannot switch to %s", value.c_str());
+            return;
+        }
+        settings->audio_config->device = device;
+        LOGI("Audio output switched to %s", value.c_str());
+        snprintf(reply, reply_len, "ok");
+        return;
+    } else if (name == "touch") {
+        int rpi_width, rpi_height, iphone_width, iphone_height;
+        args >> extra;
+        if (!parse_resolution(value, rpi_width, rpi_height) || !parse_resolution(extra, iphone_width, iphone_height)) {
+            snprintf(reply, reply_len, "error touch needs the screen and the iPhone resolution, e.g. touch 800x480 390x844");
+            return;
+        }
+        // The touch mapping and the ESP32 have to agree on the iPhone resolution
+        std::lock_guard<std::mutex> lock(touch_mutex);
+        if (touch_handler) touch_handler->set_coordinate_mapping(rpi_width, rpi_height, iphone_width, iphone_height);
+        if (esp32_comm) esp32_comm->set_iphone_resolution(iphone_width, iphone_height);
+        settings->rpi_width = rpi_width;
+        settings->rpi_height = rpi_height;
+        settings->iphone_width = iphone_width;
+        settings->iphone_height = iphone_height;
+        snprintf(reply, reply_len, "ok");
+        return;
+    } else {
+        snprintf(reply, reply_len, "error unknown command %s", name.c_str());
+        return;
+    }
+
+    if (!video_renderer->funcs->reconfigure(video_renderer, &video_config)) {
+        snprintf(reply, reply_len, "error the video renderer cannot change %s while running", name.c_str());
+        return;
+    }
+    *settings->video_config = video_config;
+    LOGI("Video %s set to %s", name.c_str(), value.c_str());
+    snprintf(reply, reply_len, "ok");
+}
+
 void print_info(char *name) {
     printf("RPiPlay %s: An open-source AirPlay mirroring server for Raspberry Pi\n", VERSION);
-    printf("Usage: %s [-n name] [-b (on|auto|off)] [-r (90|180|270)] [-l] [-a (hdmi|analog|off)] [-vr renderer] [-ar renderer] [-esp32 device] [-touch device] [-iphone WxH]\n", name);
+    printf("Usage: %s [-n name] [-b (on|auto|off)] [-r (90|180|270)] [-l] [-a (hdmi|analog|off)] [-vr renderer] [-vd decoder] [-hevc] [-fps n] [-mdns] [-ar renderer] [-esp32 device] [-touch device] [-iphone WxH] [-ctl path]\n", name);
     printf("Options:\n");
     printf("-n name               Specify the network name of the AirPlay server\n");
     printf("-b (on|auto|off)      Show black background always, only during active connection, or never\n");
@@ -243,37 +507,72 @@ void print_info(char *name) {
     printf("-l                    Enable low-latency mode (disables render clock)\n");
     printf("-a (hdmi|analog|off)  Set audio output device\n");
     printf("-vr renderer          Set video renderer to use. Available renderers:\n");
+    bool has_default = false;
+#if defined(HAS_RENDERER_MODULES)
+    std::vector<std::string> modules = find_renderer_modules();
+    for (const std::string &module_name : modules) {
+        const renderer_module_t *module = load_renderer_module(module_name.c_str());
+        if (module && module->video_description) {
+            printf("    %s: %s%s\n", module_name.c_str(), module->video_description, !has_default ? " [Default]" : "");
+            has_default = true;
+        }
+    }
+#endif
     for (int i = 0; i < sizeof(video_renderers)/sizeof(video_renderers[0]); i++) {
-        printf("    %s: %s%s\n", video_renderers[i].name, video_renderers[i].description, i == 0 ? " [Default]" : "");
+        printf("    %s: %s%s\n", video_renderers[i].name, video_renderers[i].description, i == 0 && !has_default ? " [Default]" : "");
     }
+    printf("-vd (auto|decoder)    Set the GStreamer H.264 decoder, e.g. \"avdec_h264 max-threads=2\",\n");
+    printf("                      or benchmark the available ones once and use the best (auto)\n");
+    printf("-hevc                 Offer H.265 mirroring if the video renderer can decode it\n");
+    printf("-fps n                Decode at most n frames per second by skipping non-reference frames\n");
+    printf("-mdns                 Advertise with the built-in mDNS responder instead of avahi\n");
     printf("-ar renderer          Set audio renderer to use. Available renderers:\n");
+    has_default = false;
+#if defined(HAS_RENDERER_MODULES)
+    for (const std::string &module_name : modules) {
+        const renderer_module_t *module = load_renderer_module(module_name.c_str());
+        if (module && module->audio_description) {
+            printf("    %s: %s%s\n", module_name.c_str(), module->audio_description, !has_default ? " [Default]" : "");
+            has_default = true;
+        }
+    }
+#endif
     for (int i = 0; i < sizeof(audio_renderers)/sizeof(audio_renderers[0]); i++) {
-        printf("    %s: %s%s\n", audio_renderers[i].name, audio_renderers[i].description, i == 0 ? " [Default]" : "");
+        printf("    %s: %s%s\n", audio_renderers[i].name, audio_renderers[i].description, i == 0 && !has_default ? " [Default]" : "");
     }
     printf("-d                    Enable debug logging\n");
     printf("-esp32 device         Enable ESP32 touch control via serial device (default: /dev/ttyUSB0)\n");
     printf("-touch device         Enable touchscreen input device (default: /dev/input/event0)\n");
     printf("-iphone WxH           Set iPhone screen resolution (default: 390x844 for iPhone 14)\n");
     printf("-rpi WxH              Set RPi touchscreen resolution (default: 800x480)\n");
+    printf("-ctl path             Accept settings changes on a local control socket at path\n");
     printf("-v/-h                 Displays this help and version information\n");
 }
 
 int main(int argc, char *argv[]) {
+    startup_time = std::chrono::steady_clock::now();
     init_signals();
     
     std::string server_name = DEFAULT_NAME;
     std::vector<char> server_hw_addr = DEFAULT_HW_ADDRESS;
     bool debug_log = DEFAULT_DEBUG_LOG;
+    bool hevc = DEFAULT_HEVC;
+    bool builtin_mdns = DEFAULT_BUILTIN_MDNS;
+    int max_fps = DEFAULT_MAX_FPS;
+    std::string control_path = DEFAULT_CONTROL_SOCKET;
 
     video_renderer_config_t video_config;
     video_config.background_mode = DEFAULT_BACKGROUND_MODE;
     video_config.low_latency = DEFAULT_LOW_LATENCY;
     video_config.rotation = DEFAULT_ROTATE;
     video_config.flip = DEFAULT_FLIP;
+    video_config.decoder = DEFAULT_DECODER;
+    video_config.probe = NULL;
     
     audio_renderer_config_t audio_config;
     audio_config.device = DEFAULT_AUDIO_DEVICE;
     audio_config.low_latency = DEFAULT_LOW_LATENCY;
+    audio_config.probe = NULL;
     
     // ESP32 and touch configuration
     std::string esp32_device = "/dev/ttyUSB0";
@@ -285,10 +584,6 @@ int main(int argc, char *argv[]) {
     int rpi_width = 800;
     int rpi_height = 480;
     
-    // Default to the best available renderer
-    video_init_func = video_renderers[0].init_func;
-    audio_init_func = audio_renderers[0].init_func;
-
     // Parse arguments
     for (int i = 1; i < argc; i++) {
         std::string arg(argv[i]);
@@ -336,6 +631,26 @@ int main(int argc, char *argv[]) {
                 fprintf(stderr, "Error: Unable to locate video renderer \"%s\".\n", argv[i]);
                 exit(1);
             }
+        } else if (arg == "-vd") {
+            if (i == argc - 1) {
+                fprintf(stderr, "Error: You must supply a decoder or \"auto\" after the -vd argument.\n");
+                exit(1);
+            }
+            video_config.decoder = argv[++i];
+        } else if (arg == "-hevc") {
+            hevc = !hevc;
+        } else if (arg == "-fps") {
+            if (i == argc - 1) {
+                fprintf(stderr, "Error: You must supply a frame rate after the -fps argument.\n");
+                exit(1);
+            }
+            max_fps = atoi(argv[++i]);
+            if (max_fps <= 0) {
+                fprintf(stderr, "Error: The frame rate must be a positive number.\n");
+                exit(1);
+            }
+        } else if (arg == "-mdns") {
+            builtin_mdns = !builtin_mdns;
         } else if (arg == "-ar") {
             if (i == argc - 1) {
                 fprintf(stderr, "Error: You must supply the name of an audio renderer after the -ar argument.\n");
@@ -370,19 +685,29 @@ int main(int argc, char *argv[]) {
                 rpi_width = std::stoi(resolution.substr(0, x_pos));
                 rpi_height = std::stoi(resolution.substr(x_pos + 1));
             }
+        } else if (arg == "-ctl") {
+            if (i == argc - 1) {
+                fprintf(stderr, "Error: You must supply a socket path after the -ctl argument.\n");
+                exit(1);
+            }
+            control_path = argv[++i];
         } else if (arg == "-h" || arg == "-v") {
             print_info(argv[0]);
             exit(0);
         }
     }
 
+    // Default to the best available renderer
+    if (!video_init_func) video_init_func = find_default_video_init_func();
+    if (!audio_init_func) audio_init_func = find_default_audio_init_func();
+
     std::string mac_address = find_mac();
     if (!mac_address.empty()) {
         server_hw_addr.clear();
         parse_hw_addr(mac_address, server_hw_addr);
     }
 
-    if (start_server(server_hw_addr, server_name, debug_log, &video_config, &audio_config) != 0) {
+    if (start_server(server_hw_addr, server_name, debug_log, hevc, builtin_mdns, max_fps, &video_config, &audio_config) != 0) {
         return 1;
     }
 
@@ -414,12 +739,25 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    control_settings_t control_settings = { &video_config, &audio_config, rpi_width, rpi_height,
+                                            iphone_width, iphone_height };
+    if (!control_path.empty()) {
+        control_socket = control_socket_init(render_logger, control_path.c_str(), control_command, &control_settings);
+        if (!control_socket) {
+            LOGE("Could not open the control socket %s", control_path.c_str());
+        }
+    }
+
     running = true;
     while (running) {
         sleep(1);
     }
 
     LOGI("Stopping...");
+
+    // Stop taking commands before anything they refer to goes away
+    control_socket_destroy(control_socket);
+    control_socket = NULL;
     
     // Stop touch handler
     if (touch_handler) {
@@ -455,6 +793,9 @@ extern "C" void audio_process(void *cls, raop_ntp_t *ntp, aac_decode_struct *dat
 
 extern "C" void video_process(void *cls, raop_ntp_t *ntp, h264_decode_struct *data) {
     if (video_renderer != NULL) {
+        if (data->frame_type == 0) {
+            video_renderer->funcs->set_codec(video_renderer, data->codec);
+        }
         video_renderer->funcs->render_buffer(video_renderer, ntp, data->data, data->data_len, data->pts, data->frame_type);
     }
 }
@@ -467,10 +808,31 @@ extern "C" void video_flush(void *cls) {
     if (video_renderer) video_renderer->funcs->flush(video_renderer);
 }
 
-extern "C" void audio_set_volume(void *cls, float volume) {
+extern "C" void audio_set_volume(void *cls, float volume, uint64_t pts) {
+    if (audio_renderer != NULL) {
+        audio_renderer->funcs->set_volume(audio_renderer, volume, pts);
+    }
+}
+
+extern "C" uint64_t audio_get_latency(void *cls) {
     if (audio_renderer != NULL) {
-        audio_renderer->funcs->set_volume(audio_renderer, volume);
+        return audio_renderer->funcs->get_latency(audio_renderer);
+    }
+    return 0;
+}
+
+extern "C" uint64_t video_get_latency(void *cls) {
+    if (video_renderer != NULL) {
+        return video_renderer->funcs->get_latency(video_renderer);
+    }
+    return 0;
+}
+
+extern "C" int video_get_queue_depth(void *cls) {
+    if (video_renderer != NULL) {
+        return video_renderer->funcs->get_queue_depth(video_renderer);
     }
+    return 0;
 }
 
 extern "C" void log_callback(void *cls, int level, const char *msg) {
@@ -497,7 +859,7 @@ extern "C" void log_callback(void *cls, int level, const char *msg) {
 
 }
 
-int start_server(std::vector<char> hw_addr, std::string name, bool debug_log,
+int start_server(std::vector<char> hw_addr, std::string name, bool debug_log, bool hevc, bool builtin_mdns, int max_fps,
                  video_renderer_config_t const *video_config, audio_renderer_config_t const *audio_config) {
     raop_callbacks_t raop_cbs;
     memset(&raop_cbs, 0, sizeof(raop_cbs));
@@ -508,6 +870,9 @@ int start_server(std::vector<char> hw_addr, std::string name, bool debug_log,
     raop_cbs.audio_flush = audio_flush;
     raop_cbs.video_flush = video_flush;
     raop_cbs.audio_set_volume = audio_set_volume;
+    raop_cbs.audio_get_latency = audio_get_latency;
+    raop_cbs.video_get_latency = video_get_latency;
+    raop_cbs.video_get_queue_depth = video_get_queue_depth;
 
     raop = raop_init(10, &raop_cbs);
     if (raop == NULL) {
@@ -518,6 +883,13 @@ int start_server(std::vector<char> hw_addr, std::string name, bool debug_log,
     raop_set_log_callback(raop, log_callback, NULL);
     raop_set_log_level(raop, debug_log ? RAOP_LOG_DEBUG : LOGGER_INFO);
 
+    // Only now that the log goes somewhere, so that a lost identity key does not go unnoticed
+    std::string keyfile = find_keyfile();
+    if (!keyfile.empty() && raop_set_keyfile(raop, keyfile.c_str()) < 0) {
+        LOGE("Error creating the identity key!");
+        return -1;
+    }
+
     render_logger = logger_init();
     logger_set_callback(render_logger, log_callback, NULL);
     logger_set_level(render_logger, debug_log ? LOGGER_DEBUG : LOGGER_INFO);
@@ -540,19 +912,38 @@ int start_server(std::vector<char> hw_addr, std::string name, bool debug_log,
     if (video_renderer) video_renderer->funcs->start(video_renderer);
     if (audio_renderer) audio_renderer->funcs->start(audio_renderer);
 
+    std::chrono::duration<double, std::milli> startup = std::chrono::steady_clock::now() - startup_time;
+    LOGI("Renderers started after %.1f ms, resident memory %ld kB", startup.count(), get_resident_memory());
+
     unsigned short port = 0;
     raop_start(raop, &port);
     raop_set_port(raop, port);
 
     int error;
-    dnssd = dnssd_init(name.c_str(), strlen(name.c_str()), hw_addr.data(), hw_addr.size(), &error);
-    if (error) {
+    dnssd = dnssd_init(name.c_str(), strlen(name.c_str()), hw_addr.data(), hw_addr.size(), builtin_mdns, &error);
+    if (error == DNSSD_ERROR_MDNS) {
+        LOGE("Could not start the mDNS responder, is UDP port 5353 available?");
+        return -2;
+    } else if (error) {
         LOGE("Could not initialize dnssd library!");
         return -2;
     }
 
     raop_set_dnssd(raop, dnssd);
 
+    if (hevc && video_renderer->funcs->supports_codec(video_renderer, VIDEO_CODEC_H265)) {
+        LOGI("Offering H.265 mirroring");
+        raop_set_hevc(raop, 1);
+        dnssd_set_airplay_features(dnssd, RAOP_FEATURE_SCREEN_MULTI_CODEC, 1);
+    } else if (hevc) {
+        LOGW("The video renderer cannot decode H.265, only offering H.264 mirroring");
+    }
+
+    if (max_fps) {
+        LOGI("Decoding at most %d frames per second", max_fps);
+        raop_set_max_fps(raop, max_fps);
+    }
+
     dnssd_register_raop(dnssd, port);
     dnssd_register_airplay(dnssd, port + 1);
 
@@ -563,6 +954,7 @@ int stop_server() {
     raop_destroy(raop);
     dnssd_unregister_raop(dnssd);
     dnssd_unregister_airplay(dnssd);
+    dnssd_destroy(dnssd);
     // If we don't destroy these two in the correct order, we get a deadlock from the ilclient library
     if (audio_renderer) audio_renderer->funcs->destroy(audio_renderer);
     if (video_renderer) video_renderer->funcs->destroy(video_renderer);
@@ -0,0 +1,502 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Glass-to-glass latency and A/V sync harness for the GStreamer renderers.
+ *
+ * Plays the part of the sender: a synthesized H.264 stream whose pictures carry
+ * a sequence number in their pixels and a SEI message with the send time, and
+ * an AAC-ELD stream with a short tone burst every second, at the same moment
+ * as one of the video frames. Both are fed through the renderer interface
+ * like raop does, in real time. Probes on the renderer pipelines see the
+ * frames leave the input queue and arrive at the sink after decoding, where
+ * the markers are detected again. The sinks are fakesinks, so this runs
+ * without a display or sound card.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "aacenc_lib.h"
+
+#include "../lib/logger.h"
+#include "../lib/threads.h"
+#include "../renderers/video_renderer.h"
+#include "../renderers/audio_renderer.h"
+#include "../renderers/h264_synth.h"
+
+#define VIDEO_WIDTH 1280
+#define VIDEO_HEIGHT 720
+#define DEFAULT_FPS 30
+#define DEFAULT_SECONDS 10
+
+#define SAMPLE_RATE 44100
+#define CHANNELS 2
+#define AUDIO_FRAME_SAMPLES 480
+
+// 20 ms of 1 kHz at -6 dBFS at the start of every second but the first
+#define TONE_FREQUENCY 1000
+#define TONE_SAMPLES (SAMPLE_RATE / 50)
+#define TONE_AMPLITUDE 16384
+#define TONE_THRESHOLD 8192
+#define TONE_QUIET_SAMPLES (SAMPLE_RATE / 2)
+
+static const unsigned char eld_conf[] = { 0xF8, 0xE8, 0x50, 0x00 };
+
+typedef struct stats_s {
+    const char *name;
+    int64_t *values;
+    int count;
+    int size;
+} stats_t;
+
+typedef struct harness_s {
+    mutex_handle_t mutex;
+
+    int fps;
+    int video_frames;
+    int audio_frames;
+    int bursts;
+    int audio_delay; // Codec delay in samples
+
+    // Indexed by video sequence number, in microseconds
+    int64_t *video_push;
+    int64_t *video_queued;
+    int64_t *video_present;
+
+    // Indexed by audio frame
+    int64_t *audio_push;
+    int64_t *audio_queued;
+
+    // Indexed by tone burst
+    int64_t *burst_present;
+    int quiet_samples;
+
+    stats_t video_queue, video_decode, video_total;
+    stats_t audio_queue, audio_decode, audio_total;
+    stats_t av_offset;
+} harness_t;
+
+static int64_t
+now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void
+sleep_until(int64_t time)
+{
+    int64_t delay = time - now_us();
+    if (delay > 0) {
+        usleep(delay);
+    }
+}
+
+static void
+stats_init(stats_t *stats, const char *name, int size)
+{
+    stats->name = name;
+    stats->values = calloc(size, sizeof(int64_t));
+    stats->size = size;
+    stats->count = 0;
+}
+
+static void
+stats_add(stats_t *stats, int64_t value)
+{
+    if (stats->count < stats->size) {
+        stats->values[stats->count++] = value;
+    }
+}
+
+static int
+compare_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void
+stats_print(stats_t *stats)
+{
+    if (stats->count == 0) {
+        printf("%-14s %6d\n", stats->name, 0);
+        return;
+    }
+    qsort(stats->values, stats->count, sizeof(int64_t), compare_int64);
+    int64_t *v = stats->values;
+    int n = stats->count - 1;
+    printf("%-14s %6d %8.1f %8.1f %8.1f %8.1f %8.1f\n", stats->name, stats->count,
+           v[0] / 1000.0, v[n / 2] / 1000.0, v[n * 95 / 100] / 1000.0, v[n * 99 / 100] / 1000.0, v[n] / 1000.0);
+}
+
+static uint64_t
+audio_frame_pts(int frame)
+{
+    return (uint64_t) frame * AUDIO_FRAME_SAMPLES * 1000000 / SAMPLE_RATE;
+}
+
+static int
+audio_pts_frame(uint64_t pts)
+{
+    uint64_t frame_us = (uint64_t) AUDIO_FRAME_SAMPLES * 1000000;
+    return (int) ((pts * SAMPLE_RATE + frame_us / 2) / frame_us);
+}
+
+static void
+video_queued(void *cls, uint64_t pts, const unsigned char *data, int data_len)
+{
+    harness_t *h = cls;
+    int64_t now = now_us();
+    uint32_t seq;
+    uint64_t timestamp;
+
+    if (h264_synth_parse_sei(data, data_len, &seq, &timestamp) < 0 || seq >= (uint32_t) h->video_frames) {
+        return;
+    }
+    MUTEX_LOCK(h->mutex);
+    h->video_queued[seq] = now;
+    stats_add(&h->video_queue, now - (int64_t) timestamp);
+    MUTEX_UNLOCK(h->mutex);
+}
+
+static void
+video_decoded(void *cls, uint64_t pts, const unsigned char *luma, int stride, int width, int height)
+{
+    harness_t *h = cls;
+    int64_t now = now_us();
+    uint32_t seq;
+
+    if (h264_synth_read_marker(luma, stride, width, height, &seq) < 0 || seq >= (uint32_t) h->video_frames) {
+        return;
+    }
+    MUTEX_LOCK(h->mutex);
+    if (!h->video_present[seq]) {
+        h->video_present[seq] = now;
+        stats_add(&h->video_total, now - h->video_push[seq]);
+        if (h->video_queued[seq]) {
+            stats_add(&h->video_decode, now - h->video_queued[seq]);
+        }
+    }
+    MUTEX_UNLOCK(h->mutex);
+}
+
+static void
+audio_queued(void *cls, uint64_t pts, const unsigned char *data, int data_len)
+{
+    harness_t *h = cls;
+    int64_t now = now_us();
+    int frame = audio_pts_frame(pts);
+
+    if (frame < 0 || frame >= h->audio_frames) {
+        return;
+    }
+    MUTEX_LOCK(h->mutex);
+    h->audio_queued[frame] = now;
+    if (h->audio_push[frame]) {
+        stats_add(&h->audio_queue, now - h->audio_push[frame]);
+    }
+    MUTEX_UNLOCK(h->mutex);
+}
+
+static void
+audio_decoded(void *cls, uint64_t pts, const int16_t *samples, int frames, int channels)
+{
+    harness_t *h = cls;
+    int64_t now = now_us();
+
+    MUTEX_LOCK(h->mutex);
+    for (int i = 0; i < frames; i++) {
+        int sample = samples[i * channels];
+        if (sample < TONE_THRESHOLD && sample > -TONE_THRESHOLD) {
+            h->quiet_samples++;
+            continue;
+        }
+        // Bursts start on the second, so the sample's position in the stream tells which one this is
+        int64_t position = (int64_t) (pts * SAMPLE_RATE / 1000000) + i - h->audio_delay;
+        int burst = (int) ((position + SAMPLE_RATE / 2) / SAMPLE_RATE);
+        if (h->quiet_samples >= TONE_QUIET_SAMPLES && burst > 0 && burst < h->bursts && !h->burst_present[burst]) {
+            int64_t onset = now + (int64_t) i * 1000000 / SAMPLE_RATE;
+            h->burst_present[burst] = onset;
+
+            // The codec delays the burst, find the frame that carries its start
+            int start = burst * SAMPLE_RATE + h->audio_delay;
+            int frame = start / AUDIO_FRAME_SAMPLES;
+            int64_t offset = (int64_t) (start % AUDIO_FRAME_SAMPLES) * 1000000 / SAMPLE_RATE;
+            if (frame < h->audio_frames && h->audio_push[frame]) {
+                stats_add(&h->audio_total, onset - (h->audio_push[frame] + offset));
+            }
+            if (frame < h->audio_frames && h->audio_queued[frame]) {
+                stats_add(&h->audio_decode, onset - (h->audio_queued[frame] + offset));
+            }
+        }
+        h->quiet_samples = 0;
+    }
+    MUTEX_UNLOCK(h->mutex);
+}
+
+/* Encodes the whole audio track up front, so that the encoder does not disturb the timing */
+static int
+encode_audio(harness_t *h, unsigned char **frames, int *frame_lens)
+{
+    HANDLE_AACENCODER encoder;
+    AACENC_InfoStruct info;
+
+    if (aacEncOpen(&encoder, 0, CHANNELS) != AACENC_OK) {
+        fprintf(stderr, "Could not open the AAC encoder\n");
+        return -1;
+    }
+    if (aacEncoder_SetParam(encoder, AACENC_AOT, AOT_ER_AAC_ELD) != AACENC_OK ||
+        aacEncoder_SetParam(encoder, AACENC_SAMPLERATE, SAMPLE_RATE) != AACENC_OK ||
+        aacEncoder_SetParam(encoder, AACENC_CHANNELMODE, MODE_2) != AACENC_OK ||
+        aacEncoder_SetParam(encoder, AACENC_GRANULE_LENGTH, AUDIO_FRAME_SAMPLES) != AACENC_OK ||
+        aacEncoder_SetParam(encoder, AACENC_SBR_MODE, 0) != AACENC_OK ||
+        aacEncoder_SetParam(encoder, AACENC_BITRATE, 128000) != AACENC_OK ||
+        aacEncoder_SetParam(encoder, AACENC_TRANSMUX, TT_MP4_RAW) != AACENC_OK ||
+        aacEncEncode(encoder, NULL, NULL, NULL, NULL) != AACENC_OK ||
+        aacEncInfo(encoder, &info) != AACENC_OK) {
+        fprintf(stderr, "Could not configure the AAC encoder for AAC-ELD\n");
+        aacEncClose(&encoder);
+        return -1;
+    }
+    // The renderers expect exactly the configuration AirPlay senders use
+    if (info.confSize != sizeof(eld_conf) || memcmp(info.confBuf, eld_conf, sizeof(eld_conf)) != 0) {
+        fprintf(stderr, "Warning: the encoder's AAC-ELD configuration differs from the one senders use\n");
+    }
+    h->audio_delay = info.nDelay;
+
+    INT_PCM pcm[AUDIO_FRAME_SAMPLES * CHANNELS];
+    UCHAR out[768];
+    int count = 0;
+    for (int frame = 0; count < h->audio_frames && frame < 2 * h->audio_frames; frame++) {
+        void *in_ptr = pcm, *out_ptr = out;
+        INT in_id = IN_AUDIO_DATA, out_id = OUT_BITSTREAM_DATA;
+        INT in_size = sizeof(pcm), out_size = sizeof(out);
+        INT in_el_size = sizeof(INT_PCM), out_el_size = 1;
+        AACENC_BufDesc in_buf = { 1, &in_ptr, &in_id, &in_size, &in_el_size };
+        AACENC_BufDesc out_buf = { 1, &out_ptr, &out_id, &out_size, &out_el_size };
+        AACENC_InArgs in_args = { AUDIO_FRAME_SAMPLES * CHANNELS, 0 };
+        AACENC_OutArgs out_args;
+
+        for (int i = 0; i < AUDIO_FRAME_SAMPLES; i++) {
+            int n = frame * AUDIO_FRAME_SAMPLES + i;
+            int in_burst = n >= SAMPLE_RATE && n % SAMPLE_RATE < TONE_SAMPLES;
+            INT_PCM value = in_burst ? (INT_PCM) (TONE_AMPLITUDE * sin(2 * M_PI * TONE_FREQUENCY * n / SAMPLE_RATE)) : 0;
+            for (int c = 0; c < CHANNELS; c++) {
+                pcm[i * CHANNELS + c] = value;
+            }
+        }
+
+        memset(&out_args, 0, sizeof(out_args));
+        if (aacEncEncode(encoder, &in_buf, &out_buf, &in_args, &out_args) != AACENC_OK) {
+            fprintf(stderr, "AAC encoding failed\n");
+            aacEncClose(&encoder);
+            return -1;
+        }
+        if (out_args.numOutBytes > 0) {
+            frames[count] = malloc(out_args.numOutBytes);
+            memcpy(frames[count], out, out_args.numOutBytes);
+            frame_lens[count] = out_args.numOutBytes;
+            count++;
+        }
+    }
+    aacEncClose(&encoder);
+    if (count < h->audio_frames) {
+        fprintf(stderr, "The AAC encoder produced too few frames\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void
+print_usage(const char *argv0)
+{
+    printf("Usage: %s [-t seconds] [-fps n] [-vd decoder] [-na]\n", argv0);
+    printf("-t seconds  Duration of the run, default %d\n", DEFAULT_SECONDS);
+    printf("-fps n      Video frame rate, default %d\n", DEFAULT_FPS);
+    printf("-vd decoder H.264 decoder for the video renderer, as for rpiplay\n");
+    printf("-na         Video only, no audio\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    harness_t h;
+    int seconds = DEFAULT_SECONDS;
+    int audio = 1;
+    const char *decoder = NULL;
+
+    memset(&h, 0, sizeof(h));
+    h.fps = DEFAULT_FPS;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            seconds = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-fps") && i + 1 < argc) {
+            h.fps = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-vd") && i + 1 < argc) {
+            decoder = argv[++i];
+        } else if (!strcmp(argv[i], "-na")) {
+            audio = 0;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (seconds < 2 || h.fps < 1) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    MUTEX_CREATE(h.mutex);
+    h.video_frames = seconds * h.fps;
+    h.audio_frames = audio ? seconds * SAMPLE_RATE / AUDIO_FRAME_SAMPLES : 0;
+    h.bursts = seconds;
+    h.quiet_samples = TONE_QUIET_SAMPLES;
+    h.video_push = calloc(h.video_frames, sizeof(int64_t));
+    h.video_queued = calloc(h.video_frames, sizeof(int64_t));
+    h.video_present = calloc(h.video_frames, sizeof(int64_t));
+    h.audio_push = calloc(h.audio_frames + 1, sizeof(int64_t));
+    h.audio_queued = calloc(h.audio_frames + 1, sizeof(int64_t));
+    h.burst_present = calloc(h.bursts, sizeof(int64_t));
+    stats_init(&h.video_queue, "video queue", h.video_frames);
+    stats_init(&h.video_decode, "video decode", h.video_frames);
+    stats_init(&h.video_total, "video total", h.video_frames);
+    stats_init(&h.audio_queue, "audio queue", h.audio_frames);
+    stats_init(&h.audio_decode, "audio decode", h.bursts);
+    stats_init(&h.audio_total, "audio total", h.bursts);
+    stats_init(&h.av_offset, "a/v offset", h.bursts);
+
+    unsigned char **audio_data = calloc(h.audio_frames + 1, sizeof(unsigned char *));
+    int *audio_len = calloc(h.audio_frames + 1, sizeof(int));
+    if (audio && encode_audio(&h, audio_data, audio_len) < 0) {
+        return 1;
+    }
+
+    renderer_probe_t probe;
+    memset(&probe, 0, sizeof(probe));
+    probe.cls = &h;
+    probe.video_queued = video_queued;
+    probe.video_decoded = video_decoded;
+    probe.audio_queued = audio_queued;
+    probe.audio_decoded = audio_decoded;
+
+    video_renderer_config_t video_config;
+    memset(&video_config, 0, sizeof(video_config));
+    video_config.background_mode = BACKGROUND_MODE_OFF;
+    video_config.decoder = decoder;
+    video_config.probe = &probe;
+
+    audio_renderer_config_t audio_config;
+    memset(&audio_config, 0, sizeof(audio_config));
+    audio_config.device = AUDIO_DEVICE_HDMI;
+    audio_config.probe = &probe;
+
+    logger_t *logger = logger_init();
+    logger_set_level(logger, LOGGER_INFO);
+
+    video_renderer_t *video_renderer = video_renderer_gstreamer_init(logger, &video_config);
+    audio_renderer_t *audio_renderer = audio ? audio_renderer_gstreamer_init(logger, video_renderer, &audio_config) : NULL;
+    if (!video_renderer || (audio && !audio_renderer)) {
+        fprintf(stderr, "Could not initialize the GStreamer renderers\n");
+        return 1;
+    }
+    video_renderer->funcs->start(video_renderer);
+    if (audio_renderer) audio_renderer->funcs->start(audio_renderer);
+
+    h264_synth_t *synth = h264_synth_init(VIDEO_WIDTH, VIDEO_HEIGHT);
+    const unsigned char *data;
+    int len = h264_synth_get_headers(synth, &data);
+    int64_t start = now_us() + 100000;
+
+    printf("Running for %d seconds at %d fps%s\n", seconds, h.fps, audio ? " with audio" : "");
+    video_renderer->funcs->render_buffer(video_renderer, NULL, (unsigned char *) data, len, 0, 0);
+
+    int video_frame = 0, audio_frame = 0;
+    while (video_frame < h.video_frames || audio_frame < h.audio_frames) {
+        int64_t video_time = start + (int64_t) video_frame * 1000000 / h.fps;
+        int64_t audio_time = start + (int64_t) audio_frame_pts(audio_frame);
+
+        if (video_frame < h.video_frames && (audio_frame >= h.audio_frames || video_time <= audio_time)) {
+            // The SEI carries the scheduled send time
+            len = h264_synth_next_marked_frame(synth, video_frame, video_time, &data);
+            sleep_until(video_time);
+            MUTEX_LOCK(h.mutex);
+            h.video_push[video_frame] = now_us();
+            MUTEX_UNLOCK(h.mutex);
+            video_renderer->funcs->render_buffer(video_renderer, NULL, (unsigned char *) data, len,
+                                                 (uint64_t) video_frame * 1000000 / h.fps, 1);
+            video_frame++;
+        } else {
+            sleep_until(audio_time);
+            MUTEX_LOCK(h.mutex);
+            h.audio_push[audio_frame] = now_us();
+            MUTEX_UNLOCK(h.mutex);
+            audio_renderer->funcs->render_buffer(audio_renderer, NULL, audio_data[audio_frame], audio_len[audio_frame],
+                                                 audio_frame_pts(audio_frame));
+            audio_frame++;
+        }
+    }
+
+    // Let the pipelines drain before looking at the results
+    sleepms(1000);
+    uint64_t video_latency = video_renderer->funcs->get_latency(video_renderer);
+    uint64_t audio_latency = audio_renderer ? audio_renderer->funcs->get_latency(audio_renderer) : 0;
+    if (audio_renderer) audio_renderer->funcs->destroy(audio_renderer);
+    video_renderer->funcs->destroy(video_renderer);
+
+    // A burst goes out together with the first frame of its second
+    for (int burst = 1; burst < h.bursts; burst++) {
+        int frame = burst * h.fps;
+        if (h.burst_present[burst] && frame < h.video_frames && h.video_present[frame]) {
+            stats_add(&h.av_offset, h.burst_present[burst] - h.video_present[frame]);
+        }
+    }
+
+    printf("\n%-14s %6s %8s %8s %8s %8s %8s\n", "stage (ms)", "count", "min", "p50", "p95", "p99", "max");
+    stats_print(&h.video_queue);
+    stats_print(&h.video_decode);
+    stats_print(&h.video_total);
+    if (audio) {
+        stats_print(&h.audio_queue);
+        stats_print(&h.audio_decode);
+        stats_print(&h.audio_total);
+        stats_print(&h.av_offset);
+        printf("(a positive a/v offset means audio comes out after video)\n");
+    }
+    printf("\nReported by the renderers: video %.1f ms, audio %.1f ms\n", video_latency / 1000.0, audio_latency / 1000.0);
+    printf("Frames detected at the sink: video %d of %d, audio bursts %d of %d\n",
+           h.video_total.count, h.video_frames, h.audio_total.count, audio ? h.bursts - 1 : 0);
+
+    int ok = h.video_total.count > 0 && (!audio || h.audio_total.count > 0);
+
+    h264_synth_destroy(synth);
+    for (int i = 0; i < h.audio_frames; i++) {
+        free(audio_data[i]);
+    }
+    free(audio_data);
+    free(audio_len);
+    logger_destroy(logger);
+    MUTEX_DESTROY(h.mutex);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,879 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Connection setup benchmark for the RTSP control plane.
+ *
+ * Runs raop on loopback and plays the part of many senders connecting at
+ * once, each going through the requests a sender makes before mirroring
+ * starts: /info, pair-setup, pair-verify, fp-setup, the two SETUPs, RECORD,
+ * GET_PARAMETER, SET_PARAMETER and FLUSH. The server is given fixed test keys,
+ * so the sender's half of pair-verify is computed once and every connection
+ * sends the same bytes. The requests are either synthesized or read from a
+ * recording of the sender's side of a real session. Timing requests from the
+ * server are answered, so clock sync runs like with a real sender. Prints
+ * latency percentiles per request and for the whole setup.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <plist/plist.h>
+
+#include "../lib/raop.h"
+#include "../lib/crypto.h"
+#include "../lib/byteutils.h"
+#include "../lib/threads.h"
+
+#define DEFAULT_CONNECTIONS 200
+#define DEFAULT_CONCURRENCY 8
+/* raop takes fewer than 100 clients, and connections that are closing still count for a moment */
+#define MAX_CONCURRENCY 64
+#define MAX_STEPS 32
+#define MAX_RESPONSE 65536
+#define IO_TIMEOUT 5 // seconds
+
+#define SALT_KEY "Pair-Verify-AES-Key"
+#define SALT_IV "Pair-Verify-AES-IV"
+
+/* Tell the fixed keys apart, their values do not matter as long as every run uses the same */
+#define SERVER_IDENTITY_KEY 0x11
+#define SERVER_ECDH_KEY 0x22
+#define CLIENT_IDENTITY_KEY 0x33
+#define CLIENT_ECDH_KEY 0x44
+
+typedef struct stats_s {
+    const char *name;
+    int64_t *values;
+    int count;
+    int size;
+} stats_t;
+
+typedef struct client_keys_s {
+    unsigned char ed_public[ED25519_KEY_SIZE];
+    unsigned char ecdh_public[X25519_KEY_SIZE];
+    unsigned char server_ecdh_public[X25519_KEY_SIZE];
+    /* Encrypted, as sent with the second pair-verify request */
+    unsigned char signature[2 * X25519_KEY_SIZE];
+} client_keys_t;
+
+typedef struct step_s {
+    char name[32];
+    char *request;
+    int request_len;
+    /* The answer to the first pair-verify request must carry the test key */
+    int check_ecdh;
+} step_t;
+
+typedef struct transcript_s {
+    step_t steps[MAX_STEPS];
+    int count;
+} transcript_t;
+
+typedef struct bench_s {
+    transcript_t transcript;
+    client_keys_t keys;
+    unsigned short port;
+
+    int timing_fd;
+    unsigned short timing_port;
+    thread_handle_t timing_thread;
+
+    mutex_handle_t mutex;
+    int timing_running;
+    int connections;
+    int next_connection;
+    int failures;
+    char error[128];
+    stats_t connect_stats;
+    stats_t step_stats[MAX_STEPS];
+    stats_t total_stats;
+} bench_t;
+
+static int64_t
+now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void
+stats_init(stats_t *stats, const char *name, int size)
+{
+    stats->name = name;
+    stats->values = calloc(size, sizeof(int64_t));
+    stats->size = size;
+    stats->count = 0;
+}
+
+static void
+stats_add(stats_t *stats, int64_t value)
+{
+    if (stats->count < stats->size) {
+        stats->values[stats->count++] = value;
+    }
+}
+
+static int
+compare_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void
+stats_print(stats_t *stats)
+{
+    if (stats->count == 0) {
+        printf("%-16s %6d\n", stats->name, 0);
+        return;
+    }
+    qsort(stats->values, stats->count, sizeof(int64_t), compare_int64);
+    int64_t *v = stats->values;
+    int n = stats->count - 1;
+    printf("%-16s %6d %8.2f %8.2f %8.2f %8.2f %8.2f\n", stats->name, stats->count,
+           v[0] / 1000.0, v[n / 2] / 1000.0, v[n * 90 / 100] / 1000.0, v[n * 99 / 100] / 1000.0, v[n] / 1000.0);
+}
+
+static void
+test_key(unsigned char key[32], unsigned char tag)
+{
+    for (int i = 0; i < 32; i++) {
+        key[i] = (unsigned char) (tag + 37 * i);
+    }
+}
+
+/* Same derivation as the server does in pairing.c */
+static void
+derive_key(const char *salt, const unsigned char secret[X25519_KEY_SIZE], unsigned char key[AES_128_BLOCK_SIZE])
+{
+    unsigned char hash[64];
+
+    sha_ctx_t *ctx = sha_init();
+    sha_update(ctx, (const uint8_t *) salt, strlen(salt));
+    sha_update(ctx, secret, X25519_KEY_SIZE);
+    sha_final(ctx, hash, NULL);
+    sha_destroy(ctx);
+    memcpy(key, hash, AES_128_BLOCK_SIZE);
+}
+
+/* Computes the sender's half of pair-verify against the server's fixed ECDH key */
+static void
+client_keys_init(client_keys_t *keys)
+{
+    unsigned char raw[32];
+    unsigned char secret[X25519_KEY_SIZE];
+    unsigned char sig_msg[2 * X25519_KEY_SIZE];
+    unsigned char server_signature[2 * X25519_KEY_SIZE] = { 0 };
+    unsigned char aes_key[AES_128_BLOCK_SIZE], aes_iv[AES_128_BLOCK_SIZE];
+
+    test_key(raw, CLIENT_IDENTITY_KEY);
+    ed25519_key_t *ed = ed25519_key_from_private_raw(raw);
+    ed25519_key_get_raw(keys->ed_public, ed);
+
+    test_key(raw, CLIENT_ECDH_KEY);
+    x25519_key_t *ecdh = x25519_key_from_private_raw(raw);
+    x25519_key_get_raw(keys->ecdh_public, ecdh);
+
+    test_key(raw, SERVER_ECDH_KEY);
+    x25519_key_t *server_private = x25519_key_from_private_raw(raw);
+    x25519_key_get_raw(keys->server_ecdh_public, server_private);
+    x25519_key_destroy(server_private);
+    x25519_key_t *server_ecdh = x25519_key_from_raw(keys->server_ecdh_public);
+    x25519_derive_secret(secret, ecdh, server_ecdh);
+
+    memcpy(sig_msg, keys->ecdh_public, X25519_KEY_SIZE);
+    memcpy(sig_msg + X25519_KEY_SIZE, keys->server_ecdh_public, X25519_KEY_SIZE);
+    ed25519_sign(keys->signature, sizeof(keys->signature), sig_msg, sizeof(sig_msg), ed);
+
+    // The server's signature went first through the same cipher stream
+    derive_key(SALT_KEY, secret, aes_key);
+    derive_key(SALT_IV, secret, aes_iv);
+    aes_ctx_t *aes_ctx = aes_ctr_init(aes_key, aes_iv);
+    aes_ctr_encrypt(aes_ctx, server_signature, server_signature, sizeof(server_signature));
+    aes_ctr_encrypt(aes_ctx, keys->signature, keys->signature, sizeof(keys->signature));
+    aes_ctr_destroy(aes_ctx);
+
+    x25519_key_destroy(server_ecdh);
+    x25519_key_destroy(ecdh);
+    ed25519_key_destroy(ed);
+}
+
+/* head holds the request line and headers, each ending in CRLF, without Content-Length */
+static int
+transcript_add(transcript_t *t, const char *head, const void *body, int body_len)
+{
+    char length[32] = "";
+
+    if (t->count == MAX_STEPS) {
+        fprintf(stderr, "Transcripts may have at most %d requests\n", MAX_STEPS);
+        return -1;
+    }
+    step_t *step = &t->steps[t->count];
+
+    if (body_len > 0) {
+        snprintf(length, sizeof(length), "Content-Length: %d\r\n", body_len);
+    }
+    int head_len = strlen(head), length_len = strlen(length);
+    step->request_len = head_len + length_len + 2 + body_len;
+    step->request = malloc(step->request_len);
+    memcpy(step->request, head, head_len);
+    memcpy(step->request + head_len, length, length_len);
+    memcpy(step->request + head_len + length_len, "\r\n", 2);
+    if (body_len > 0) {
+        memcpy(step->request + head_len + length_len + 2, body, body_len);
+    }
+
+    // Named after the path, or the method for requests on the session URL, counting repeats
+    char method[16] = "", url[64] = "";
+    sscanf(head, "%15s %63s", method, url);
+    const char *name = url[0] == '/' ? url + 1 : method;
+    int repeat = 1;
+    for (int i = 0; i < t->count; i++) {
+        if (!strncmp(t->steps[i].name, name, strlen(name)) &&
+            (t->steps[i].name[strlen(name)] == '\0' || t->steps[i].name[strlen(name)] == ' ')) {
+            repeat++;
+        }
+    }
+    if (repeat > 1) {
+        snprintf(step->name, sizeof(step->name), "%s %d", name, repeat);
+    } else {
+        snprintf(step->name, sizeof(step->name), "%s", name);
+    }
+    step->check_ecdh = !strcmp(method, "POST") && !strcmp(url, "/pair-verify") &&
+                       body_len > 0 && ((const unsigned char *) body)[0] == 1;
+    t->count++;
+    return 0;
+}
+
+static int
+transcript_add_plist(transcript_t *t, const char *head, plist_t node)
+{
+    char *data = NULL;
+    uint32_t data_len = 0;
+
+    plist_to_bin(node, &data, &data_len);
+    plist_free(node);
+    int ret = transcript_add(t, head, data, data_len);
+    free(data);
+    return ret;
+}
+
+static void
+synth_head(char *head, int size, const char *request_line, int cseq, const char *extra)
+{
+    snprintf(head, size, "%s RTSP/1.0\r\nCSeq: %d\r\n%sUser-Agent: AirPlay/381.13\r\n", request_line, cseq, extra);
+}
+
+/* The requests an iOS sender makes to start mirroring, without a device ID so that nothing is cached */
+static int
+transcript_synthesize(transcript_t *t, const client_keys_t *keys, unsigned short timing_port)
+{
+    static const unsigned char fp_setup_1[16] = {
+        0x46, 0x50, 0x4c, 0x59, 0x03, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x04, 0x02, 0x00, 0x02, 0xbb
+    };
+    static const unsigned char fp_setup_2_header[12] = {
+        0x46, 0x50, 0x4c, 0x59, 0x03, 0x01, 0x03, 0x00, 0x00, 0x00, 0x00, 0x98
+    };
+    static const unsigned char ekey_header[16] = {
+        0x46, 0x50, 0x4c, 0x59, 0x01, 0x02, 0x01, 0x00, 0x00, 0x00, 0x00, 0x3c, 0x00, 0x00, 0x00, 0x00
+    };
+    const char *binary_plist = "Content-Type: application/x-apple-binary-plist\r\n";
+    const char *octet_stream = "Content-Type: application/octet-stream\r\n";
+    const char *parameters = "Content-Type: text/parameters\r\n";
+    const char *session_url = "rtsp://127.0.0.1/2835906581461744577";
+    char head[512], request_line[128];
+    unsigned char body[164];
+    int cseq = 0, ret = 0;
+
+    synth_head(head, sizeof(head), "GET /info", cseq++, "");
+    ret |= transcript_add(t, head, NULL, 0);
+
+    synth_head(head, sizeof(head), "POST /pair-setup", cseq++, octet_stream);
+    ret |= transcript_add(t, head, keys->ed_public, ED25519_KEY_SIZE);
+
+    body[0] = 1;
+    body[1] = body[2] = body[3] = 0;
+    memcpy(body + 4, keys->ecdh_public, X25519_KEY_SIZE);
+    memcpy(body + 4 + X25519_KEY_SIZE, keys->ed_public, ED25519_KEY_SIZE);
+    synth_head(head, sizeof(head), "POST /pair-verify", cseq++, octet_stream);
+    ret |= transcript_add(t, head, body, 4 + X25519_KEY_SIZE + ED25519_KEY_SIZE);
+
+    memset(body, 0, 4);
+    memcpy(body + 4, keys->signature, sizeof(keys->signature));
+    synth_head(head, sizeof(head), "POST /pair-verify", cseq++, octet_stream);
+    ret |= transcript_add(t, head, body, 4 + sizeof(keys->signature));
+
+    synth_head(head, sizeof(head), "POST /fp-setup", cseq++, octet_stream);
+    ret |= transcript_add(t, head, fp_setup_1, sizeof(fp_setup_1));
+
+    memcpy(body, fp_setup_2_header, sizeof(fp_setup_2_header));
+    for (int i = sizeof(fp_setup_2_header); i < 164; i++) {
+        body[i] = (unsigned char) (13 * i);
+    }
+    // Continues in the mode chosen with the first message
+    body[12] = fp_setup_1[14];
+    synth_head(head, sizeof(head), "POST /fp-setup", cseq++, octet_stream);
+    ret |= transcript_add(t, head, body, 164);
+
+    unsigned char eiv[16], ekey[72];
+    for (int i = 0; i < 16; i++) {
+        eiv[i] = (unsigned char) (7 * i);
+    }
+    memcpy(ekey, ekey_header, sizeof(ekey_header));
+    for (int i = sizeof(ekey_header); i < 72; i++) {
+        ekey[i] = (unsigned char) (11 * i);
+    }
+    plist_t setup = plist_new_dict();
+    plist_dict_set_item(setup, "eiv", plist_new_data((const char *) eiv, sizeof(eiv)));
+    plist_dict_set_item(setup, "ekey", plist_new_data((const char *) ekey, sizeof(ekey)));
+    plist_dict_set_item(setup, "timingPort", plist_new_uint(timing_port));
+    plist_dict_set_item(setup, "timingProtocol", plist_new_string("NTP"));
+    plist_dict_set_item(setup, "isScreenMirroringSession", plist_new_bool(1));
+    plist_dict_set_item(setup, "sessionUUID", plist_new_string("5F1B3B1C-6E0A-4C39-9C2A-3A6F1B2E7D40"));
+    plist_dict_set_item(setup, "name", plist_new_string("rtsp_bench"));
+    plist_dict_set_item(setup, "model", plist_new_string("iPhone10,6"));
+    plist_dict_set_item(setup, "sourceVersion", plist_new_string("381.13"));
+    snprintf(request_line, sizeof(request_line), "SETUP %s", session_url);
+    synth_head(head, sizeof(head), request_line, cseq++, binary_plist);
+    ret |= transcript_add_plist(t, head, setup);
+
+    plist_t streams = plist_new_array();
+    plist_t stream = plist_new_dict();
+    plist_dict_set_item(stream, "type", plist_new_uint(110));
+    plist_dict_set_item(stream, "streamConnectionID", plist_new_uint(0x1b2c3d4e5f607182ull));
+    plist_dict_set_item(stream, "timestampInfo", plist_new_array());
+    plist_array_append_item(streams, stream);
+    setup = plist_new_dict();
+    plist_dict_set_item(setup, "streams", streams);
+    synth_head(head, sizeof(head), request_line, cseq++, binary_plist);
+    ret |= transcript_add_plist(t, head, setup);
+
+    snprintf(request_line, sizeof(request_line), "RECORD %s", session_url);
+    synth_head(head, sizeof(head), request_line, cseq++, "");
+    ret |= transcript_add(t, head, NULL, 0);
+
+    snprintf(request_line, sizeof(request_line), "GET_PARAMETER %s", session_url);
+    synth_head(head, sizeof(head), request_line, cseq++, parameters);
+    ret |= transcript_add(t, head, "volume\r\n", 8);
+
+    const char volume[] = "volume: -11.123456\r\n";
+    snprintf(request_line, sizeof(request_line), "SET_PARAMETER %s", session_url);
+    synth_head(head, sizeof(head), request_line, cseq++, parameters);
+    ret |= transcript_add(t, head, volume, strlen(volume));
+
+    snprintf(request_line, sizeof(request_line), "FLUSH %s", session_url);
+    synth_head(head, sizeof(head), request_line, cseq++, "RTP-Info: seq=0;rtptime=0\r\n");
+    ret |= transcript_add(t, head, NULL, 0);
+
+    return ret ? -1 : 0;
+}
+
+static int
+find_header_end(const char *data, int len)
+{
+    for (int i = 0; i + 4 <= len; i++) {
+        if (!memcmp(data + i, "\r\n\r\n", 4)) {
+            return i + 4;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Reads the sender's half of a recorded session, the requests back to back as
+ * they went over the wire. The sender's pairing messages are replaced with our
+ * own, which fit the server's test keys, and the timing port with ours.
+ */
+static int
+transcript_load(transcript_t *t, const char *path, const client_keys_t *keys, unsigned short timing_port)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *data = malloc(size + 1);
+    if (fread(data, 1, size, file) != (size_t) size) {
+        fprintf(stderr, "Could not read %s\n", path);
+        fclose(file);
+        free(data);
+        return -1;
+    }
+    fclose(file);
+
+    int pos = 0, ret = 0;
+    while (pos < size && !ret) {
+        int head_len = find_header_end(data + pos, size - pos);
+        if (head_len < 0) {
+            fprintf(stderr, "Incomplete request at offset %d of %s\n", pos, path);
+            ret = -1;
+            break;
+        }
+
+        // Copy the headers but Content-Length, which is added again for the body we send
+        char *head = calloc(1, head_len + 1);
+        int body_len = 0, out = 0;
+        const char *line = data + pos;
+        const char *end = data + pos + head_len - 2;
+        while (line < end) {
+            const char *next = line;
+            while (next < end && !(next[0] == '\r' && next[1] == '\n')) next++;
+            next += 2;
+            if (!strncasecmp(line, "Content-Length:", 15)) {
+                body_len = atoi(line + 15);
+            } else {
+                memcpy(head + out, line, next - line);
+                out += next - line;
+            }
+            line = next;
+        }
+        if (body_len < 0 || body_len > size - pos - head_len) {
+            fprintf(stderr, "Truncated request body at offset %d of %s\n", pos, path);
+            free(head);
+            ret = -1;
+            break;
+        }
+        const unsigned char *body = (const unsigned char *) data + pos + head_len;
+        pos += head_len + body_len;
+
+        unsigned char pairing[4 + 2 * X25519_KEY_SIZE];
+        if (!strncmp(head, "POST /pair-setup ", 17) && body_len == ED25519_KEY_SIZE) {
+            ret = transcript_add(t, head, keys->ed_public, ED25519_KEY_SIZE);
+        } else if (!strncmp(head, "POST /pair-verify ", 18) && body_len == sizeof(pairing) && body[0] == 1) {
+            memcpy(pairing, body, 4);
+            memcpy(pairing + 4, keys->ecdh_public, X25519_KEY_SIZE);
+            memcpy(pairing + 4 + X25519_KEY_SIZE, keys->ed_public, ED25519_KEY_SIZE);
+            ret = transcript_add(t, head, pairing, sizeof(pairing));
+        } else if (!strncmp(head, "POST /pair-verify ", 18) && body_len == sizeof(pairing) && body[0] == 0) {
+            memcpy(pairing, body, 4);
+            memcpy(pairing + 4, keys->signature, sizeof(keys->signature));
+            ret = transcript_add(t, head, pairing, sizeof(pairing));
+        } else if (!strncmp(head, "SETUP ", 6) && body_len > 8 && !memcmp(body, "bplist00", 8)) {
+            plist_t setup = NULL;
+            plist_from_bin((const char *) body, body_len, &setup);
+            if (setup && plist_dict_get_item(setup, "timingPort")) {
+                plist_dict_set_item(setup, "timingPort", plist_new_uint(timing_port));
+                ret = transcript_add_plist(t, head, setup);
+            } else {
+                plist_free(setup);
+                ret = transcript_add(t, head, body, body_len);
+            }
+        } else {
+            ret = transcript_add(t, head, body, body_len);
+        }
+        free(head);
+    }
+    free(data);
+
+    if (!ret && t->count == 0) {
+        fprintf(stderr, "No requests in %s\n", path);
+        ret = -1;
+    }
+    return ret;
+}
+
+/* Answers the server's clock sync requests like a sender would */
+static THREAD_RETVAL
+timing_thread(void *arg)
+{
+    bench_t *bench = arg;
+    unsigned char packet[128], reply[32];
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+
+    while (1) {
+        MUTEX_LOCK(bench->mutex);
+        int running = bench->timing_running;
+        MUTEX_UNLOCK(bench->mutex);
+        if (!running) {
+            break;
+        }
+
+        addr_len = sizeof(addr);
+        int len = recvfrom(bench->timing_fd, packet, sizeof(packet), 0, (struct sockaddr *) &addr, &addr_len);
+        if (len < 32) {
+            continue;
+        }
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        uint64_t now = (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+        memset(reply, 0, sizeof(reply));
+        reply[0] = 0x80;
+        reply[1] = 0xd3;
+        reply[3] = 0x07;
+        memcpy(reply + 8, packet + 24, 8);
+        byteutils_put_ntp_timestamp(reply, 16, now);
+        byteutils_put_ntp_timestamp(reply, 24, now);
+        sendto(bench->timing_fd, reply, sizeof(reply), 0, (struct sockaddr *) &addr, addr_len);
+    }
+    return 0;
+}
+
+static int
+timing_start(bench_t *bench)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    struct timeval tv = { 0, 100000 };
+
+    bench->timing_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (bench->timing_fd < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(bench->timing_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        getsockname(bench->timing_fd, (struct sockaddr *) &addr, &addr_len) < 0 ||
+        setsockopt(bench->timing_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
+        close(bench->timing_fd);
+        return -1;
+    }
+    bench->timing_port = ntohs(addr.sin_port);
+    bench->timing_running = 1;
+    THREAD_CREATE(bench->timing_thread, timing_thread, bench);
+    return 0;
+}
+
+static void
+timing_stop(bench_t *bench)
+{
+    MUTEX_LOCK(bench->mutex);
+    bench->timing_running = 0;
+    MUTEX_UNLOCK(bench->mutex);
+    THREAD_JOIN(bench->timing_thread);
+    close(bench->timing_fd);
+}
+
+static int
+send_all(int fd, const char *data, int len)
+{
+    while (len > 0) {
+        ssize_t ret = send(fd, data, len, MSG_NOSIGNAL);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) return -1;
+        data += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+/* Reads one response into buffer, returns the status code or -1 */
+static int
+read_response(int fd, char *buffer, int size, const char **body, int *body_len)
+{
+    int len = 0, head_len = -1, content_length = 0;
+
+    while (head_len < 0 || len < head_len + content_length) {
+        if (len == size) {
+            return -1;
+        }
+        ssize_t ret = recv(fd, buffer + len, size - len, 0);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) return -1;
+        len += ret;
+
+        if (head_len < 0 && (head_len = find_header_end(buffer, len)) >= 0) {
+            for (const char *line = buffer; line < buffer + head_len; line++) {
+                if (line[0] == '\n' && !strncasecmp(line + 1, "Content-Length:", 15)) {
+                    content_length = atoi(line + 16);
+                }
+            }
+        }
+    }
+    // Everything is sent one request at a time, so nothing may follow the response
+    if (len != head_len + content_length) {
+        return -1;
+    }
+
+    int status;
+    if (sscanf(buffer, "RTSP/1.0 %d", &status) != 1) {
+        return -1;
+    }
+    *body = buffer + head_len;
+    *body_len = content_length;
+    return status;
+}
+
+static void
+bench_set_error(bench_t *bench, const char *step, const char *reason)
+{
+    MUTEX_LOCK(bench->mutex);
+    if (!bench->error[0]) {
+        snprintf(bench->error, sizeof(bench->error), "%s: %s", step, reason);
+    }
+    MUTEX_UNLOCK(bench->mutex);
+}
+
+/* Goes through the transcript on a new connection, durations get the time of every request */
+static int
+bench_connection(bench_t *bench, char *buffer, int64_t *connect_time, int64_t *durations)
+{
+    transcript_t *t = &bench->transcript;
+    struct sockaddr_in addr;
+    struct timeval tv = { IO_TIMEOUT, 0 };
+    int one = 1;
+
+    int64_t start = now_us();
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        bench_set_error(bench, "connect", strerror(errno));
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(bench->port);
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        bench_set_error(bench, "connect", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    *connect_time = now_us() - start;
+
+    for (int i = 0; i < t->count; i++) {
+        step_t *step = &t->steps[i];
+        const char *body;
+        int body_len;
+
+        start = now_us();
+        if (send_all(fd, step->request, step->request_len) < 0) {
+            bench_set_error(bench, step->name, "could not send the request");
+            close(fd);
+            return -1;
+        }
+        int status = read_response(fd, buffer, MAX_RESPONSE, &body, &body_len);
+        durations[i] = now_us() - start;
+
+        if (status < 0) {
+            bench_set_error(bench, step->name, "no valid response, the server may have closed the connection");
+            close(fd);
+            return -1;
+        }
+        if (status != 200) {
+            char reason[32];
+            snprintf(reason, sizeof(reason), "status %d", status);
+            bench_set_error(bench, step->name, reason);
+            close(fd);
+            return -1;
+        }
+        if (step->check_ecdh && (body_len < X25519_KEY_SIZE ||
+                                 memcmp(body, bench->keys.server_ecdh_public, X25519_KEY_SIZE))) {
+            bench_set_error(bench, step->name, "the server does not use the test keys");
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+static THREAD_RETVAL
+bench_thread(void *arg)
+{
+    bench_t *bench = arg;
+    int64_t durations[MAX_STEPS];
+    int64_t connect_time;
+    char *buffer = malloc(MAX_RESPONSE);
+
+    while (1) {
+        MUTEX_LOCK(bench->mutex);
+        if (bench->next_connection == bench->connections) {
+            MUTEX_UNLOCK(bench->mutex);
+            break;
+        }
+        bench->next_connection++;
+        MUTEX_UNLOCK(bench->mutex);
+
+        int64_t start = now_us();
+        int ret = bench_connection(bench, buffer, &connect_time, durations);
+        int64_t total = now_us() - start;
+
+        MUTEX_LOCK(bench->mutex);
+        if (ret < 0) {
+            bench->failures++;
+        } else {
+            stats_add(&bench->connect_stats, connect_time);
+            for (int i = 0; i < bench->transcript.count; i++) {
+                stats_add(&bench->step_stats[i], durations[i]);
+            }
+            stats_add(&bench->total_stats, total);
+        }
+        MUTEX_UNLOCK(bench->mutex);
+    }
+    free(buffer);
+    return 0;
+}
+
+static void
+bench_audio_process(void *cls, raop_ntp_t *ntp, aac_decode_struct *data)
+{
+}
+
+static void
+bench_video_process(void *cls, raop_ntp_t *ntp, h264_decode_struct *data)
+{
+}
+
+static void
+bench_video_flush(void *cls)
+{
+}
+
+static void
+print_usage(const char *argv0)
+{
+    printf("Usage: %s [-n connections] [-c concurrency] [-r file] [-d]\n", argv0);
+    printf("-n connections Number of connections to set up, default %d\n", DEFAULT_CONNECTIONS);
+    printf("-c concurrency Connections set up at the same time, default %d, at most %d\n",
+           DEFAULT_CONCURRENCY, MAX_CONCURRENCY);
+    printf("-r file        Replay the requests recorded in file instead of the built-in ones\n");
+    printf("-d             Enable the server's debug logging\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    bench_t bench;
+    int concurrency = DEFAULT_CONCURRENCY;
+    const char *recording = NULL;
+    int debug = 0;
+
+    memset(&bench, 0, sizeof(bench));
+    bench.connections = DEFAULT_CONNECTIONS;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            bench.connections = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+            concurrency = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            recording = argv[++i];
+        } else if (!strcmp(argv[i], "-d")) {
+            debug = 1;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (bench.connections < 1 || concurrency < 1 || concurrency > MAX_CONCURRENCY) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (concurrency > bench.connections) {
+        concurrency = bench.connections;
+    }
+
+    MUTEX_CREATE(bench.mutex);
+    client_keys_init(&bench.keys);
+    if (timing_start(&bench) < 0) {
+        fprintf(stderr, "Could not open the timing socket\n");
+        return 1;
+    }
+    if (recording ? transcript_load(&bench.transcript, recording, &bench.keys, bench.timing_port) :
+                    transcript_synthesize(&bench.transcript, &bench.keys, bench.timing_port)) {
+        return 1;
+    }
+
+    raop_callbacks_t callbacks;
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.cls = &bench;
+    callbacks.audio_process = bench_audio_process;
+    callbacks.video_process = bench_video_process;
+    callbacks.video_flush = bench_video_flush;
+
+    unsigned char identity_seed[32], ecdh_key[32];
+    test_key(identity_seed, SERVER_IDENTITY_KEY);
+    test_key(ecdh_key, SERVER_ECDH_KEY);
+    const char hw_addr[] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    int error;
+
+    // Leave room for connections that are still being torn down
+    raop_t *raop = raop_init(concurrency + concurrency / 2 + 1, &callbacks);
+    dnssd_t *dnssd = raop ? dnssd_init("rtsp_bench", strlen("rtsp_bench"), hw_addr, sizeof(hw_addr), 1, &error) : NULL;
+    if (!raop || !dnssd || raop_set_test_keys(raop, identity_seed, ecdh_key) < 0) {
+        fprintf(stderr, "Could not initialize raop\n");
+        return 1;
+    }
+    raop_set_log_level(raop, debug ? RAOP_LOG_DEBUG : RAOP_LOG_ERR);
+    raop_set_dnssd(raop, dnssd);
+    if (raop_start(raop, &bench.port) < 0) {
+        fprintf(stderr, "Could not start raop\n");
+        return 1;
+    }
+    raop_set_port(raop, bench.port);
+
+    stats_init(&bench.connect_stats, "connect", bench.connections);
+    for (int i = 0; i < bench.transcript.count; i++) {
+        stats_init(&bench.step_stats[i], bench.transcript.steps[i].name, bench.connections);
+    }
+    stats_init(&bench.total_stats, "total", bench.connections);
+
+    printf("Setting up %d connections with %d requests each, %d at a time%s\n", bench.connections,
+           bench.transcript.count, concurrency, recording ? ", replaying the recording" : "");
+    thread_handle_t *threads = calloc(concurrency, sizeof(thread_handle_t));
+    int64_t start = now_us();
+    for (int i = 0; i < concurrency; i++) {
+        THREAD_CREATE(threads[i], bench_thread, &bench);
+    }
+    for (int i = 0; i < concurrency; i++) {
+        THREAD_JOIN(threads[i]);
+    }
+    int64_t elapsed = now_us() - start;
+
+    raop_destroy(raop);
+    dnssd_destroy(dnssd);
+    timing_stop(&bench);
+
+    printf("\n%-16s %6s %8s %8s %8s %8s %8s\n", "request (ms)", "count", "min", "p50", "p90", "p99", "max");
+    stats_print(&bench.connect_stats);
+    for (int i = 0; i < bench.transcript.count; i++) {
+        stats_print(&bench.step_stats[i]);
+    }
+    stats_print(&bench.total_stats);
+    printf("\n%d of %d connections set up, %.1f per second\n", bench.connections - bench.failures,
+           bench.connections, (bench.connections - bench.failures) * 1000000.0 / elapsed);
+    if (bench.failures) {
+        printf("%d failed, the first at %s\n", bench.failures, bench.error);
+    }
+
+    for (int i = 0; i < bench.transcript.count; i++) {
+        free(bench.transcript.steps[i].request);
+    }
+    free(threads);
+    MUTEX_DESTROY(bench.mutex);
+    return bench.failures ? 1 : 0;
+}